@@ -39,13 +39,14 @@
 #define kUnitsRadiansPerSecond "rad/sec"
 #define kUnitsPascal "pa"
 #define kUnitsMilliseconds "ms"
+#define kUnitsSeconds "s"
 
 #define kGroupPosition "Position"
 #define kChannelSpeed "Speed"
 #define kChannelPitch "Pitch"
 #define kChannelRoll "Roll"
-#define kChannelTime "Time"
 #define kChannelDistance "Distance"
+#define kChannelLapDelta "Lap Delta"
 
 #define kGroupAcceleration "Acceleration"
 #define kChannelAccelerationX "Acceleration X"
@@ -80,6 +81,8 @@
 #define kChannelTemperatureLeft "Temperature Left"
 #define kChannelTemperatureCenter "Temperature Center"
 #define kChannelTemperatureRight "Temperature Right"
+#define kChannelGripFraction "Grip Fraction"
+#define kChannelWear "Wear"
 
 #define kNumberOfWheels 4
 static std::string kWheels[] = {
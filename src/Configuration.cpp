@@ -34,6 +34,19 @@ Configuration::Configuration(void)
   mConfiguration[kConfigurationOutputDirectory] = kDefaultOutputDirectory;
   mConfiguration[kConfigurationFilename] = kDefaultFilename;
   mConfiguration[kConfigurationRequireOneLap] = kDefaultRequireOneLap;
+  mConfiguration[kConfigurationSharedMemory] = kDefaultSharedMemory;
+  mConfiguration[kConfigurationSharedMemoryName] = kDefaultSharedMemoryName;
+  mConfiguration[kConfigurationStream] = kDefaultStream;
+  mConfiguration[kConfigurationStreamAddress] = kDefaultStreamAddress;
+  mConfiguration[kConfigurationStreamBatch] = kDefaultStreamBatch;
+  mConfiguration[kConfigurationProfile] = kDefaultProfile;
+  mConfiguration[kConfigurationProfileMetadata] = kDefaultProfileMetadata;
+  mConfiguration[kConfigurationTrace] = kDefaultTrace;
+  mConfiguration[kConfigurationTraceEvents] = kDefaultTraceEvents;
+  mConfiguration[kConfigurationTrackMap] = kDefaultTrackMap;
+  mConfiguration[kConfigurationTrackMapDirectory] = kDefaultTrackMapDirectory;
+  mConfiguration[kConfigurationRunLengthEncoding] = kDefaultRunLengthEncoding;
+  mConfiguration[kConfigurationTolerances] = kDefaultTolerances;
 }
 
 Configuration::~Configuration(void)
@@ -27,12 +27,39 @@
 #define kConfigurationOutputDirectory "OutputDirectory"
 #define kConfigurationFilename "Filename"
 #define kConfigurationRequireOneLap "RequireOneLap"
+#define kConfigurationSharedMemory "SharedMemory"
+#define kConfigurationSharedMemoryName "SharedMemoryName"
+#define kConfigurationStream "Stream"
+#define kConfigurationStreamAddress "StreamAddress"
+#define kConfigurationStreamBatch "StreamBatch"
+#define kConfigurationProfile "Profile"
+#define kConfigurationProfileMetadata "ProfileMetadata"
+#define kConfigurationTrace "Trace"
+#define kConfigurationTraceEvents "TraceEvents"
+#define kConfigurationTrackMap "TrackMap"
+#define kConfigurationTrackMapDirectory "TrackMapDirectory"
+#define kConfigurationRunLengthEncoding "RunLengthEncoding"
+#define kConfigurationTolerances "Tolerances"
 
 #define kDefaultFilename "%Y%M%D%H%M_%d_%c_%t.om"
 #define kDefaultSampleInterval "200"
 #define kDefaultOutputDirectory ".\\UserData\\LOG\\OpenMotorsport\\"
 #define kDefaultConfigurationFile "OpenMotorsport.xml"
 #define kDefaultRequireOneLap "True"
+#define kDefaultSharedMemory "False"
+#define kDefaultSharedMemoryName "Local\\OpenMotorsportTelemetry"
+#define kDefaultStream "False"
+#define kDefaultStreamAddress "127.0.0.1:7788"
+#define kDefaultStreamBatch "5"
+#define kDefaultProfile "True"
+#define kDefaultProfileMetadata "False"
+#define kDefaultTrace "False"
+#define kDefaultTraceEvents "65536"
+#define kDefaultTrackMap "True"
+#define kDefaultTrackMapDirectory ".\\UserData\\LOG\\OpenMotorsport\\Maps\\"
+#define kDefaultRunLengthEncoding "True"
+#define kDefaultTolerances "Brake Temperature=0.5;Temperature Left=0.5;" \
+  "Temperature Center=0.5;Temperature Right=0.5;Pressure=0.5;Fuel=0.01"
 
 #include <string>
 #include <unordered_map>
@@ -0,0 +1,417 @@
+/*
+  Martin Galpin (m@66laps.com)
+  
+  Copyright (c) 2010 66laps Limited. All rights reserved.
+  
+  This file is part of rFactor-OpenMotorsport.
+  
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+  
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#include <math.h>
+
+#include "DerivedChannels.hpp"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define DERIVED_HAS_SSE2
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+// AVX intrinsics need Visual Studio 2012 or GCC (with a per-function target)
+#if defined(DERIVED_HAS_SSE2) && \
+  ((defined(_MSC_VER) && _MSC_VER >= 1700) || defined(__GNUC__))
+#define DERIVED_HAS_AVX
+#include <immintrin.h>
+#ifdef __GNUC__
+#define DERIVED_TARGET_AVX __attribute__((target("avx")))
+#else
+#define DERIVED_TARGET_AVX
+#endif
+#endif
+
+#define kRadiansToDegrees 57.296f
+#define kHalfPi 1.57079633f
+
+// Minimax coefficients of atan(a) / a in a * a over [0, 1]
+#define kAtan1 0.99997726f
+#define kAtan3 -0.33262347f
+#define kAtan5 0.19354346f
+#define kAtan7 -0.11643287f
+#define kAtan9 0.05265332f
+#define kAtan11 -0.01172120f
+
+typedef void (*MagnitudeKernel)(const float* x, const float* y, const float* z,
+  size_t count, float scale, float* output);
+typedef void (*InclinationKernel)(const float* x, const float* y, 
+  const float* z, size_t count, float sign, float* output);
+typedef void (*StepKernel)(const float* x, const float* y, const float* z,
+  size_t count, float* output);
+
+/****************************************************************************/
+/* Scalar kernels.                                                          */
+/****************************************************************************/
+
+// atan2(y, x) for x >= 0, which is all an inclination needs
+static float FastAtan2(float y, float x)
+{
+  float ay = fabsf(y);
+  float hi = ay > x ? ay : x;
+  float lo = ay > x ? x : ay;
+  if(hi == 0.0f) return 0.0f;
+  float a = lo / hi;
+  float s = a * a;
+  float r = a * (kAtan1 + s * (kAtan3 + s * (kAtan5 + s * (kAtan7 +
+    s * (kAtan9 + s * kAtan11)))));
+  if(ay > x) r = kHalfPi - r;
+  return y < 0.0f ? -r : r;
+}
+
+static void MagnitudeScalar(const float* x, const float* y, const float* z,
+                            size_t count, float scale, float* output)
+{
+  for(size_t i = 0; i < count; ++i)
+    output[i] = sqrtf(x[i] * x[i] + y[i] * y[i] + z[i] * z[i]) * scale;
+}
+
+static void InclinationScalar(const float* x, const float* y, const float* z,
+                              size_t count, float sign, float* output)
+{
+  for(size_t i = 0; i < count; ++i) {
+    output[i] = FastAtan2(sign * y[i], sqrtf(x[i] * x[i] + z[i] * z[i])) *
+      kRadiansToDegrees;
+  }
+}
+
+// output[i] = |p[i] - p[i - 1]| for i >= 1 (output[0] is left alone)
+static void StepScalar(const float* x, const float* y, const float* z,
+                       size_t count, float* output)
+{
+  for(size_t i = 1; i < count; ++i) {
+    float dx = x[i] - x[i - 1];
+    float dy = y[i] - y[i - 1];
+    float dz = z[i] - z[i - 1];
+    output[i] = sqrtf(dx * dx + dy * dy + dz * dz);
+  }
+}
+
+/****************************************************************************/
+/* SSE2 kernels (four lanes).                                               */
+/****************************************************************************/
+
+#ifdef DERIVED_HAS_SSE2
+static __m128 FastAtan2SSE2(__m128 y, __m128 x)
+{
+  const __m128 signMask = _mm_set1_ps(-0.0f);
+  __m128 ay = _mm_andnot_ps(signMask, y);
+  __m128 hi = _mm_max_ps(ay, x);
+  __m128 lo = _mm_min_ps(ay, x);
+  __m128 nonZero = _mm_cmpgt_ps(hi, _mm_setzero_ps());
+  __m128 a = _mm_and_ps(_mm_div_ps(lo, hi), nonZero); // 0 / 0 gives 0
+  __m128 s = _mm_mul_ps(a, a);
+  __m128 r = _mm_add_ps(_mm_set1_ps(kAtan9), _mm_mul_ps(s, _mm_set1_ps(kAtan11)));
+  r = _mm_add_ps(_mm_set1_ps(kAtan7), _mm_mul_ps(s, r));
+  r = _mm_add_ps(_mm_set1_ps(kAtan5), _mm_mul_ps(s, r));
+  r = _mm_add_ps(_mm_set1_ps(kAtan3), _mm_mul_ps(s, r));
+  r = _mm_add_ps(_mm_set1_ps(kAtan1), _mm_mul_ps(s, r));
+  r = _mm_mul_ps(a, r);
+  __m128 swapped = _mm_cmpgt_ps(ay, x);
+  r = _mm_or_ps(_mm_and_ps(swapped, _mm_sub_ps(_mm_set1_ps(kHalfPi), r)),
+                _mm_andnot_ps(swapped, r));
+  return _mm_or_ps(r, _mm_and_ps(signMask, y));
+}
+
+static void MagnitudeSSE2(const float* x, const float* y, const float* z,
+                          size_t count, float scale, float* output)
+{
+  __m128 vscale = _mm_set1_ps(scale);
+  size_t i = 0;
+  for(; i + 4 <= count; i += 4) {
+    __m128 vx = _mm_loadu_ps(x + i);
+    __m128 vy = _mm_loadu_ps(y + i);
+    __m128 vz = _mm_loadu_ps(z + i);
+    __m128 sum = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)),
+      _mm_mul_ps(vz, vz));
+    _mm_storeu_ps(output + i, _mm_mul_ps(_mm_sqrt_ps(sum), vscale));
+  }
+  MagnitudeScalar(x + i, y + i, z + i, count - i, scale, output + i);
+}
+
+static void InclinationSSE2(const float* x, const float* y, const float* z,
+                            size_t count, float sign, float* output)
+{
+  __m128 vsign = _mm_set1_ps(sign);
+  __m128 degrees = _mm_set1_ps(kRadiansToDegrees);
+  size_t i = 0;
+  for(; i + 4 <= count; i += 4) {
+    __m128 vx = _mm_loadu_ps(x + i);
+    __m128 vy = _mm_mul_ps(_mm_loadu_ps(y + i), vsign);
+    __m128 vz = _mm_loadu_ps(z + i);
+    __m128 r = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vz, vz)));
+    _mm_storeu_ps(output + i, _mm_mul_ps(FastAtan2SSE2(vy, r), degrees));
+  }
+  InclinationScalar(x + i, y + i, z + i, count - i, sign, output + i);
+}
+
+static void StepSSE2(const float* x, const float* y, const float* z,
+                     size_t count, float* output)
+{
+  size_t i = 1;
+  for(; i + 4 <= count; i += 4) {
+    __m128 dx = _mm_sub_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(x + i - 1));
+    __m128 dy = _mm_sub_ps(_mm_loadu_ps(y + i), _mm_loadu_ps(y + i - 1));
+    __m128 dz = _mm_sub_ps(_mm_loadu_ps(z + i), _mm_loadu_ps(z + i - 1));
+    __m128 sum = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)),
+      _mm_mul_ps(dz, dz));
+    _mm_storeu_ps(output + i, _mm_sqrt_ps(sum));
+  }
+  if(i < count)
+    StepScalar(x + i - 1, y + i - 1, z + i - 1, count - i + 1, output + i - 1);
+}
+#endif
+
+/****************************************************************************/
+/* AVX kernels (eight lanes).                                               */
+/****************************************************************************/
+
+#ifdef DERIVED_HAS_AVX
+DERIVED_TARGET_AVX
+static __m256 FastAtan2AVX(__m256 y, __m256 x)
+{
+  const __m256 signMask = _mm256_set1_ps(-0.0f);
+  __m256 ay = _mm256_andnot_ps(signMask, y);
+  __m256 hi = _mm256_max_ps(ay, x);
+  __m256 lo = _mm256_min_ps(ay, x);
+  __m256 nonZero = _mm256_cmp_ps(hi, _mm256_setzero_ps(), _CMP_GT_OQ);
+  __m256 a = _mm256_and_ps(_mm256_div_ps(lo, hi), nonZero);
+  __m256 s = _mm256_mul_ps(a, a);
+  __m256 r = _mm256_add_ps(_mm256_set1_ps(kAtan9),
+    _mm256_mul_ps(s, _mm256_set1_ps(kAtan11)));
+  r = _mm256_add_ps(_mm256_set1_ps(kAtan7), _mm256_mul_ps(s, r));
+  r = _mm256_add_ps(_mm256_set1_ps(kAtan5), _mm256_mul_ps(s, r));
+  r = _mm256_add_ps(_mm256_set1_ps(kAtan3), _mm256_mul_ps(s, r));
+  r = _mm256_add_ps(_mm256_set1_ps(kAtan1), _mm256_mul_ps(s, r));
+  r = _mm256_mul_ps(a, r);
+  __m256 swapped = _mm256_cmp_ps(ay, x, _CMP_GT_OQ);
+  r = _mm256_or_ps(_mm256_and_ps(swapped, _mm256_sub_ps(_mm256_set1_ps(kHalfPi), r)),
+                   _mm256_andnot_ps(swapped, r));
+  return _mm256_or_ps(r, _mm256_and_ps(signMask, y));
+}
+
+DERIVED_TARGET_AVX
+static void MagnitudeAVX(const float* x, const float* y, const float* z,
+                         size_t count, float scale, float* output)
+{
+  __m256 vscale = _mm256_set1_ps(scale);
+  size_t i = 0;
+  for(; i + 8 <= count; i += 8) {
+    __m256 vx = _mm256_loadu_ps(x + i);
+    __m256 vy = _mm256_loadu_ps(y + i);
+    __m256 vz = _mm256_loadu_ps(z + i);
+    __m256 sum = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vx, vx), 
+      _mm256_mul_ps(vy, vy)), _mm256_mul_ps(vz, vz));
+    _mm256_storeu_ps(output + i, _mm256_mul_ps(_mm256_sqrt_ps(sum), vscale));
+  }
+  _mm256_zeroupper();
+  MagnitudeSSE2(x + i, y + i, z + i, count - i, scale, output + i);
+}
+
+DERIVED_TARGET_AVX
+static void InclinationAVX(const float* x, const float* y, const float* z,
+                           size_t count, float sign, float* output)
+{
+  __m256 vsign = _mm256_set1_ps(sign);
+  __m256 degrees = _mm256_set1_ps(kRadiansToDegrees);
+  size_t i = 0;
+  for(; i + 8 <= count; i += 8) {
+    __m256 vx = _mm256_loadu_ps(x + i);
+    __m256 vy = _mm256_mul_ps(_mm256_loadu_ps(y + i), vsign);
+    __m256 vz = _mm256_loadu_ps(z + i);
+    __m256 r = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(vx, vx), 
+      _mm256_mul_ps(vz, vz)));
+    _mm256_storeu_ps(output + i, _mm256_mul_ps(FastAtan2AVX(vy, r), degrees));
+  }
+  _mm256_zeroupper();
+  InclinationSSE2(x + i, y + i, z + i, count - i, sign, output + i);
+}
+
+DERIVED_TARGET_AVX
+static void StepAVX(const float* x, const float* y, const float* z,
+                    size_t count, float* output)
+{
+  size_t i = 1;
+  for(; i + 8 <= count; i += 8) {
+    __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(x + i - 1));
+    __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(y + i), _mm256_loadu_ps(y + i - 1));
+    __m256 dz = _mm256_sub_ps(_mm256_loadu_ps(z + i), _mm256_loadu_ps(z + i - 1));
+    __m256 sum = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), 
+      _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz));
+    _mm256_storeu_ps(output + i, _mm256_sqrt_ps(sum));
+  }
+  _mm256_zeroupper();
+  if(i < count)
+    StepSSE2(x + i - 1, y + i - 1, z + i - 1, count - i + 1, output + i - 1);
+}
+#endif
+
+/****************************************************************************/
+/* Run time dispatch.                                                       */
+/****************************************************************************/
+
+static DerivedKernelLevel DetectKernelLevel()
+{
+  DerivedKernelLevel level = kDerivedKernelScalar;
+#ifdef DERIVED_HAS_SSE2
+  unsigned int ecx, edx;
+#ifdef _MSC_VER
+  int info[4];
+  __cpuid(info, 1);
+  ecx = (unsigned int) info[2];
+  edx = (unsigned int) info[3];
+#else
+  unsigned int eax, ebx;
+  if(!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return level;
+#endif
+  if(edx & (1 << 26))
+    level = kDerivedKernelSSE2;
+#ifdef DERIVED_HAS_AVX
+  // AVX needs both the CPU (bit 28) and the OS saving its registers (XCR0)
+  if((ecx & (1 << 27)) && (ecx & (1 << 28))) {
+#ifdef _MSC_VER
+    unsigned long long xcr0 = _xgetbv(0);
+#else
+    unsigned int xlo, xhi;
+    __asm__ ("xgetbv" : "=a" (xlo), "=d" (xhi) : "c" (0));
+    unsigned long long xcr0 = ((unsigned long long) xhi << 32) | xlo;
+#endif
+    if((xcr0 & 6) == 6)
+      level = kDerivedKernelAVX;
+  }
+#endif
+#endif
+  return level;
+}
+
+static DerivedKernelLevel sSupportedLevel = DetectKernelLevel();
+static DerivedKernelLevel sLevel = sSupportedLevel;
+
+DerivedKernelLevel GetDerivedKernelLevel()
+{
+  return sSupportedLevel;
+}
+
+void SetDerivedKernelLevel(DerivedKernelLevel level)
+{
+  sLevel = level < sSupportedLevel ? level : sSupportedLevel;
+}
+
+static MagnitudeKernel GetMagnitudeKernel()
+{
+#ifdef DERIVED_HAS_AVX
+  if(sLevel >= kDerivedKernelAVX) return MagnitudeAVX;
+#endif
+#ifdef DERIVED_HAS_SSE2
+  if(sLevel >= kDerivedKernelSSE2) return MagnitudeSSE2;
+#endif
+  return MagnitudeScalar;
+}
+
+static InclinationKernel GetInclinationKernel()
+{
+#ifdef DERIVED_HAS_AVX
+  if(sLevel >= kDerivedKernelAVX) return InclinationAVX;
+#endif
+#ifdef DERIVED_HAS_SSE2
+  if(sLevel >= kDerivedKernelSSE2) return InclinationSSE2;
+#endif
+  return InclinationScalar;
+}
+
+static StepKernel GetStepKernel()
+{
+#ifdef DERIVED_HAS_AVX
+  if(sLevel >= kDerivedKernelAVX) return StepAVX;
+#endif
+#ifdef DERIVED_HAS_SSE2
+  if(sLevel >= kDerivedKernelSSE2) return StepSSE2;
+#endif
+  return StepScalar;
+}
+
+/****************************************************************************/
+/* Derived functions.                                                       */
+/****************************************************************************/
+
+void ScaleFunction::Evaluate(const float* const* inputs, size_t count,
+                             float* output) const
+{
+  // simple enough for the compiler to vectorise
+  const float* x = inputs[0];
+  for(size_t i = 0; i < count; ++i)
+    output[i] = x[i] * mScale;
+}
+
+void MagnitudeFunction::Evaluate(const float* const* inputs, size_t count,
+                                 float* output) const
+{
+  GetMagnitudeKernel()(inputs[0], inputs[1], inputs[2], count, mScale, output);
+}
+
+void InclinationFunction::Evaluate(const float* const* inputs, size_t count,
+                                   float* output) const
+{
+  GetInclinationKernel()(inputs[0], inputs[1], inputs[2], count, mSign, output);
+}
+
+void DistanceFunction::Reset()
+{
+  mHasPrevious = false;
+  mPrevious[0] = mPrevious[1] = mPrevious[2] = 0.0f;
+  mTotal = 0.0f;
+}
+
+void DistanceFunction::Evaluate(const float* const* inputs, size_t count,
+                                float* output) const
+{
+  if(count == 0) return;
+  const float* x = inputs[0];
+  const float* y = inputs[1];
+  const float* z = inputs[2];
+
+  // the step into the first sample comes from the previous batch
+  if(mHasPrevious) {
+    float dx = x[0] - mPrevious[0];
+    float dy = y[0] - mPrevious[1];
+    float dz = z[0] - mPrevious[2];
+    output[0] = sqrtf(dx * dx + dy * dy + dz * dz);
+  }
+  else {
+    output[0] = 0.0f;
+  }
+  GetStepKernel()(x, y, z, count, output);
+
+  for(size_t i = 0; i < count; ++i) {
+    mTotal += output[i];
+    output[i] = mTotal;
+  }
+
+  mPrevious[0] = x[count - 1];
+  mPrevious[1] = y[count - 1];
+  mPrevious[2] = z[count - 1];
+  mHasPrevious = true;
+}
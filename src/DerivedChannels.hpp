@@ -0,0 +1,123 @@
+/*
+  Martin Galpin (m@66laps.com)
+  
+  Copyright (c) 2010 66laps Limited. All rights reserved.
+  
+  This file is part of rFactor-OpenMotorsport.
+  
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+  
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#pragma once
+#ifndef DERIVEDCHANNELS_HPP
+#define DERIVEDCHANNELS_HPP
+
+#include "OpenMotorsport.hpp"
+
+/**
+ * The functions used to derive channels from the raw telemetry stored by
+ * the plugin (see LoggingPlugin::CreateLoggingSession). They are evaluated
+ * in batches when a session is written, not on the game thread.
+ *
+ * Each batch is processed with SSE2 or AVX kernels when the CPU has them
+ * (chosen once at run time) and scalar code otherwise. The kernels only use
+ * float arithmetic, so they need AVX rather than AVX2 (which adds integer
+ * lanes and so fewer CPUs have it). "omtool bench" times every level
+ * against the scalar code (see SetDerivedKernelLevel()). Angles use a
+ * polynomial atan2 whose error is below kDerivedAtan2MaxError radians on
+ * every path, so results do not depend on the CPU beyond rounding.
+ */
+
+#define kDerivedAtan2MaxError 1e-5f
+
+/**
+ * The instruction sets the kernels can use, best last.
+ */
+enum DerivedKernelLevel
+{
+  kDerivedKernelScalar,
+  kDerivedKernelSSE2,
+  kDerivedKernelAVX
+};
+
+/**
+ * @return The best instruction set supported by this CPU (and build).
+ */
+DerivedKernelLevel GetDerivedKernelLevel();
+
+/**
+ * Forces the kernels to use no more than the given instruction set, for
+ * comparing them. The level is capped at what the CPU supports.
+ *
+ * @param level The instruction set.
+ */
+void SetDerivedKernelLevel(DerivedKernelLevel level);
+
+/**
+ * output = input * scale. Used for unit conversions.
+ */
+class ScaleFunction : public OpenMotorsport::DerivedFunction
+{
+public:
+  ScaleFunction(float scale) : mScale(scale) {}
+  void Evaluate(const float* const* inputs, size_t count, float* output) const;
+private:
+  float mScale;
+};
+
+/**
+ * output = |(x, y, z)| * scale. Used for speed from a velocity vector.
+ */
+class MagnitudeFunction : public OpenMotorsport::DerivedFunction
+{
+public:
+  MagnitudeFunction(float scale) : mScale(scale) {}
+  void Evaluate(const float* const* inputs, size_t count, float* output) const;
+private:
+  float mScale;
+};
+
+/**
+ * output = atan2(sign * y, sqrt(x * x + z * z)) in degrees. The angle of a
+ * vector above the horizontal plane (from ISI code), used for pitch and roll
+ * from the columns of the orientation matrix.
+ */
+class InclinationFunction : public OpenMotorsport::DerivedFunction
+{
+public:
+  InclinationFunction(float sign) : mSign(sign) {}
+  void Evaluate(const float* const* inputs, size_t count, float* output) const;
+private:
+  float mSign;
+};
+
+/**
+ * output = the cumulative (Cartesian) distance travelled by a position
+ * (x, y, z) since the first sample.
+ */
+class DistanceFunction : public OpenMotorsport::DerivedFunction
+{
+public:
+  DistanceFunction() { Reset(); }
+  void Evaluate(const float* const* inputs, size_t count, float* output) const;
+  bool HasState() const { return true; }
+  void Reset();
+private:
+  // carried from one batch to the next
+  mutable bool mHasPrevious;
+  mutable float mPrevious[3];
+  mutable float mTotal;
+};
+
+#endif /* DERIVEDCHANNELS_HPP */
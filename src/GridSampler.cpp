@@ -0,0 +1,136 @@
+/*
+  Martin Galpin (m@66laps.com)
+  
+  Copyright (c) 2010 66laps Limited. All rights reserved.
+  
+  This file is part of rFactor-OpenMotorsport.
+  
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+  
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#include <string.h>
+
+#include "GridSampler.hpp"
+#include "WheelSampler.hpp"
+
+// Interpolates between two values.
+static inline float Lerp(float from, float to, float fraction)
+{
+  return from + (to - from) * fraction;
+}
+
+static inline void Lerp(TelemVect3& out, const TelemVect3& from,
+                        const TelemVect3& to, float fraction)
+{
+  out.x = Lerp(from.x, to.x, fraction);
+  out.y = Lerp(from.y, to.y, fraction);
+  out.z = Lerp(from.z, to.z, fraction);
+}
+
+// The telemetry a given fraction of the way from one frame to the next. The
+// rows of the orientation are interpolated as vectors, which is close enough
+// over the few degrees a car turns between frames.
+static void Interpolate(const TelemInfoV2& from, const TelemInfoV2& to,
+                        float fraction, TelemInfoV2& out)
+{
+  if(fraction >= 1.0f) {
+    out = to;
+    return;
+  }
+  out = from;
+
+  Lerp(out.mPos, from.mPos, to.mPos, fraction);
+  Lerp(out.mLocalVel, from.mLocalVel, to.mLocalVel, fraction);
+  Lerp(out.mLocalAccel, from.mLocalAccel, to.mLocalAccel, fraction);
+  Lerp(out.mOriX, from.mOriX, to.mOriX, fraction);
+  Lerp(out.mOriY, from.mOriY, to.mOriY, fraction);
+  Lerp(out.mOriZ, from.mOriZ, to.mOriZ, fraction);
+  Lerp(out.mLocalRot, from.mLocalRot, to.mLocalRot, fraction);
+  Lerp(out.mLocalRotAccel, from.mLocalRotAccel, to.mLocalRotAccel, fraction);
+
+  out.mEngineRPM = Lerp(from.mEngineRPM, to.mEngineRPM, fraction);
+  out.mEngineWaterTemp = Lerp(from.mEngineWaterTemp, to.mEngineWaterTemp, fraction);
+  out.mEngineOilTemp = Lerp(from.mEngineOilTemp, to.mEngineOilTemp, fraction);
+  out.mClutchRPM = Lerp(from.mClutchRPM, to.mClutchRPM, fraction);
+  out.mFuel = Lerp(from.mFuel, to.mFuel, fraction);
+
+  out.mUnfilteredThrottle = 
+    Lerp(from.mUnfilteredThrottle, to.mUnfilteredThrottle, fraction);
+  out.mUnfilteredBrake = Lerp(from.mUnfilteredBrake, to.mUnfilteredBrake, fraction);
+  out.mUnfilteredSteering = 
+    Lerp(from.mUnfilteredSteering, to.mUnfilteredSteering, fraction);
+  out.mUnfilteredClutch = Lerp(from.mUnfilteredClutch, to.mUnfilteredClutch, fraction);
+  out.mSteeringArmForce = Lerp(from.mSteeringArmForce, to.mSteeringArmForce, fraction);
+
+  // the leading floats of each wheel, as read by WheelSampler
+  for(int i = 0; i < 4; ++i) {
+    const float* a = &from.mWheel[i].mRotation;
+    const float* b = &to.mWheel[i].mRotation;
+    float* values = &out.mWheel[i].mRotation;
+    for(int f = 0; f < kWheelFields; ++f)
+      values[f] = Lerp(a[f], b[f], fraction);
+  }
+}
+
+GridSampler::GridSampler() :
+  mPreviousTime(0.0),
+  mLatestTime(0.0),
+  mInterval(0),
+  mSamples(0),
+  mSampleTime(0.0),
+  mSampleFraction(1.0f)
+{
+  memset(&mPrevious, 0, sizeof(mPrevious));
+  memset(&mLatest, 0, sizeof(mLatest));
+  memset(&mSample, 0, sizeof(mSample));
+}
+
+void GridSampler::Start(const TelemInfoV2& info, long interval)
+{
+  mPrevious = mLatest = info;
+  mPreviousTime = mLatestTime = 0.0;
+  mInterval = interval;
+  mSamples = 1;
+  mSampleTime = 0.0;
+  mSampleFraction = 1.0f;
+}
+
+void GridSampler::Add(const TelemInfoV2& info, double elapsed)
+{
+  mPrevious = mLatest;
+  mPreviousTime = mLatestTime;
+  mLatest = info;
+  mLatestTime = elapsed;
+}
+
+const TelemInfoV2* GridSampler::Next()
+{
+  // from the count rather than accumulated, so the error never grows
+  double time = (double) mSamples * mInterval / 1000.0;
+  if(mInterval <= 0 || time > mLatestTime)
+    return NULL;
+
+  double span = mLatestTime - mPreviousTime;
+  float fraction = 1.0f;
+  if(span > 0.0 && time < mLatestTime)
+    fraction = (float) ((time - mPreviousTime) / span);
+  if(fraction < 0.0f)
+    fraction = 0.0f;
+  Interpolate(mPrevious, mLatest, fraction, mSample);
+
+  mSampleTime = time;
+  mSampleFraction = fraction;
+  mSamples++;
+  return &mSample;
+}
@@ -0,0 +1,102 @@
+/*
+  Martin Galpin (m@66laps.com)
+  
+  Copyright (c) 2010 66laps Limited. All rights reserved.
+  
+  This file is part of rFactor-OpenMotorsport.
+  
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+  
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#pragma once
+#ifndef GRIDSAMPLER_HPP
+#define GRIDSAMPLER_HPP
+
+#include <stddef.h>
+
+#include "InternalsPlugin.hpp"
+
+/**
+ * Places the samples of a session on an exact grid of times, one every
+ * interval from the start, rather than on whichever physics frame follows
+ * each interval. The telemetry at a time of the grid is interpolated 
+ * between the frames either side of it: continuous values (position,
+ * velocity, orientation, engine, driver inputs and the wheels) linearly
+ * and the others held from the earlier frame. The times are computed from
+ * the number of samples, so the rate never drifts and sessions logged at
+ * the same interval line up sample for sample.
+ */
+class GridSampler
+{
+public:
+  /**
+   * Default constructor.
+   */
+  GridSampler();
+
+  /**
+   * Starts a new grid. The frame given is the first sample (at time 0).
+   *
+   * @param info The first frame.
+   * @param interval The interval of the grid (in milliseconds).
+   */
+  void Start(const TelemInfoV2& info, long interval);
+
+  /**
+   * Adds the next frame. Every sample due before it must have been taken
+   * with Next().
+   *
+   * @param info The frame.
+   * @param elapsed The time of the frame since the start (in seconds). This
+   *   should be kept in double, as a float sum of frame times drifts by
+   *   seconds an hour.
+   */
+  void Add(const TelemInfoV2& info, double elapsed);
+
+  /**
+   * Takes the next sample due by the latest frame.
+   *
+   * @return The sample (valid until the next call) or NULL if none is due.
+   */
+  const TelemInfoV2* Next();
+
+  /**
+   * @return The time of the sample last taken (in seconds).
+   */
+  double GetSampleTime() const { return mSampleTime; }
+
+  /**
+   * @return How far the sample last taken is from the previous frame to the
+   *   latest (0 to 1), to interpolate values kept outside the telemetry.
+   */
+  float GetSampleFraction() const { return mSampleFraction; }
+
+  /**
+   * @return The number of samples taken (including the first).
+   */
+  size_t GetSamples() const { return mSamples; }
+
+private:
+  TelemInfoV2 mPrevious;
+  TelemInfoV2 mLatest;
+  TelemInfoV2 mSample;
+  double mPreviousTime;
+  double mLatestTime;
+  long mInterval;
+  size_t mSamples;        // also the index of the next time of the grid
+  double mSampleTime;
+  float mSampleFraction;
+};
+
+#endif /* GRIDSAMPLER_HPP */
@@ -0,0 +1,92 @@
+/*
+  Martin Galpin (m@66laps.com)
+  
+  Copyright (c) 2010 66laps Limited. All rights reserved.
+  
+  This file is part of rFactor-OpenMotorsport.
+  
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+  
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#include "LapDelta.hpp"
+
+LapDelta::LapDelta(size_t capacity) :
+  mReference(capacity > 2 ? capacity : 2),
+  mCurrent(capacity > 2 ? capacity : 2)
+{
+  Reset();
+}
+
+void LapDelta::Reset()
+{
+  mReferenceCount = 0;
+  mCurrentCount = 0;
+  mCursor = 0;
+  mCurrentComplete = false;
+  mReferenceTime = 0.0f;
+  mDelta = 0.0f;
+}
+
+void LapDelta::EndLap(float lapTime)
+{
+  if(!mCurrentComplete || mCurrentCount < 2) return;
+  if(HasReference() && lapTime >= mReferenceTime) return;
+
+  // the arrays are exchanged rather than copied
+  mReference.swap(mCurrent);
+  mReferenceCount = mCurrentCount;
+  mReferenceTime = lapTime;
+}
+
+void LapDelta::BeginLap(bool complete)
+{
+  mCurrentCount = 0;
+  mCurrentComplete = complete;
+  mCursor = 0;
+  mDelta = 0.0f;
+}
+
+void LapDelta::Update(float lapTime, float distance)
+{
+  // keep the distances increasing (the car may stop or reverse)
+  if(mCurrentCount == 0 || distance > mCurrent[mCurrentCount - 1].distance) {
+    if(mCurrentCount < mCurrent.size()) {
+      mCurrent[mCurrentCount].distance = distance;
+      mCurrent[mCurrentCount].time = lapTime;
+      mCurrentCount++;
+    }
+  }
+
+  mDelta = HasReference() ? lapTime - _referenceTime(distance) : 0.0f;
+}
+
+float LapDelta::_referenceTime(float distance)
+{
+  const Point* points = &mReference[0];
+  size_t last = mReferenceCount - 1;
+
+  // the car normally moves forward a little each time
+  while(mCursor < last && points[mCursor + 1].distance <= distance)
+    mCursor++;
+  while(mCursor > 0 && points[mCursor].distance > distance)
+    mCursor--;
+
+  if(distance <= points[0].distance) return points[0].time;
+  if(mCursor == last) return points[last].time;
+
+  const Point& a = points[mCursor];
+  const Point& b = points[mCursor + 1];
+  return a.time + (b.time - a.time) * 
+    (distance - a.distance) / (b.distance - a.distance);
+}
@@ -0,0 +1,116 @@
+/*
+  Martin Galpin (m@66laps.com)
+  
+  Copyright (c) 2010 66laps Limited. All rights reserved.
+  
+  This file is part of rFactor-OpenMotorsport.
+  
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+  
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#pragma once
+#ifndef LAPDELTA_HPP
+#define LAPDELTA_HPP
+
+#include <vector>
+#include <stddef.h>
+
+// Enough for a lap of about 12 minutes at the 90Hz telemetry rate
+#define kLapDeltaMaxPoints 65536
+
+/**
+ * Computes the live time difference to the fastest lap. The elapsed time
+ * of each lap is kept against its distance around the track in an array
+ * of increasing distance. The fastest complete lap becomes the reference
+ * and the delta is read from it with a cursor that follows the car (so
+ * each lookup is O(1) amortised) and linear interpolation. All memory is
+ * allocated up front.
+ */
+class LapDelta
+{
+public:
+  /**
+   * Constructor.
+   *
+   * @param capacity The number of points kept for a lap. Later points of
+   *   longer laps are not kept.
+   */
+  LapDelta(size_t capacity = kLapDeltaMaxPoints);
+
+  /**
+   * Forgets the reference lap (for a different car or track).
+   */
+  void Reset();
+
+  /**
+   * Ends the current lap. It becomes the reference if it is complete and
+   * faster than the reference.
+   *
+   * @param lapTime The time of the lap (in seconds).
+   */
+  void EndLap(float lapTime);
+
+  /**
+   * Starts a new lap.
+   *
+   * @param complete false if the lap is joined part way around (when
+   *   logging starts), so that it is never used as the reference.
+   */
+  void BeginLap(bool complete);
+
+  /**
+   * Records the position in the current lap and updates the delta.
+   *
+   * @param lapTime The time since the lap started (in seconds).
+   * @param distance The distance around the track (in meters).
+   */
+  void Update(float lapTime, float distance);
+
+  /**
+   * @return The time behind (positive) or ahead of (negative) the reference
+   *   lap at the same distance, in seconds, or 0 without a reference.
+   */
+  float GetDelta() const { return mDelta; }
+
+  /**
+   * @return true if there is a reference lap.
+   */
+  bool HasReference() const { return mReferenceCount > 1; }
+
+  /**
+   * @return The time of the reference lap (in seconds) or 0.
+   */
+  float GetReferenceLapTime() const { return mReferenceTime; }
+
+private:
+  struct Point
+  {
+    float distance;
+    float time;
+  };
+
+  float _referenceTime(float distance);
+
+private:
+  std::vector<Point> mReference;
+  std::vector<Point> mCurrent;
+  size_t mReferenceCount;
+  size_t mCurrentCount;
+  size_t mCursor;          // mReference[mCursor].distance <= the distance
+  bool mCurrentComplete;
+  float mReferenceTime;
+  float mDelta;
+};
+
+#endif /* LAPDELTA_HPP */
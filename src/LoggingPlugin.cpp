@@ -24,6 +24,15 @@
 #include "ChannelDefinitions.hpp"
 #include "Configuration.hpp"
 #include "Utilities.hpp"
+#include "DerivedChannels.hpp"
+#include "TelemetryPublisher.hpp"
+#include "TelemetryStreamer.hpp"
+#include "WheelSampler.hpp"
+#include "GridSampler.hpp"
+#include "LapDelta.hpp"
+#include "TrackMap.hpp"
+#include "PerformanceMonitor.hpp"
+#include "TraceRecorder.hpp"
 
 #include <math.h>
 #include <windows.h>
@@ -102,11 +111,6 @@ static std::string kSessions[] = {
   "Testing", "Practice", "", "", "", "Qualifying", "Warmup", "Race"
 };
 
-// Constants for the TelemWheel.mTemperature array (see InternalsPlugin.hpp)
-#define kWheelTemperatureLeft 0
-#define kWheelTemperatureCenter 1
-#define kWheelTemperatureRight 2
-
 // Constants for the ScoringInfoV2.mCurrentSectors
 #define kSectorsSector1 1
 #define kSectorsSector2 2
@@ -131,19 +135,42 @@ static std::string kSessions[] = {
 #define kPluginObjectCount 1
 
 // Macros that aid the sampling code
-#define RANGE_TO_PERCENT(x) 100.0f * x
 #define BOOL_TO_FLOAT(x) (x) ? 1.0f : 0.0f
-#define MPS_TO_KPH(x) x * 3.6f
-#define SPEED_MPS(v) sqrtf( (v.x * v.x) + (v.y * v.y) + (v.z * v.z));
-#define RAD_TO_DEG(x)  x * 57.296f;
+
+// Unit conversions applied by derived channels
+#define kRangeToPercent 100.0f
+#define kMpsToKph 3.6f
+#define kMsmsToG 0.101971621f
+
+// Raw telemetry stored for derived channels (see CreateLoggingSession)
+#define kInputLocalAccelX "mLocalAccel.x"
+#define kInputLocalAccelY "mLocalAccel.y"
+#define kInputLocalAccelZ "mLocalAccel.z"
+#define kInputLocalVelX "mLocalVel.x"
+#define kInputLocalVelY "mLocalVel.y"
+#define kInputLocalVelZ "mLocalVel.z"
+#define kInputOriXx "mOriX.x"
+#define kInputOriYx "mOriY.x"
+#define kInputOriZx "mOriZ.x"
+#define kInputOriXz "mOriX.z"
+#define kInputOriYz "mOriY.z"
+#define kInputOriZz "mOriZ.z"
+#define kInputPosX "mPos.x"
+#define kInputPosY "mPos.y"
+#define kInputPosZ "mPos.z"
+#define kInputThrottle "mUnfilteredThrottle"
+#define kInputBrake "mUnfilteredBrake"
+#define kInputClutch "mUnfilteredClutch"
+#define kInputSteering "mUnfilteredSteering"
 
 // Convert sectors to milliseconds
 #define SEC_TO_MS(x) (int) (x * 1000)
 #define MS_TO_SEC(x) (float) x / 1000
-#define MSMS_TO_G(x) x * 0.101971621
 
-// Copy an instance of TelemVect3 from src to dest
-#define COPY_VECT3(src, dest) dest.x = src.x; dest.y = src.y; dest.z = src.z;
+// Capacity planning for the channels of a new session
+#define kPresizeMaxDuration 3600.0f // plan no more than an hour up front
+#define kPresizeLapTime 120.0f      // assumed lap time of lap limited sessions
+#define kPresizeMaxLaps 1000        // larger mMaxLaps means no lap limit
 
 // Log file path
 #define LOG_PATH "OpenMotorsport.log"
@@ -157,64 +184,260 @@ void LoggingPlugin::Startup()
 {
   mSession = NULL;
   mIsLogging = false;
+  mSessionCurrentET = mSessionEndET = 0.0f;
+  mSessionMaxLaps = 0;
   mConfiguration = new Configuration();
   mConfiguration->Read();
   // cache sample interval to stop a lookup for every thread loop
   mSamplingInterval = 
         mConfiguration->GetInt(kConfigurationSampleInterval);
   mSamplingIntervalSeconds = MS_TO_SEC(mSamplingInterval);
+
+  mWheelSampler = new WheelSampler();
+  mGridSampler = new GridSampler();
+  mLapDelta = new LapDelta();
+
+  mTrackMap = NULL;
+  if(mConfiguration->GetBool(kConfigurationTrackMap))
+    mTrackMap = new TrackMap();
+
+  mMonitor = NULL;
+  if(mConfiguration->GetBool(kConfigurationProfile))
+    mMonitor = new PerformanceMonitor();
+
+  mTracer = NULL;
+  if(mConfiguration->GetBool(kConfigurationTrace)) {
+    mTracer = new TraceRecorder(mConfiguration->GetInt(kConfigurationTraceEvents));
+    mTracer->Instant("Startup");
+  }
+
+  mPublisher = NULL;
+  if(mConfiguration->GetBool(kConfigurationSharedMemory)) {
+    mPublisher = new TelemetryPublisher();
+    if(!mPublisher->Open(
+        mConfiguration->GetString(kConfigurationSharedMemoryName))) {
+      log("Failed to open shared memory, live telemetry disabled", LOG_WARN);
+      delete mPublisher;
+      mPublisher = NULL;
+    }
+  }
+
+  mStreamer = NULL;
+  if(mConfiguration->GetBool(kConfigurationStream)) {
+    mStreamer = new TelemetryStreamer(
+      mConfiguration->GetInt(kConfigurationStreamBatch));
+    if(!mStreamer->Open(
+        mConfiguration->GetString(kConfigurationStreamAddress))) {
+      log("Failed to open stream socket, streaming disabled", LOG_WARN);
+      delete mStreamer;
+      mStreamer = NULL;
+    }
+  }
   log("Startup");
 }
 
 void LoggingPlugin::Destroy()
 {
   Shutdown();
+  delete mSession;
+  mSession = NULL;
+  delete mWheelSampler;
+  mWheelSampler = NULL;
+  delete mGridSampler;
+  mGridSampler = NULL;
+  delete mLapDelta;
+  mLapDelta = NULL;
+  delete mTrackMap;
+  mTrackMap = NULL;
+  delete mMonitor;
+  mMonitor = NULL;
+  delete mTracer;
+  mTracer = NULL;
+  delete mPublisher;
+  mPublisher = NULL;
+  delete mStreamer;
+  mStreamer = NULL;
 }
 
 // Game lifecycle methods
 void LoggingPlugin::EnterRealtime()
 {
   mEnterPhase = kGamePhaseNotEnteredGame;
+  if(mMonitor)
+    mMonitor->Reset();
+  if(mTracer)
+    mTracer->Instant("EnterRealtime");
 }
 
 void LoggingPlugin::ExitRealtime()
 {
+  if(mTracer)
+    mTracer->Instant("ExitRealtime");
   if(isCurrentlyLogging())
     stopLogging();
+  logPerformance();
+  saveTrace();
 }
 
 // Logging lifecycle methods
 void LoggingPlugin::startLogging(const TelemInfoV2 &info)
 {
+  TraceScope trace(mTracer, "startLogging");
   mCurrentSector = kSectorsSector1;
   mSavedMetaData = false;
-  mTotalElapsed = 0.0f;
-  mFirstLapET = 0.0f;
+  mTotalElapsed = 0.0;
+  mFirstLapET = 0.0;
   mEnterLapNumber = info.mLapNumber;
   mCurrentLapNumber = info.mLapNumber;
-  mTimeSinceLastSample = 0.0f;
   mIsLogging = true;
-  mHasPreviousPosition = false;
-  mPreviousPosition.x = mPreviousPosition.y = mPreviousPosition.z = 0;
-  mCumulativeDistance = 0.0f;
 
-  LoggingPlugin::CreateLoggingSession();
-  SampleBlock(info);
+  // The lap we join is never a reference, it may have started anywhere
+  if(mDeltaTrack != info.mTrackName || mDeltaVehicle != info.mVehicleName) {
+    mDeltaTrack = info.mTrackName;
+    mDeltaVehicle = info.mVehicleName;
+    mLapDelta->Reset();
+  }
+  mLapDelta->BeginLap(false);
+  mDeltaLapNumber = info.mLapNumber;
+  mDeltaLapStartET = 0.0;
+  mDeltaLapDistance = 0.0f;
+  mPreviousDelta = mLapDelta->GetDelta();
+  mLapDistanceKnown = false;
+  mInPits = true;
+
+  // The session of the previous logging period is recycled (keeping its
+  // channels and their memory) rather than rebuilt.
+  if(mSession == NULL)
+    LoggingPlugin::CreateLoggingSession();
+  else
+    mSession->Clear();
+  size_t samples = estimateSessionSamples();
+  if(samples > 0)
+    mSession->Reserve(samples);
+  if(mPublisher)
+    mPublisher->Attach(*mSession);
+  if(mStreamer)
+    mStreamer->Attach(*mSession);
+  mGridSampler->Start(info, mSamplingInterval);
+  SampleBlock(info, 0.0f);
 
   log("Started logging");
 }
 
 void LoggingPlugin::stopLogging()
 {
+  TraceScope trace(mTracer, "stopLogging");
   mIsLogging = false;
+  if(mPublisher)
+    mPublisher->Detach();
+  if(mStreamer) {
+    mStreamer->Detach();
+    if(mStreamer->GetDropped() > 0) {
+      std::stringstream message;
+      message << "Stream consumers were too slow, dropped "
+              << mStreamer->GetDropped() << " frames";
+      log(message.str(), LOG_WARN);
+    }
+  }
   saveSession();
-  mSession = NULL;
-  delete mSession;
   mEnterPhase = kGamePhaseNotEnteredGame;
   
   log("Stopped logging");
 }
 
+void LoggingPlugin::updateLapDelta(const TelemInfoV2& info)
+{
+  mPreviousDelta = mLapDelta->GetDelta();
+  if(info.mLapNumber != mDeltaLapNumber) {
+    mLapDelta->EndLap(float(mTotalElapsed - mDeltaLapStartET));
+    mLapDelta->BeginLap(info.mLapNumber == mDeltaLapNumber + 1);
+    mDeltaLapNumber = info.mLapNumber;
+    mDeltaLapStartET = mTotalElapsed;
+    mDeltaLapDistance = 0.0f;
+    mLapDistanceKnown = true;
+  }
+
+  const TelemVect3& v = info.mLocalVel;
+  mDeltaLapDistance += 
+    sqrtf(v.x * v.x + v.y * v.y + v.z * v.z) * info.mDeltaTime;
+  mLapDelta->Update(float(mTotalElapsed - mDeltaLapStartET), mDeltaLapDistance);
+}
+
+void LoggingPlugin::updatePerformanceCounters()
+{
+  if(mMonitor == NULL || mSession == NULL) return;
+  mMonitor->SetCounter(kCounterBytesBuffered, mSession->GetBufferedBytes());
+  mMonitor->SetCounter(kCounterAllocations, mSession->GetAllocations());
+}
+
+void LoggingPlugin::logPerformance()
+{
+  if(mMonitor == NULL) return;
+  updatePerformanceCounters();
+  std::stringstream report(mMonitor->Report());
+  std::string line;
+  while(std::getline(report, line))
+    log("Performance " + line);
+}
+
+void LoggingPlugin::saveTrace()
+{
+  if(mTracer == NULL) return;
+
+  time_t rawtime;
+  time(&rawtime);
+  char name[64];
+  strftime(name, sizeof(name), "trace_%Y%m%d%H%M%S.json", localtime(&rawtime));
+
+  std::stringstream path;
+  path << mConfiguration->GetString(kConfigurationOutputDirectory);
+  CreateDirectory(path.str().c_str(), NULL);
+  path << "\\" << name;
+
+  if(mTracer->Write(path.str()))
+    log("Saved trace " + path.str());
+  else
+    log("Failed to save trace " + path.str(), LOG_WARN);
+  mTracer->Clear();
+}
+
+std::string LoggingPlugin::trackMapPath(const std::string& track)
+{
+  std::string name = track;
+  for(size_t i = 0; i < name.size(); ++i) {
+    if(!isalnum((unsigned char) name[i]) && name[i] != '-' && name[i] != '_')
+      name[i] = '_';
+  }
+  std::stringstream path;
+  path << mConfiguration->GetString(kConfigurationTrackMapDirectory);
+  path << "\\" << name << ".map";
+  return path.str();
+}
+
+void LoggingPlugin::loadTrackMap(const ScoringInfoV2& info)
+{
+  mTrackMap->Reset(info.mTrackName, info.mLapDist);
+  if(mTrackMap->Load(trackMapPath(info.mTrackName)))
+    log("Loaded track map of " + mTrackMap->GetTrack());
+}
+
+void LoggingPlugin::saveTrackMap()
+{
+  std::string data;
+  if(!mTrackMap->Encode(data)) return;
+  mSession->SetFile(kTrackMapFileName, data);
+
+  // refine the cache with what was seen in this session
+  if(!mTrackMap->IsChanged()) return;
+  CreateDirectory(
+    mConfiguration->GetString(kConfigurationOutputDirectory).c_str(), NULL);
+  CreateDirectory(
+    mConfiguration->GetString(kConfigurationTrackMapDirectory).c_str(), NULL);
+  std::string path = trackMapPath(mTrackMap->GetTrack());
+  if(!mTrackMap->Save(path))
+    log("Failed to save track map " + path, LOG_WARN);
+}
+
 bool LoggingPlugin::isCurrentlyLogging()
 {
   return mIsLogging;
@@ -222,12 +445,14 @@ bool LoggingPlugin::isCurrentlyLogging()
 
 void LoggingPlugin::saveSession()
 {
+  ProfileScope scope(mMonitor, kProfileSaveSession);
+  TraceScope trace(mTracer, "saveSession");
   if(mConfiguration->GetBool(kConfigurationRequireOneLap) &&
       (mCurrentLapNumber - mEnterLapNumber) < 1) {
     return;
   }
 
-  mSession->SetDuration(mTotalElapsed);
+  mSession->SetDuration(float(mTotalElapsed));
 
   std::stringstream path;
   path << mConfiguration->GetString(kConfigurationOutputDirectory);
@@ -236,7 +461,18 @@ void LoggingPlugin::saveSession()
   path << formatFileName(mConfiguration->GetString(kConfigurationFilename), 
     mSession);
 
+  if(mTrackMap)
+    saveTrackMap();
+
+  if(mMonitor) {
+    updatePerformanceCounters();
+    if(mConfiguration->GetBool(kConfigurationProfileMetadata))
+      mMonitor->WriteProperties(*mSession);
+  }
+
   try {
+    ProfileScope scope(mMonitor, kProfileSessionWrite);
+    TraceScope trace(mTracer, "Session::Write");
     mSession->Write(path.str());
   }
   catch (const char* e) {
@@ -246,110 +482,84 @@ void LoggingPlugin::saveSession()
   }
 }
 
-void LoggingPlugin::SampleBlock(const TelemInfoV2& info)
+size_t LoggingPlugin::estimateSessionSamples()
 {
-  mCurrentLapNumber = info.mLapNumber;
-
-  // Compute some auxiliary info based on the above (vectors from ISI code)
-  float speed = SPEED_MPS(info.mLocalVel);
-  TelemVect3 forwardVector = { -info.mOriX.z, -info.mOriY.z, -info.mOriZ.z };
-  TelemVect3 leftVector = { info.mOriX.x,  info.mOriY.x,  info.mOriZ.x };
-  float pitch = atan2f( 
-    forwardVector.y, 
-    sqrtf( (forwardVector.x * forwardVector.x) + 
-           (forwardVector.z * forwardVector.z) ) 
-  );
-  pitch = RAD_TO_DEG(pitch);
-
-  float roll = atan2f( 
-    leftVector.y, 
-    sqrtf( (leftVector.x * leftVector.x) + 
-           (leftVector.z * leftVector.z) ) 
-  );
-  roll = RAD_TO_DEG(roll);
-
-  // Calculate cumulative distance (Cartesian distance)
-  if(mHasPreviousPosition) {
-    mCumulativeDistance += sqrtf(
-      pow(mPreviousPosition.x - info.mPos.x, 2) +
-      pow(mPreviousPosition.y - info.mPos.y, 2) +
-      pow(mPreviousPosition.z - info.mPos.z, 2)
-    );
+  // Size the channels for the rest of the session (from the latest scoring
+  // update) so they do not have to grow while driving. Zero means unknown.
+  float duration = 0.0f;
+  if(mSessionEndET > mSessionCurrentET)
+    duration = mSessionEndET - mSessionCurrentET;
+  if(mSessionMaxLaps > 0 && mSessionMaxLaps < kPresizeMaxLaps) {
+    float lapsDuration = mSessionMaxLaps * kPresizeLapTime;
+    if(duration <= 0.0f || lapsDuration < duration)
+      duration = lapsDuration;
   }
-  COPY_VECT3(info.mPos, mPreviousPosition);
-  mHasPreviousPosition = true;
+  if(duration <= 0.0f || mSamplingIntervalSeconds <= 0.0f)
+    return 0;
+  if(duration > kPresizeMaxDuration)
+    duration = kPresizeMaxDuration;
+  return (size_t) (duration / mSamplingIntervalSeconds) + 1;
+}
 
-  // Group: Acceleration
-  mSession->GetChannel(kChannelAccelerationX, kGroupAcceleration)
-    .GetDataBuffer().Write(MSMS_TO_G(info.mLocalAccel.x));
-  mSession->GetChannel(kChannelAccelerationY, kGroupAcceleration)
-    .GetDataBuffer().Write(MSMS_TO_G(info.mLocalAccel.y));
-  mSession->GetChannel(kChannelAccelerationZ, kGroupAcceleration)
-    .GetDataBuffer().Write(MSMS_TO_G(info.mLocalAccel.z));
+void LoggingPlugin::SampleBlock(const TelemInfoV2& info, float elapsed)
+{
+  ProfileScope scope(mMonitor, kProfileSampleBlock);
+  TraceScope trace(mTracer, "SampleBlock");
+  if(mMonitor)
+    mMonitor->Count(kCounterSamples);
+  mCurrentLapNumber = info.mLapNumber;
 
-  // Group: Position
-  mSession->GetChannel(kChannelSpeed, kGroupPosition)
-    .GetDataBuffer().Write(MPS_TO_KPH(speed));
-  mSession->GetChannel(kChannelPitch, kGroupPosition)
-    .GetDataBuffer().Write(pitch);
-  mSession->GetChannel(kChannelRoll, kGroupPosition).
-    GetDataBuffer().Write(roll);
-  mSession->GetChannel(kChannelTime, kGroupPosition).
-    GetDataBuffer().Write(SEC_TO_MS(mTotalElapsed));
-  mSession->GetChannel(kChannelDistance, kGroupPosition).
-    GetDataBuffer().Write(mCumulativeDistance);
+  // Raw inputs of the derived channels (acceleration, speed, pitch, roll,
+  // distance and the driver inputs), which are computed in batches
+  mBuffers[kBufferLocalAccelX]->Write(info.mLocalAccel.x);
+  mBuffers[kBufferLocalAccelY]->Write(info.mLocalAccel.y);
+  mBuffers[kBufferLocalAccelZ]->Write(info.mLocalAccel.z);
+  mBuffers[kBufferLocalVelX]->Write(info.mLocalVel.x);
+  mBuffers[kBufferLocalVelY]->Write(info.mLocalVel.y);
+  mBuffers[kBufferLocalVelZ]->Write(info.mLocalVel.z);
+  mBuffers[kBufferOriXx]->Write(info.mOriX.x);
+  mBuffers[kBufferOriYx]->Write(info.mOriY.x);
+  mBuffers[kBufferOriZx]->Write(info.mOriZ.x);
+  mBuffers[kBufferOriXz]->Write(info.mOriX.z);
+  mBuffers[kBufferOriYz]->Write(info.mOriY.z);
+  mBuffers[kBufferOriZz]->Write(info.mOriZ.z);
+  mBuffers[kBufferPosX]->Write(info.mPos.x);
+  mBuffers[kBufferPosY]->Write(info.mPos.y);
+  mBuffers[kBufferPosZ]->Write(info.mPos.z);
+  mBuffers[kBufferThrottle]->Write(info.mUnfilteredThrottle);
+  mBuffers[kBufferBrake]->Write(info.mUnfilteredBrake);
+  mBuffers[kBufferClutch]->Write(info.mUnfilteredClutch);
+  mBuffers[kBufferSteering]->Write(info.mUnfilteredSteering);
+
+  // Group: Position (the time of a sample follows from its index on the grid
+  // and the lap delta is interpolated to it like the telemetry)
+  float fraction = mGridSampler->GetSampleFraction();
+  mBuffers[kBufferLapDelta]->Write(
+    mPreviousDelta + (mLapDelta->GetDelta() - mPreviousDelta) * fraction);
 
   // Group: Driver
-  mSession->GetChannel(kChannelGear, kGroupDriver)
-    .GetDataBuffer().Write(float(info.mGear));
-  mSession->GetChannel(kChannelThrottle, kGroupDriver)
-    .GetDataBuffer().Write(RANGE_TO_PERCENT(info.mUnfilteredThrottle));
-  mSession->GetChannel(kChannelBrake, kGroupDriver)
-    .GetDataBuffer().Write(RANGE_TO_PERCENT(info.mUnfilteredBrake));
-  mSession->GetChannel(kChannelClutch, kGroupDriver)
-    .GetDataBuffer().Write(RANGE_TO_PERCENT(info.mUnfilteredClutch));
-  mSession->GetChannel(kChannelSteering, kGroupDriver)
-    .GetDataBuffer().Write(RANGE_TO_PERCENT(info.mUnfilteredSteering));
+  mBuffers[kBufferGear]->Write(float(info.mGear));
 
   // Group: Engine
-  mSession->GetChannel(kChannelRPM, kGroupEngine)
-    .GetDataBuffer().Write(info.mEngineRPM);
-  mSession->GetChannel(kChannelClutchRPM, kGroupEngine)
-    .GetDataBuffer().Write(info.mClutchRPM);
-  mSession->GetChannel(kChannelFuel, kGroupEngine)
-    .GetDataBuffer().Write(info.mFuel);
-  mSession->GetChannel(kChannelOverheating, kGroupEngine)
-    .GetDataBuffer().Write(BOOL_TO_FLOAT(info.mOverheating));
+  mBuffers[kBufferRPM]->Write(info.mEngineRPM);
+  mBuffers[kBufferClutchRPM]->Write(info.mClutchRPM);
+  mBuffers[kBufferFuel]->Write(info.mFuel);
+  mBuffers[kBufferOverheating]->Write(BOOL_TO_FLOAT(info.mOverheating));
 
   // Group: Wheels
-  for( long i = 0; i < kNumberOfWheels; ++i ) {
-    const TelemWheelV2 &wheel = info.mWheel[i];
-    mSession->GetChannel(kChannelSuspensionDeflection, kWheels[i])
-      .GetDataBuffer().Write(wheel.mSuspensionDeflection);
-    mSession->GetChannel(kChannelRotation, kWheels[i])
-      .GetDataBuffer().Write(-wheel.mRotation);
-    mSession->GetChannel(kChannelRideHeight, kWheels[i])
-      .GetDataBuffer().Write(wheel.mRideHeight);
-    mSession->GetChannel(kChannelTireLoad, kWheels[i])
-      .GetDataBuffer().Write(wheel.mTireLoad);
-    mSession->GetChannel(kChannelLateralForce, kWheels[i])
-      .GetDataBuffer().Write(wheel.mLateralForce);
-    mSession->GetChannel(kChannelBrakeTemperature, kWheels[i])
-      .GetDataBuffer().Write(wheel.mBrakeTemp);
-    mSession->GetChannel(kChannelPressure, kWheels[i])
-      .GetDataBuffer().Write(wheel.mPressure);
-    mSession->GetChannel(kChannelTemperatureLeft, kWheels[i])
-      .GetDataBuffer().Write(wheel.mTemperature[kWheelTemperatureLeft]);
-    mSession->GetChannel(kChannelTemperatureCenter, kWheels[i])
-      .GetDataBuffer().Write(wheel.mTemperature[kWheelTemperatureCenter]);
-    mSession->GetChannel(kChannelTemperatureRight, kWheels[i])
-      .GetDataBuffer().Write(wheel.mTemperature[kWheelTemperatureRight]);
-  }
+  mWheelSampler->Sample(info.mWheel);
+
+  if(mPublisher)
+    mPublisher->Publish(elapsed);
+  if(mStreamer)
+    mStreamer->Publish(elapsed);
 }
 
 // Telemetry updates from InternalsPluginV3
 void LoggingPlugin::UpdateTelemetry( const TelemInfoV2 &info )
 {
+  ProfileScope scope(mMonitor, kProfileUpdateTelemetry);
+  TraceScope trace(mTracer, "UpdateTelemetry");
   if(mEnterPhase == kGamePhaseNotEnteredGame) {
     mEnterPhase = mCurrentPhase;
 
@@ -376,24 +586,30 @@ void LoggingPlugin::UpdateTelemetry( const TelemInfoV2 &info )
 
   // We get the ET of the out lap by looking for when the lap number
   // increases. All other lap times after now handled by scoring.
-  if(info.mLapNumber > mEnterLapNumber && mFirstLapET == 0.0f) {
+  if(info.mLapNumber > mEnterLapNumber && mFirstLapET == 0.0) {
     mFirstLapET = mTotalElapsed;
     mSession->AddMarker(SEC_TO_MS(mFirstLapET));
   }
 
-  // Check if we should sample yet.
-  if(mTimeSinceLastSample >= mSamplingIntervalSeconds) {
-    SampleBlock(info);
-    mTimeSinceLastSample = 0.0f;
-  }
+  updateLapDelta(info);
+  if(mTrackMap && mLapDistanceKnown && !mInPits)
+    mTrackMap->Add(mDeltaLapDistance, info.mPos.x, info.mPos.y, info.mPos.z);
+
+  // Sample at every time of the grid up to this frame (interpolated from
+  // the previous frame)
+  mGridSampler->Add(info, mTotalElapsed);
+  const TelemInfoV2* sample;
+  while((sample = mGridSampler->Next()) != NULL)
+    SampleBlock(*sample, float(mGridSampler->GetSampleTime()));
 
   mTotalElapsed += info.mDeltaTime;
-  mTimeSinceLastSample += info.mDeltaTime;
 }
 
 // Scoring updates from InternalsPluginV3
 void LoggingPlugin::UpdateScoring( const ScoringInfoV2 &info )
 {
+  ProfileScope scope(mMonitor, kProfileUpdateScoring);
+  TraceScope trace(mTracer, "UpdateScoring");
   // It's possible to restart a race without leaving realtime mode so if we 
   // detect this, we need to manually stop/start logging
   if(info.mGamePhase < mCurrentPhase) {
@@ -404,6 +620,16 @@ void LoggingPlugin::UpdateScoring( const ScoringInfoV2 &info )
   // Update current game phase
   mCurrentPhase = info.mGamePhase;
 
+  // Remember the length of the session for sizing the next one we log
+  mSessionCurrentET = info.mCurrentET;
+  mSessionEndET = info.mEndET;
+  mSessionMaxLaps = info.mMaxLaps;
+
+  // The map of a new track starts from the cache (if there is one)
+  if(mTrackMap && info.mLapDist > 0.0f && 
+      mTrackMap->GetTrack() != info.mTrackName)
+    loadTrackMap(info);
+
   // Sanity check so we don't end up crashing the game
   if(!isCurrentlyLogging()) 
     return;
@@ -423,6 +649,14 @@ void LoggingPlugin::UpdateScoring( const ScoringInfoV2 &info )
         saveSectorTime(info, vinfo);
       }
 
+      // Scoring knows the distance along the track, which corrects the
+      // distance integrated from the velocity in between
+      if(vinfo.mTotalLaps == mDeltaLapNumber && vinfo.mLapDist >= 0.0f) {
+        mDeltaLapDistance = vinfo.mLapDist;
+        mLapDistanceKnown = true;
+      }
+      mInPits = vinfo.mInPits;
+
       // We are only interested in this player.
       break;
     }
@@ -540,87 +774,117 @@ void LoggingPlugin::log(std::string message, short level)
 void LoggingPlugin::CreateLoggingSession()
 {
   mSession = new OpenMotorsport::Session();
+  mSession->SetTracer(mTracer);
+  mSession->SetRunLengthEncoding(
+    mConfiguration->GetBool(kConfigurationRunLengthEncoding));
   int channelID = 0;
 
+  // Raw telemetry that channels are derived from (see SampleBlock), in the
+  // order of SampleBuffer
+  const char* inputs[] = {
+    kInputLocalAccelX, kInputLocalAccelY, kInputLocalAccelZ,
+    kInputLocalVelX, kInputLocalVelY, kInputLocalVelZ,
+    kInputOriXx, kInputOriYx, kInputOriZx,
+    kInputOriXz, kInputOriYz, kInputOriZz,
+    kInputPosX, kInputPosY, kInputPosZ,
+    kInputThrottle, kInputBrake, kInputClutch, kInputSteering
+  };
+  for(int i = 0; i < sizeof(inputs) / sizeof(inputs[0]); ++i)
+    mBuffers[i] = &mSession->AddInput(inputs[i]);
+
   // Group: Acceleration
-  mSession->AddChannel(
+  mSession->AddDerivedChannel(
     OpenMotorsport::Channel(
       channelID++, 
       kChannelAccelerationX, 
       mSamplingInterval, 
       kUnitsGee, 
       kGroupAcceleration
-    )
+    ),
+    new ScaleFunction(kMsmsToG),
+    kInputLocalAccelX
   );
 
-  mSession->AddChannel(
+  mSession->AddDerivedChannel(
     OpenMotorsport::Channel(
       channelID++, 
       kChannelAccelerationY, 
       mSamplingInterval, 
       kUnitsGee, 
       kGroupAcceleration
-    )
+    ),
+    new ScaleFunction(kMsmsToG),
+    kInputLocalAccelY
   );
 
-  mSession->AddChannel(
+  mSession->AddDerivedChannel(
     OpenMotorsport::Channel(
       channelID++, 
       kChannelAccelerationZ,
       mSamplingInterval, 
       kUnitsGee, 
       kGroupAcceleration
-    )
+    ),
+    new ScaleFunction(kMsmsToG),
+    kInputLocalAccelZ
   );
 
   // Group: Position
-  mSession->AddChannel(
+  mSession->AddDerivedChannel(
     OpenMotorsport::Channel(
       channelID++, 
       kChannelSpeed, 
       mSamplingInterval, 
       kUnitsKPH, 
       kGroupPosition
-    )
+    ),
+    new MagnitudeFunction(kMpsToKph),
+    kInputLocalVelX, kInputLocalVelY, kInputLocalVelZ
   );
 
-  mSession->AddChannel(
+  mSession->AddDerivedChannel(
     OpenMotorsport::Channel(
       channelID++, 
       kChannelPitch,
       mSamplingInterval, 
       kUnitsDegrees, 
       kGroupPosition
-    )
+    ),
+    new InclinationFunction(-1.0f), // forward vector
+    kInputOriXz, kInputOriYz, kInputOriZz
   );
 
-  mSession->AddChannel(
+  mSession->AddDerivedChannel(
     OpenMotorsport::Channel(
       channelID++, 
       kChannelRoll,
       mSamplingInterval, 
       kUnitsDegrees, 
       kGroupPosition
-    )
+    ),
+    new InclinationFunction(1.0f), // left vector
+    kInputOriXx, kInputOriYx, kInputOriZx
   );
 
-  mSession->AddChannel(
+  mSession->AddDerivedChannel(
     OpenMotorsport::Channel(
       channelID++, 
-      kChannelTime,
+      kChannelDistance,
       mSamplingInterval, 
-      kUnitsMilliseconds, 
+      kUnitsMeters, 
       kGroupPosition
-    )
+    ),
+    new DistanceFunction(), // cumulative (Cartesian) distance
+    kInputPosX, kInputPosY, kInputPosZ
   );
 
   mSession->AddChannel(
     OpenMotorsport::Channel(
-    channelID++, 
-    kChannelDistance,
-    mSamplingInterval, 
-    kUnitsMeters, 
-    kGroupPosition
+      channelID++, 
+      kChannelLapDelta,
+      mSamplingInterval, 
+      kUnitsSeconds, 
+      kGroupPosition
     )
   );
 
@@ -635,44 +899,52 @@ void LoggingPlugin::CreateLoggingSession()
     )
   );
 
-  mSession->AddChannel(
+  mSession->AddDerivedChannel(
     OpenMotorsport::Channel(
       channelID++, 
       kChannelThrottle,
       mSamplingInterval, 
       kUnitsPercent, 
       kGroupDriver
-    )
+    ),
+    new ScaleFunction(kRangeToPercent),
+    kInputThrottle
   );
 
-  mSession->AddChannel(
+  mSession->AddDerivedChannel(
     OpenMotorsport::Channel(
       channelID++, 
       kChannelBrake,
       mSamplingInterval, 
       kUnitsPercent, 
       kGroupDriver
-    )
+    ),
+    new ScaleFunction(kRangeToPercent),
+    kInputBrake
   );
 
-  mSession->AddChannel(
+  mSession->AddDerivedChannel(
     OpenMotorsport::Channel(
       channelID++, 
       kChannelClutch,
       mSamplingInterval, 
       kUnitsPercent, 
       kGroupDriver
-    )
+    ),
+    new ScaleFunction(kRangeToPercent),
+    kInputClutch
   );
 
-  mSession->AddChannel(
+  mSession->AddDerivedChannel(
     OpenMotorsport::Channel(
       channelID++, 
       kChannelSteering,
       mSamplingInterval, 
       kUnitsPercent, 
       kGroupDriver
-    )
+    ),
+    new ScaleFunction(kRangeToPercent),
+    kInputSteering
   );
 
   // Group: Engine
@@ -719,105 +991,56 @@ void LoggingPlugin::CreateLoggingSession()
   // Group: Wheels
   for( long i = 0; i < kNumberOfWheels; ++i )
   {
-    mSession->AddChannel(
-      OpenMotorsport::Channel(
-        channelID++, 
-        kChannelRotation,
-        mSamplingInterval, 
-        kUnitsRadiansPerSecond, 
-        kWheels[i]
-      )
-    ); 
-
-    mSession->AddChannel(
-      OpenMotorsport::Channel(
-        channelID++, 
-        kChannelSuspensionDeflection,
-        mSamplingInterval,
-        kUnitsMeters, 
-        kWheels[i]
-      )
-    );
-
-    mSession->AddChannel(
-      OpenMotorsport::Channel(
-        channelID++, 
-        kChannelRideHeight,
-        mSamplingInterval,
-        kUnitsMeters, 
-        kWheels[i]
-      )
-    );
-
-    mSession->AddChannel(
-      OpenMotorsport::Channel(
-        channelID++, 
-        kChannelTireLoad,
-        mSamplingInterval,
-        kUnitsNewtons, 
-        kWheels[i]
-      )
-    );
-
-    mSession->AddChannel(
-      OpenMotorsport::Channel(
-        channelID++, 
-        kChannelLateralForce,
-        mSamplingInterval,
-        kUnitsNewtons, 
-        kWheels[i]
-      )
-    );
-
-    mSession->AddChannel(
-      OpenMotorsport::Channel(
-        channelID++, 
-        kChannelBrakeTemperature,
-        mSamplingInterval,
-        kUnitsCelcius, 
-        kWheels[i]
-      )
-    );
-
-    mSession->AddChannel(
-      OpenMotorsport::Channel(
-        channelID++, 
-        kChannelPressure,
-        mSamplingInterval,
-        kUnitsPascal, 
-        kWheels[i]
-      )
-    );
-
-    mSession->AddChannel(
-      OpenMotorsport::Channel(
-        channelID++, 
-        kChannelTemperatureLeft,
-        mSamplingInterval,
-        kUnitsCelcius, 
-        kWheels[i]
-      )
-    );
-
-    mSession->AddChannel(
-      OpenMotorsport::Channel(
-        channelID++, 
-        kChannelTemperatureCenter,
-        mSamplingInterval,
-        kUnitsCelcius, 
-        kWheels[i]
-      )
-    );
-
-    mSession->AddChannel(
-      OpenMotorsport::Channel(
-        channelID++, 
-        kChannelTemperatureRight,
-        mSamplingInterval,
-        kUnitsCelcius, 
-        kWheels[i]
-      )
-    );
+    for(int j = 0; j < kWheelChannels; ++j) {
+      mSession->AddChannel(
+        OpenMotorsport::Channel(
+          channelID++, 
+          kWheelChannelDefinitions[j].name,
+          mSamplingInterval, 
+          kWheelChannelDefinitions[j].units, 
+          kWheels[i]
+        )
+      );
+    }
+  }
+  applyTolerances();
+  mWheelSampler->Attach(*mSession);
+
+  // The channels SampleBlock writes directly
+  mBuffers[kBufferLapDelta] = 
+    &mSession->GetChannel(kChannelLapDelta, kGroupPosition).GetDataBuffer();
+  mBuffers[kBufferGear] = 
+    &mSession->GetChannel(kChannelGear, kGroupDriver).GetDataBuffer();
+  mBuffers[kBufferRPM] = 
+    &mSession->GetChannel(kChannelRPM, kGroupEngine).GetDataBuffer();
+  mBuffers[kBufferClutchRPM] = 
+    &mSession->GetChannel(kChannelClutchRPM, kGroupEngine).GetDataBuffer();
+  mBuffers[kBufferFuel] = 
+    &mSession->GetChannel(kChannelFuel, kGroupEngine).GetDataBuffer();
+  mBuffers[kBufferOverheating] = 
+    &mSession->GetChannel(kChannelOverheating, kGroupEngine).GetDataBuffer();
+}
+
+// Gives each channel named by the Tolerances option (in every group) its
+// tolerance, as "Name=tolerance;Name=tolerance".
+void LoggingPlugin::applyTolerances()
+{
+  std::vector<OpenMotorsport::Channel*> channels;
+  mSession->GetChannels(channels);
+
+  std::stringstream option(mConfiguration->GetString(kConfigurationTolerances));
+  std::string entry;
+  while(std::getline(option, entry, ';')) {
+    size_t separator = entry.rfind('=');
+    size_t first = entry.find_first_not_of(" \t\r\n");
+    if(separator == std::string::npos || first >= separator) continue;
+    size_t last = entry.find_last_not_of(" \t", separator - 1);
+    std::string name = entry.substr(first, last - first + 1);
+    float tolerance = (float) atof(entry.c_str() + separator + 1);
+    for(size_t i = 0; i < channels.size(); ++i) {
+      if(channels[i]->GetName() == name)
+        channels[i]->GetDataBuffer().SetTolerance(tolerance);
+    }
   }
 }
 
@@ -25,7 +25,7 @@
 #include "InternalsPlugin.hpp"
 #include <string>
 
-namespace OpenMotorsport { class Session; }
+namespace OpenMotorsport { class Session; class DataBuffer; }
 
 #define LOG_INFO 0
 #define LOG_ERROR 1
@@ -102,39 +102,87 @@ public:
    * Saves a block of telemetry into the current session.
    *
    * @param info The instance of TelemInfoV2 to sample.
+   * @param elapsed The time of the sample since logging started (in seconds).
    */
-  void SampleBlock(const TelemInfoV2& info);
+  void SampleBlock(const TelemInfoV2& info, float elapsed);
 
   /**
-   * Creates a new instance of OpenMotorsport::Session.
+   * Creates a new instance of OpenMotorsport::Session. It is kept (and
+   * cleared) for every later logging period until the plugin is destroyed.
    */
   void CreateLoggingSession();
 
 private:
+  // The buffers SampleBlock writes every sample, the inputs in the order
+  // they are added (see CreateLoggingSession)
+  enum SampleBuffer
+  {
+    kBufferLocalAccelX, kBufferLocalAccelY, kBufferLocalAccelZ,
+    kBufferLocalVelX, kBufferLocalVelY, kBufferLocalVelZ,
+    kBufferOriXx, kBufferOriYx, kBufferOriZx,
+    kBufferOriXz, kBufferOriYz, kBufferOriZz,
+    kBufferPosX, kBufferPosY, kBufferPosZ,
+    kBufferThrottle, kBufferBrake, kBufferClutch, kBufferSteering,
+    kBufferLapDelta, kBufferGear, kBufferRPM, kBufferClutchRPM, kBufferFuel,
+    kBufferOverheating,
+    kSampleBuffers
+  };
+
+  // Resolved once when the session is created rather than looked up by
+  // name (a string built and hashed) for every sample
+  OpenMotorsport::DataBuffer* mBuffers[kSampleBuffers];
+
   // Maintaining the game state between the Scoring/Telemetry updates.
   signed char mCurrentSector;
   unsigned char mEnterPhase;
   unsigned char mCurrentPhase;
+  float mSessionCurrentET;
+  float mSessionEndET;
+  long mSessionMaxLaps;
   int mEnterLapNumber;
   int mCurrentLapNumber;
   bool mSavedMetaData;
   bool mIsLogging;
 
   class Configuration* mConfiguration;
+  class WheelSampler* mWheelSampler;
+  class GridSampler* mGridSampler;
+  class LapDelta* mLapDelta;
+  class TrackMap* mTrackMap;
+  class PerformanceMonitor* mMonitor;
+  class TraceRecorder* mTracer;
+  class TelemetryPublisher* mPublisher;
+  class TelemetryStreamer* mStreamer;
   int mSamplingInterval;
   float mSamplingIntervalSeconds;
-  float mTimeSinceLastSample;
-
-  float mTotalElapsed;
-  float mFirstLapET;
 
-  bool mHasPreviousPosition;
-  TelemVect3 mPreviousPosition;
-  float mCumulativeDistance;
+  // Seconds since logging started, summed in double so that the grid and the
+  // markers do not drift over a long session
+  double mTotalElapsed;
+  double mFirstLapET;
+
+  // Maintaining the lap delta
+  long mDeltaLapNumber;
+  double mDeltaLapStartET;
+  float mDeltaLapDistance;
+  float mPreviousDelta;      // the delta of the frame before the latest
+  bool mLapDistanceKnown;    // mDeltaLapDistance is measured along the track
+  bool mInPits;
+  std::string mDeltaTrack;
+  std::string mDeltaVehicle;
 private:
   void stopLogging();
   void startLogging(const TelemInfoV2 &info);
   void saveSession();
+  size_t estimateSessionSamples();
+  void applyTolerances();
+  void updatePerformanceCounters();
+  void logPerformance();
+  void saveTrace();
+  void updateLapDelta(const TelemInfoV2& info);
+  void loadTrackMap(const ScoringInfoV2& info);
+  void saveTrackMap();
+  std::string trackMapPath(const std::string& track);
   bool isCurrentlyLogging();
   void saveSectorTime(const ScoringInfoV2& info,
                       const VehicleScoringInfoV2& vinfo);
@@ -0,0 +1,470 @@
+/* iobuffered.c -- Buffered IO functions for writing .zip files
+   Added by Martin Galpin (m@66laps.com)
+
+   See iobuffered.h for a description.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "zlib.h"
+#include "ioapi.h"
+#include "iobuffered.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <malloc.h>
+typedef HANDLE BUFFEREDFILE_HANDLE;
+#define BUFFEREDFILE_INVALID_HANDLE INVALID_HANDLE_VALUE
+#else
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+typedef int BUFFEREDFILE_HANDLE;
+#define BUFFEREDFILE_INVALID_HANDLE (-1)
+#endif
+
+typedef struct
+{
+    BUFFEREDFILE_HANDLE hf;
+    BUFFEREDFILE_OPTIONS* options;
+    char* buffer;          /* write-back buffer, NULL when unbuffered */
+    ZPOS64_T buffer_pos;   /* file offset of buffer[0] */
+    uLong buffer_used;     /* bytes of buffer holding data */
+    ZPOS64_T position;     /* logical file position */
+    ZPOS64_T size;         /* logical file size */
+    ZPOS64_T allocated;    /* bytes preallocated, 0 when not preallocating */
+    char* filename;        /* final name, NULL when written in place */
+    char* temp_filename;
+    int error;
+} BUFFEREDFILE;
+
+
+/****************************************************************************/
+/* Platform specific file access.                                          */
+/****************************************************************************/
+
+#ifdef _WIN32
+
+static BUFFEREDFILE_HANDLE buffered_os_open(const char* filename, int mode)
+{
+    DWORD access = GENERIC_READ;
+    DWORD disposition = OPEN_EXISTING;
+    DWORD share = FILE_SHARE_READ;
+
+    if ((mode & ZLIB_FILEFUNC_MODE_READWRITEFILTER) != ZLIB_FILEFUNC_MODE_READ)
+    {
+        access = GENERIC_WRITE | GENERIC_READ;
+        share = 0;
+        if (mode & ZLIB_FILEFUNC_MODE_CREATE)
+            disposition = CREATE_ALWAYS;
+    }
+    return CreateFileA(filename, access, share, NULL, disposition,
+                       FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+}
+
+static int buffered_os_seek(BUFFEREDFILE_HANDLE hf, ZPOS64_T pos)
+{
+    LARGE_INTEGER li;
+    li.QuadPart = (LONGLONG)pos;
+    return SetFilePointerEx(hf, li, NULL, FILE_BEGIN) ? 0 : -1;
+}
+
+static uLong buffered_os_pwrite(BUFFEREDFILE_HANDLE hf, ZPOS64_T pos, const void* buf, uLong size)
+{
+    DWORD written = 0;
+    if (buffered_os_seek(hf, pos) != 0 || !WriteFile(hf, buf, size, &written, NULL))
+        return 0;
+    return written;
+}
+
+static uLong buffered_os_pread(BUFFEREDFILE_HANDLE hf, ZPOS64_T pos, void* buf, uLong size)
+{
+    DWORD read = 0;
+    if (buffered_os_seek(hf, pos) != 0 || !ReadFile(hf, buf, size, &read, NULL))
+        return 0;
+    return read;
+}
+
+static ZPOS64_T buffered_os_size(BUFFEREDFILE_HANDLE hf)
+{
+    LARGE_INTEGER li;
+    if (!GetFileSizeEx(hf, &li))
+        return 0;
+    return (ZPOS64_T)li.QuadPart;
+}
+
+static int buffered_os_truncate(BUFFEREDFILE_HANDLE hf, ZPOS64_T size)
+{
+    if (buffered_os_seek(hf, size) != 0 || !SetEndOfFile(hf))
+        return -1;
+    return 0;
+}
+
+static int buffered_os_preallocate(BUFFEREDFILE_HANDLE hf, ZPOS64_T size)
+{
+    /* Extending the end of file reserves the clusters up front. */
+    return buffered_os_truncate(hf, size);
+}
+
+static int buffered_os_close(BUFFEREDFILE_HANDLE hf)
+{
+    return CloseHandle(hf) ? 0 : -1;
+}
+
+static int buffered_os_replace(const char* from, const char* to)
+{
+    return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING) ? 0 : -1;
+}
+
+static void buffered_os_remove(const char* filename)
+{
+    DeleteFileA(filename);
+}
+
+static char* buffered_os_alloc(uLong size)
+{
+    return (char*)_aligned_malloc(size, BUFFEREDFILE_ALIGNMENT);
+}
+
+static void buffered_os_free(char* buffer)
+{
+    _aligned_free(buffer);
+}
+
+#else
+
+static BUFFEREDFILE_HANDLE buffered_os_open(const char* filename, int mode)
+{
+    int flags = O_RDONLY;
+
+    if ((mode & ZLIB_FILEFUNC_MODE_READWRITEFILTER) != ZLIB_FILEFUNC_MODE_READ)
+    {
+        flags = O_RDWR;
+        if (mode & ZLIB_FILEFUNC_MODE_CREATE)
+            flags |= O_CREAT | O_TRUNC;
+    }
+    return open(filename, flags, 0644);
+}
+
+static uLong buffered_os_pwrite(BUFFEREDFILE_HANDLE hf, ZPOS64_T pos, const void* buf, uLong size)
+{
+    uLong done = 0;
+    while (done < size)
+    {
+        ssize_t n = pwrite(hf, (const char*)buf + done, size - done, (off_t)(pos + done));
+        if (n <= 0)
+            break;
+        done += (uLong)n;
+    }
+    return done;
+}
+
+static uLong buffered_os_pread(BUFFEREDFILE_HANDLE hf, ZPOS64_T pos, void* buf, uLong size)
+{
+    uLong done = 0;
+    while (done < size)
+    {
+        ssize_t n = pread(hf, (char*)buf + done, size - done, (off_t)(pos + done));
+        if (n <= 0)
+            break;
+        done += (uLong)n;
+    }
+    return done;
+}
+
+static ZPOS64_T buffered_os_size(BUFFEREDFILE_HANDLE hf)
+{
+    off_t size = lseek(hf, 0, SEEK_END);
+    return size < 0 ? 0 : (ZPOS64_T)size;
+}
+
+static int buffered_os_truncate(BUFFEREDFILE_HANDLE hf, ZPOS64_T size)
+{
+    return ftruncate(hf, (off_t)size);
+}
+
+static int buffered_os_preallocate(BUFFEREDFILE_HANDLE hf, ZPOS64_T size)
+{
+    return posix_fallocate(hf, 0, (off_t)size) == 0 ? 0 : -1;
+}
+
+static int buffered_os_close(BUFFEREDFILE_HANDLE hf)
+{
+    return close(hf);
+}
+
+static int buffered_os_replace(const char* from, const char* to)
+{
+    return rename(from, to);
+}
+
+static void buffered_os_remove(const char* filename)
+{
+    unlink(filename);
+}
+
+static char* buffered_os_alloc(uLong size)
+{
+    void* buffer = NULL;
+    if (posix_memalign(&buffer, BUFFEREDFILE_ALIGNMENT, size) != 0)
+        return NULL;
+    return (char*)buffer;
+}
+
+static void buffered_os_free(char* buffer)
+{
+    free(buffer);
+}
+
+#endif
+
+
+/****************************************************************************/
+/* Buffering.                                                               */
+/****************************************************************************/
+
+static void buffered_grow(BUFFEREDFILE* bf, ZPOS64_T end)
+{
+    /* The estimate was short. Grow geometrically so that a poor estimate
+       costs a few more preallocations rather than one per flush. */
+    ZPOS64_T allocated = bf->allocated + bf->allocated / 2;
+    if (allocated < end)
+        allocated = end;
+    if (buffered_os_preallocate(bf->hf, allocated) == 0)
+        bf->allocated = allocated;
+    else
+        bf->allocated = 0;
+}
+
+static int buffered_flush(BUFFEREDFILE* bf)
+{
+    if (bf->buffer_used > 0)
+    {
+        if (bf->allocated > 0 && bf->buffer_pos + bf->buffer_used > bf->allocated)
+            buffered_grow(bf, bf->buffer_pos + bf->buffer_used);
+        if (buffered_os_pwrite(bf->hf, bf->buffer_pos, bf->buffer, bf->buffer_used) != bf->buffer_used)
+            bf->error = -1;
+        bf->buffer_pos += bf->buffer_used;
+        bf->buffer_used = 0;
+    }
+    return bf->error;
+}
+
+voidpf ZCALLBACK buffered_open64_file_func (voidpf opaque, const void* filename, int mode)
+{
+    BUFFEREDFILE* bf;
+    const char* path = (const char*)filename;
+
+    if (filename == NULL)
+        return NULL;
+
+    bf = (BUFFEREDFILE*)malloc(sizeof(BUFFEREDFILE));
+    if (bf == NULL)
+        return NULL;
+    memset(bf, 0, sizeof(BUFFEREDFILE));
+    bf->options = (BUFFEREDFILE_OPTIONS*)opaque;
+
+    if (mode & ZLIB_FILEFUNC_MODE_CREATE)
+    {
+        size_t length = strlen(path);
+        bf->filename = (char*)malloc(length + 1);
+        bf->temp_filename = (char*)malloc(length + sizeof(BUFFEREDFILE_TEMP_SUFFIX));
+        bf->buffer = buffered_os_alloc(BUFFEREDFILE_BUFFER_SIZE);
+        if (bf->filename == NULL || bf->temp_filename == NULL || bf->buffer == NULL)
+            goto fail;
+        strcpy(bf->filename, path);
+        strcpy(bf->temp_filename, path);
+        strcat(bf->temp_filename, BUFFEREDFILE_TEMP_SUFFIX);
+        path = bf->temp_filename;
+    }
+
+    bf->hf = buffered_os_open(path, mode);
+    if (bf->hf == BUFFEREDFILE_INVALID_HANDLE)
+        goto fail;
+
+    if (bf->buffer == NULL)
+        bf->size = buffered_os_size(bf->hf);
+    else if (bf->options != NULL && bf->options->estimated_size > 0 &&
+             buffered_os_preallocate(bf->hf, bf->options->estimated_size) == 0)
+        bf->allocated = bf->options->estimated_size; /* only a hint */
+
+    return bf;
+
+fail:
+    if (bf->buffer != NULL)
+        buffered_os_free(bf->buffer);
+    free(bf->filename);
+    free(bf->temp_filename);
+    free(bf);
+    return NULL;
+}
+
+uLong ZCALLBACK buffered_read_file_func (voidpf opaque, voidpf stream, void* buf, uLong size)
+{
+    BUFFEREDFILE* bf = (BUFFEREDFILE*)stream;
+    uLong read;
+
+    if (bf == NULL || buffered_flush(bf) != 0)
+        return 0;
+
+    read = buffered_os_pread(bf->hf, bf->position, buf, size);
+    bf->position += read;
+    bf->buffer_pos = bf->position;
+    return read;
+}
+
+uLong ZCALLBACK buffered_write_file_func (voidpf opaque, voidpf stream, const void* buf, uLong size)
+{
+    BUFFEREDFILE* bf = (BUFFEREDFILE*)stream;
+    const char* data = (const char*)buf;
+    uLong remaining = size;
+
+    if (bf == NULL)
+        return 0;
+
+    if (bf->buffer == NULL)
+    {
+        uLong written = buffered_os_pwrite(bf->hf, bf->position, buf, size);
+        if (written != size)
+            bf->error = -1;
+        bf->position += written;
+        if (bf->position > bf->size)
+            bf->size = bf->position;
+        return written;
+    }
+
+    while (remaining > 0 && bf->error == 0)
+    {
+        uLong chunk;
+
+        if (bf->position < bf->buffer_pos)
+        {
+            /* Patching data that has already gone to disk (e.g. the crc
+               and sizes in a local header). Write it through directly. */
+            chunk = remaining;
+            if (bf->position + chunk > bf->buffer_pos)
+                chunk = (uLong)(bf->buffer_pos - bf->position);
+            if (buffered_os_pwrite(bf->hf, bf->position, data, chunk) != chunk)
+                bf->error = -1;
+        }
+        else
+        {
+            uLong offset;
+
+            /* Start a new window if the write would leave a hole. */
+            if (bf->position > bf->buffer_pos + bf->buffer_used)
+            {
+                buffered_flush(bf);
+                bf->buffer_pos = bf->position;
+            }
+
+            offset = (uLong)(bf->position - bf->buffer_pos);
+            chunk = BUFFEREDFILE_BUFFER_SIZE - offset;
+            if (chunk > remaining)
+                chunk = remaining;
+
+            memcpy(bf->buffer + offset, data, chunk);
+            if (offset + chunk > bf->buffer_used)
+                bf->buffer_used = offset + chunk;
+            if (bf->buffer_used == BUFFEREDFILE_BUFFER_SIZE)
+                buffered_flush(bf);
+        }
+
+        data += chunk;
+        remaining -= chunk;
+        bf->position += chunk;
+    }
+
+    if (bf->position > bf->size)
+        bf->size = bf->position;
+    return size - remaining;
+}
+
+ZPOS64_T ZCALLBACK buffered_tell64_file_func (voidpf opaque, voidpf stream)
+{
+    BUFFEREDFILE* bf = (BUFFEREDFILE*)stream;
+    if (bf == NULL)
+        return (ZPOS64_T)-1;
+    return bf->position;
+}
+
+long ZCALLBACK buffered_seek64_file_func (voidpf opaque, voidpf stream, ZPOS64_T offset, int origin)
+{
+    BUFFEREDFILE* bf = (BUFFEREDFILE*)stream;
+    if (bf == NULL)
+        return -1;
+
+    /* Nothing touches the disk here; writes are positioned explicitly. */
+    switch (origin)
+    {
+    case ZLIB_FILEFUNC_SEEK_CUR :
+        bf->position += offset;
+        break;
+    case ZLIB_FILEFUNC_SEEK_END :
+        bf->position = bf->size + offset;
+        break;
+    case ZLIB_FILEFUNC_SEEK_SET :
+        bf->position = offset;
+        break;
+    default: return -1;
+    }
+    return 0;
+}
+
+int ZCALLBACK buffered_close_file_func (voidpf opaque, voidpf stream)
+{
+    BUFFEREDFILE* bf = (BUFFEREDFILE*)stream;
+    int ret = 0;
+
+    if (bf == NULL)
+        return -1;
+
+    if (bf->buffer != NULL)
+    {
+        int discard = bf->options != NULL && bf->options->discard;
+
+        if (buffered_flush(bf) != 0 || buffered_os_truncate(bf->hf, bf->size) != 0)
+            ret = -1;
+        if (buffered_os_close(bf->hf) != 0)
+            ret = -1;
+        if (bf->options != NULL)
+            bf->options->written_size = bf->size;
+
+        if (ret == 0 && !discard)
+            ret = buffered_os_replace(bf->temp_filename, bf->filename);
+        if (ret != 0 || discard)
+            buffered_os_remove(bf->temp_filename);
+
+        buffered_os_free(bf->buffer);
+    }
+    else if (buffered_os_close(bf->hf) != 0)
+    {
+        ret = -1;
+    }
+
+    free(bf->filename);
+    free(bf->temp_filename);
+    free(bf);
+    return ret;
+}
+
+int ZCALLBACK buffered_error_file_func (voidpf opaque, voidpf stream)
+{
+    BUFFEREDFILE* bf = (BUFFEREDFILE*)stream;
+    if (bf == NULL)
+        return -1;
+    return bf->error;
+}
+
+void fill_buffered_filefunc64 (zlib_filefunc64_def* pzlib_filefunc_def, BUFFEREDFILE_OPTIONS* options)
+{
+    pzlib_filefunc_def->zopen64_file = buffered_open64_file_func;
+    pzlib_filefunc_def->zread_file = buffered_read_file_func;
+    pzlib_filefunc_def->zwrite_file = buffered_write_file_func;
+    pzlib_filefunc_def->ztell64_file = buffered_tell64_file_func;
+    pzlib_filefunc_def->zseek64_file = buffered_seek64_file_func;
+    pzlib_filefunc_def->zclose_file = buffered_close_file_func;
+    pzlib_filefunc_def->zerror_file = buffered_error_file_func;
+    pzlib_filefunc_def->opaque = options;
+}
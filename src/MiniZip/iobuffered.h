@@ -0,0 +1,62 @@
+/* iobuffered.h -- Buffered IO functions for writing .zip files
+   Added by Martin Galpin (m@66laps.com)
+
+   A zlib_filefunc64_def backend for zip.c that:
+
+   - coalesces writes into a large aligned buffer, so local headers, deflate
+     output and the central directory reach the disk in a few large writes.
+   - writes the small header patches made when an entry is closed (crc and
+     sizes) directly, without disturbing the buffer.
+   - preallocates the file from an estimated size, extends the preallocation
+     by half as much again whenever the estimate falls short, and trims the
+     file on close.
+   - writes to "<filename>.tmp" and renames it over <filename> on close, so
+     an incomplete archive is never left under the real name.
+
+   Files opened for reading (or appending) are used in place and unbuffered.
+
+   Usage:
+      zlib_filefunc64_def filefunc;
+      BUFFEREDFILE_OPTIONS options = { estimatedSize, 0 };
+      fill_buffered_filefunc64(&filefunc, &options);
+      zf = zipOpen2_64(filename, APPEND_STATUS_CREATE, NULL, &filefunc);
+      ...
+      options.discard = 1; // on failure, removes the temporary file instead
+      zipClose(zf, NULL);
+      // options.written_size now holds the size of the file
+*/
+
+#ifndef _IOBUFFERED_H
+#define _IOBUFFERED_H
+
+#ifndef _ZLIBIOAPI64_H
+#include "ioapi.h"
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Size of the write buffer, also the alignment of sequential writes. */
+#ifndef BUFFEREDFILE_BUFFER_SIZE
+#define BUFFEREDFILE_BUFFER_SIZE (1024 * 1024)
+#endif
+
+#define BUFFEREDFILE_ALIGNMENT 4096
+#define BUFFEREDFILE_TEMP_SUFFIX ".tmp"
+
+typedef struct
+{
+    ZPOS64_T estimated_size; /* bytes to preallocate on create, 0 for none */
+    int discard;             /* when set, close deletes the file instead of renaming it */
+    ZPOS64_T written_size;   /* set on close to the size of the file written */
+} BUFFEREDFILE_OPTIONS;
+
+void fill_buffered_filefunc64 OF((zlib_filefunc64_def* pzlib_filefunc_def,
+                                  BUFFEREDFILE_OPTIONS* options));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _IOBUFFERED_H */
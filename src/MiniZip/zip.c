@@ -2005,30 +2005,96 @@ extern int ZEXPORT zipRemoveExtraInfoBlock (char* pData, int* dataLen, short sHe
 
 extern int ZEXPORT zipWriteNewFile (zipFile file, const char* filename, struct tm* date, const void* buf, unsigned len)
 {
-  int err = ZIP_OK;
+  return zipWriteNewFile64(file, filename, date, buf, (ZPOS64_T)len);
+}
+
+extern int ZEXPORT zipWriteNewFile64 (zipFile file, const char* filename, struct tm* date, const void* buf, ZPOS64_T len)
+{
+  return zipWriteNewFileParts64(file, filename, date, &buf, &len, 1);
+}
+
+/* Flushes the deflate stream of the open entry to a byte boundary (ending
+   with the empty stored block 00 00 ff ff). The final block written on close
+   is then always the empty fixed block 03 00. */
+local int zip64SyncFlush(zip64_internal* zi)
+{
+    int err = Z_OK;
+
+    if ((zi->ci.method != Z_DEFLATED) || (zi->ci.raw))
+        return ZIP_OK;
+
+    zi->ci.stream.avail_in = 0;
+    do
+    {
+        uLong uTotalOutBefore;
+        if (zi->ci.stream.avail_out == 0)
+        {
+            if (zip64FlushWriteBuffer(zi) == ZIP_ERRNO)
+                return ZIP_ERRNO;
+            zi->ci.stream.avail_out = (uInt)Z_BUFSIZE;
+            zi->ci.stream.next_out = zi->ci.buffered_data;
+        }
+        uTotalOutBefore = zi->ci.stream.total_out;
+        err = deflate(&zi->ci.stream, Z_SYNC_FLUSH);
+        zi->ci.pos_in_buffered_data += (uInt)(zi->ci.stream.total_out - uTotalOutBefore);
+    } while ((err == Z_OK) && (zi->ci.stream.avail_out == 0));
+
+    return (err == Z_OK || err == Z_BUF_ERROR) ? ZIP_OK : ZIP_INTERNALERROR;
+}
 
-  zip_fileinfo zi;
-  zi.tmz_date.tm_sec = date->tm_sec;
-  zi.tmz_date.tm_min = date->tm_min;
-  zi.tmz_date.tm_hour = date->tm_hour;
-  zi.tmz_date.tm_mday = date->tm_mday;
-  zi.tmz_date.tm_mon = date->tm_mon;
-  zi.tmz_date.tm_year = date->tm_year;
-  zi.dosDate = 0;
-  zi.internal_fa = 0;
+extern int ZEXPORT zipWriteNewFileParts64 (zipFile file, const char* filename, struct tm* date, const void* const* bufs, const ZPOS64_T* lens, unsigned count)
+{
+  int err = ZIP_OK;
+  ZPOS64_T total = 0;
+  unsigned i;
+
+  zip_fileinfo zi;
+  zi.tmz_date.tm_sec = date->tm_sec;
+  zi.tmz_date.tm_min = date->tm_min;
+  zi.tmz_date.tm_hour = date->tm_hour;
+  zi.tmz_date.tm_mday = date->tm_mday;
+  zi.tmz_date.tm_mon = date->tm_mon;
+  zi.tmz_date.tm_year = date->tm_year;
+  zi.dosDate = 0;
+  zi.internal_fa = 0;
   zi.external_fa = 0;
 
-  err = zipOpenNewFileInZip(
-        file,
-        filename,
-        &zi,
-        NULL,0,NULL,0,NULL /* comment */,
-        Z_DEFLATED,
-        Z_DEFAULT_COMPRESSION
-  );
-
+  for( i = 0; i < count; i++ )
+    total += lens[i];
+
+  err = zipOpenNewFileInZip64(
+        file,
+        filename,
+        &zi,
+        NULL,0,NULL,0,NULL /* comment */,
+        Z_DEFLATED,
+        Z_DEFAULT_COMPRESSION,
+        total >= ZIP64_WRITE_THRESHOLD /* zip64 */
+  );
+
+  if( err != ZIP_OK )
+    return err;
+
+  for( i = 0; err == ZIP_OK && i < count; i++ )
+  {
+    const char* pos = (const char*)bufs[i];
+    ZPOS64_T len = lens[i];
+
+    // zipWriteInFileInZip takes an unsigned length so feed it in pieces
+    while( err == ZIP_OK && len > 0 )
+    {
+      unsigned chunk = len > ZIP64_WRITE_CHUNK ? ZIP64_WRITE_CHUNK : (unsigned)len;
+      err = zipWriteInFileInZip(file, pos, chunk);
+      pos += chunk;
+      len -= chunk;
+    }
+  }
+
+  if( err == ZIP_OK )
+    err = zip64SyncFlush((zip64_internal*)file);
+
   if( err != ZIP_OK )
     return err;
 
-  return zipWriteInFileInZip(file, buf, len);
-}
\ No newline at end of file
+  return zipCloseFileInZip(file);
+}
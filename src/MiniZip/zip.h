@@ -368,6 +368,47 @@ extern int ZEXPORT zipWriteNewFile OF((zipFile file,
                        const void* buf,
                        unsigned len));
 
+/*
+  zipWriteNewFile64 - Added by Martin Galpin (m@66laps.com)
+
+  As zipWriteNewFile but for buffers of any size. A zip64 extended information
+  block is added to the local header when the entry could reach 4 GB (the
+  threshold leaves room for deflate expanding incompressible data) and the
+  archive switches to zip64 records on close when its offsets require it.
+  Use with zipOpen64 so the archive itself can grow beyond 4 GB.
+ */
+#ifndef ZIP64_WRITE_THRESHOLD
+#define ZIP64_WRITE_THRESHOLD ((ZPOS64_T)0xF0000000)
+#endif
+#ifndef ZIP64_WRITE_CHUNK
+#define ZIP64_WRITE_CHUNK 0x10000000
+#endif
+
+extern int ZEXPORT zipWriteNewFile64 OF((zipFile file,
+                       const char* filename,
+                       struct tm* date,
+                       const void* buf,
+                       ZPOS64_T len));
+
+/*
+  zipWriteNewFileParts64 - Added by Martin Galpin (m@66laps.com)
+
+  As zipWriteNewFile64 but the contents are gathered from count separate
+  buffers (bufs[i] of lens[i] bytes), written one after the other as a
+  single entry. The buffers need not be contiguous in memory.
+
+  The deflate stream is flushed to a byte boundary before the final block,
+  so every entry ends with 00 00 ff ff 03 00. Dropping the last two bytes
+  leaves a stream that another can be appended to without recompression
+  (see Session::Merge).
+ */
+extern int ZEXPORT zipWriteNewFileParts64 OF((zipFile file,
+                       const char* filename,
+                       struct tm* date,
+                       const void* const* bufs,
+                       const ZPOS64_T* lens,
+                       unsigned count));
+
 
 
 
@@ -20,111 +20,1251 @@
   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 */
 #include <windows.h>
+#include <limits.h>
+#include <math.h>
 #include <stdio.h>
+#include <string.h>
 #include <time.h> 
 #include <sstream>
+#include <algorithm>
+#include <deque>
 
 #include "OpenMotorsport.hpp"
 #include "tinyxml.h"
 #include "zip.h"
+#include "unzip.h"
+#include "iobuffered.h"
 #include "Utilities.hpp"
 
 // xmlns namespace for meta.xml
 #define kXmlBaseNamespace "http://66laps.org/ns/openmotorsport-1.0"
 
-// Initial capacity for a data buffer (3000 samples is 10 minutes @ 5Hz)
-#define kDataBufferInitialCapacity 3000
-
 // Check for existance of a key in an std unsorted_map
 #define MAP_HAS_KEY(map, key) !(map.find(key) == map.end())
 
+// Upper bound on the local and central headers written for one ZIP entry
+#define kZipEntryOverhead 256
+
+// The compressed size of the data of a session as a part of its stored size,
+// used to estimate the size of the first file written
+#define kZipCompressionRatio 0.5
+
+// Number of samples read from a channel entry at a time
+#define kReadChunkSamples 16384
+
+// Number of samples rebuilt from the points of a channel at a time
+#define kRebuildChunkSamples 256
+
+// Bytes recompressed at a time when merging
+#define kMergeChunkBytes (256 * 1024)
+
+// The end of every deflate stream written by zipWriteNewFileParts64: a sync
+// flush (an empty stored block) then an empty final block, which is dropped
+// to append another stream
+#define kJoinableTail "\x00\x00\xff\xff\x03\x00"
+#define kJoinableTailLength 6
+#define kFinalBlockLength 2
+
 namespace OpenMotorsport 
 {
   Session::Session() :
-    mNumSectors(kSessionNoSectors),
-    mVehicleCategory(kSessionNoVehicleCategory),
-    mFullName(kSessionNoUser),
-    mTrackName(kSessionNoTrackName),
-    mVehicleName(kSessionNoVehicleName),
-    mDataSource(kSessionNoDataSource),
-    mDuration(kSessionNoSampleDuration)
+    mLapEndMarkers(0),
+    mMarkersPerLap(0),
+    mCompressionRatio(kZipCompressionRatio),
+    mTracer(NULL),
+    mRunLengthEncoding(false)
+  {
+    _resetMetadata();
+  }
+
+  // Marks a phase for a tracer (if there is one) for the life of the scope.
+  class TraceSpan
+  {
+  public:
+    TraceSpan(Tracer* tracer, const char* name, int arg = kTraceNoArg) : 
+      mTracer(tracer) {
+      if(mTracer) mTracer->Begin(name, arg);
+    }
+    ~TraceSpan() {
+      if(mTracer) mTracer->End();
+    }
+  private:
+    Tracer* mTracer;
+  };
+
+  // Whether two samples are the same, bit for bit.
+  static inline bool SameSample(float a, float b)
+  {
+    return memcmp(&a, &b, sizeof(float)) == 0;
+  }
+
+  // The sample at a given index on the line between two points.
+  static inline float Interpolate(const DataBuffer::Point& from,
+                                  const DataBuffer::Point& to, size_t index)
+  {
+    if(to.index == from.index) return from.value;
+    return (float) (from.value + ((double) to.value - from.value) *
+      (double) (index - from.index) / (double) (to.index - from.index));
+  }
+
+  // A point as it is stored in the data of a channel (see PointDecoder).
+  struct PointRecord
   {
+    unsigned int count;
+    float value;
+  };
+
+  // Describes the points of a buffer with a tolerance as records.
+  static void EncodePoints(const DataBuffer& buffer, 
+                           std::vector<PointRecord>& records)
+  {
+    DataBuffer::PointList points;
+    buffer.GetPoints(points);
+    records.resize(points.size());
+    unsigned int next = 0;
+    for(size_t i = 0; i < points.size(); ++i) {
+      records[i].count = points[i].index + 1 - next;
+      records[i].value = points[i].value;
+      next = points[i].index + 1;
+    }
+  }
+
+  // Describes the samples of a buffer as run length records (see
+  // RunLengthDecoder) to be written as the parts of an entry. Literal samples
+  // are left where they are, so only the counts and the repeated samples
+  // are stored.
+  class RunLengthEncoder
+  {
+  public:
+    RunLengthEncoder() : mSize(0), mRunCount(0), mRunValue(0.0f) {}
+
+    void Encode(const DataBuffer& buffer) {
+      const DataBuffer::ChunkList& chunks = buffer.GetChunks();
+      for(DataBuffer::ChunkList::const_iterator chunk = chunks.begin();
+        chunk != chunks.end(); ++chunk)
+      {
+        const float* data = chunk->data;
+        size_t length = chunk->length;
+
+        // a run may continue from the end of the previous chunk
+        size_t i = 0;
+        while(mRunCount > 0 && i < length && SameSample(data[i], mRunValue)) {
+          ++i;
+          ++mRunCount;
+        }
+        if(i < length) _endRun();
+
+        size_t literal = i;
+        while(i < length) {
+          size_t j = i + 1;
+          while(j < length && SameSample(data[j], data[i])) ++j;
+          if(j - i >= kRunLengthMinRun || j == length) {
+            _literal(data + literal, i - literal);
+            mRunValue = data[i];
+            mRunCount = j - i;
+            if(j < length) _endRun();
+            literal = j;
+          }
+          i = j;
+        }
+      }
+      _endRun();
+    }
+
+    // The size of the encoded data (in bytes).
+    size_t GetSize() const { return mSize; }
+
+    const std::vector<const void*>& GetParts() const { return mParts; }
+    const std::vector<ZPOS64_T>& GetLengths() const { return mLengths; }
+
+    void Clear() {
+      mRecords.clear();
+      mParts.clear();
+      mLengths.clear();
+      mSize = 0;
+    }
+
+  private:
+    struct Record
+    {
+      int count;
+      float value;
+    };
+
+    void _literal(const float* samples, size_t count) {
+      if(count == 0) return;
+      Record record = { (int) count, 0.0f };
+      mRecords.push_back(record);
+      _addPart(&mRecords.back().count, sizeof(int));
+      _addPart(samples, count * sizeof(float));
+    }
+
+    void _endRun() {
+      while(mRunCount > 0) {
+        size_t count = mRunCount < INT_MAX ? mRunCount : INT_MAX;
+        Record record = { -(int) count, mRunValue };
+        mRecords.push_back(record);
+        _addPart(&mRecords.back(), sizeof(Record));
+        mRunCount -= count;
+      }
+    }
+
+    void _addPart(const void* data, size_t length) {
+      mParts.push_back(data);
+      mLengths.push_back(length);
+      mSize += length;
+    }
+
+  private:
+    std::deque<Record> mRecords; // never moved once added
+    std::vector<const void*> mParts;
+    std::vector<ZPOS64_T> mLengths;
+    size_t mSize;
+    size_t mRunCount;
+    float mRunValue;
+  };
+
+  void Session::_resetMetadata()
+  {
+    mNumSectors = kSessionNoSectors;
+    mVehicleCategory = kSessionNoVehicleCategory;
+    mFullName = kSessionNoUser;
+    mTrackName = kSessionNoTrackName;
+    mVehicleName = kSessionNoVehicleName;
+    mDataSource = kSessionNoDataSource;
+    mComments.clear();
+    mDuration = kSessionNoSampleDuration;
+    mStartTime = 0;
+    mProperties.clear();
+    mFiles.clear();
+
     // Initialise default date
     time_t rawtime;
     time ( &rawtime );
-    mDate = localtime ( &rawtime );
+    mDate = *localtime ( &rawtime );
+  }
+
+  void Session::Clear()
+  {
+    for(ChannelsMap::iterator it = mChannels.begin(); it != mChannels.end(); ++it) {
+      it->second.GetDataBuffer().Clear();
+      it->second.GetTimeBuffer().Clear();
+      it->second.ClearStatistics();
+    }
+    for(InputsMap::iterator it = mInputs.begin(); it != mInputs.end(); ++it)
+      it->second.Clear();
+    for(DerivedChannelsList::iterator it = mDerivedChannels.begin();
+      it != mDerivedChannels.end(); ++it)
+      it->function->Reset();
+    mAllocator.Reset();
+    mMarkers.clear();
+    mLapEnds.clear();
+    mLapEndMarkers = 0;
+    _resetMetadata();
   }
 
   Session::~Session()
   {
+    _clearDerivedChannels();
+  }
+
+  void Session::_clearDerivedChannels()
+  {
+    for(DerivedChannelsList::iterator it = mDerivedChannels.begin();
+      it != mDerivedChannels.end(); ++it)
+      delete it->function;
+    mDerivedChannels.clear();
+    mInputs.clear();
   }
 
   void Session::Write(const std::string& fileName)
   {   
     int error;
     zipFile zf;
+    {
+      TraceSpan span(mTracer, "UpdateStatistics");
+      UpdateStatistics();
+    }
+
+    // decide how each channel is stored, as meta.xml declares it
+    std::vector<RunLengthEncoder> encoders(mChannels.size());
+    std::vector<std::vector<PointRecord> > points(mChannels.size());
+    {
+      TraceSpan span(mTracer, "Encode channels");
+      size_t i = 0;
+      for(ChannelsMap::iterator it = this->mChannels.begin();
+        it != this->mChannels.end(); ++it, ++i)
+      {
+        Channel& channel = it->second;
+        size_t times = channel.GetTimeBuffer().GetLength();
+        if(times > 0 && (channel.GetSampleInterval() > 0 ||
+            times != channel.GetDataBuffer().GetLength())) {
+          throw "Channel times do not match its samples.";
+        }
+        if(channel.GetDataBuffer().GetTolerance() > 0.0f) {
+          EncodePoints(channel.GetDataBuffer(), points[i]);
+          channel.SetEncoding(Channel::kEncodingPoints, 
+            channel.GetDataBuffer().GetLength());
+          continue;
+        }
+        channel.SetEncoding(Channel::kEncodingRaw);
+        size_t size = channel.GetDataBuffer().GetSize();
+        if(!mRunLengthEncoding || size == 0) continue;
+
+        encoders[i].Encode(channel.GetDataBuffer());
+        if(encoders[i].GetSize() <= size - size / kRunLengthMinSaving)
+          channel.SetEncoding(Channel::kEncodingRunLength, 
+            channel.GetDataBuffer().GetLength());
+        else
+          encoders[i].Clear();
+      }
+    }
+
+    std::string metaXml;
+    {
+      TraceSpan span(mTracer, "Build meta.xml");
+      metaXml = _writeMetaXml();
+    }
+
+    // Buffer the archive in memory and preallocate it on disk. The size is
+    // estimated from the stored (uncompressed) size and the compression of
+    // the last file written; the file grows if that is short and is
+    // trimmed on close.
+    ZPOS64_T stored = metaXml.size();
+    ZPOS64_T overhead = kZipEntryOverhead;
+    for(FilesMap::const_iterator it = mFiles.begin(); it != mFiles.end(); ++it) {
+      stored += it->second.size();
+      overhead += kZipEntryOverhead;
+    }
+    for(ChannelsMap::iterator it = this->mChannels.begin();
+      it != this->mChannels.end(); ++it)
+    {
+      stored += it->second.GetDataBuffer().GetSize();
+      overhead += kZipEntryOverhead;
+      if(it->second.GetTimeBuffer().GetLength() > 0) {
+        stored += it->second.GetTimeBuffer().GetSize();
+        overhead += kZipEntryOverhead;
+      }
+    }
+    BUFFEREDFILE_OPTIONS options;
+    options.estimated_size = (ZPOS64_T) (stored * mCompressionRatio) + overhead;
+    options.discard = 0;
+    options.written_size = 0;
+
+    zlib_filefunc64_def filefunc;
+    fill_buffered_filefunc64(&filefunc, &options);
     
-    zf = zipOpen(fileName.c_str(), APPEND_STATUS_CREATE);
+    zf = zipOpen2_64(fileName.c_str(), APPEND_STATUS_CREATE, NULL, &filefunc);
     if(zf == NULL) {
       throw "Failed to open OpenMotorsport file writing.";
     }
 
-    // write the meta.xml to the ZIP file
-    std::string metaXml = _writeMetaXml();
-    error = zipWriteNewFile(zf, "meta.xml", mDate,
-        metaXml.c_str(), metaXml.size());
-    if(error != ZIP_OK) {
-      throw "Failed to write OpenMotorsport/meta.xml.";
+    try {
+      // write the meta.xml to the ZIP file
+      {
+        TraceSpan span(mTracer, "Deflate meta.xml");
+        error = zipWriteNewFile64(zf, "meta.xml", &mDate,
+            metaXml.c_str(), metaXml.size());
+      }
+      if(error != ZIP_OK) {
+        throw "Failed to write OpenMotorsport/meta.xml.";
+      }
+
+      // write any other files
+      for(FilesMap::const_iterator it = mFiles.begin(); it != mFiles.end(); ++it) {
+        error = zipWriteNewFile64(zf, it->first.c_str(), &mDate,
+            it->second.data(), it->second.size());
+        if(error != ZIP_OK) {
+          throw "Failed to write OpenMotorsport file.";
+        }
+      }
+
+      // write channel data to ZIP file
+      size_t index = 0;
+      for(ChannelsMap::iterator it = this->mChannels.begin();
+        it != this->mChannels.end(); ++it, ++index)
+      {
+        Channel& channel = it->second;
+        TraceSpan span(mTracer, "Deflate channel", channel.GetId());
+        
+        char dataFileName[MAX_PATH];
+        sprintf(dataFileName, "data/%d.bin", channel.GetId());
+
+        // the chunks are written in place rather than joined first
+        const DataBuffer::ChunkList& chunks = channel.GetDataBuffer().GetChunks();
+        std::vector<const void*> parts;
+        std::vector<ZPOS64_T> lengths;
+        if(channel.GetEncoding() == Channel::kEncodingPoints) {
+          if(!points[index].empty()) {
+            parts.push_back(&points[index][0]);
+            lengths.push_back(points[index].size() * sizeof(PointRecord));
+          }
+        }
+        else if(channel.GetEncoding() == Channel::kEncodingRunLength) {
+          parts = encoders[index].GetParts();
+          lengths = encoders[index].GetLengths();
+        }
+        else {
+          for(DataBuffer::ChunkList::const_iterator chunk = chunks.begin();
+            chunk != chunks.end(); ++chunk)
+          {
+            if(chunk->length == 0) continue;
+            parts.push_back(chunk->data);
+            lengths.push_back(chunk->length * sizeof(float));
+          }
+        }
+
+        error = zipWriteNewFileParts64(zf, dataFileName, &mDate,
+          parts.empty() ? NULL : &parts[0],
+          lengths.empty() ? NULL : &lengths[0], (unsigned) parts.size());
+        if(error != ZIP_OK) {
+          throw "Failed to write channel data.";
+        }
+
+        // and the time of each sample, only if the interval is variable
+        if(channel.GetTimeBuffer().GetLength() == 0) continue;
+        const DataBuffer::ChunkList& times = channel.GetTimeBuffer().GetChunks();
+        parts.clear();
+        lengths.clear();
+        for(DataBuffer::ChunkList::const_iterator chunk = times.begin();
+          chunk != times.end(); ++chunk)
+        {
+          if(chunk->length == 0) continue;
+          parts.push_back(chunk->data);
+          lengths.push_back(chunk->length * sizeof(float));
+        }
+        sprintf(dataFileName, "data/%d.time.bin", channel.GetId());
+        error = zipWriteNewFileParts64(zf, dataFileName, &mDate,
+          &parts[0], &lengths[0], (unsigned) parts.size());
+        if(error != ZIP_OK) {
+          throw "Failed to write channel data.";
+        }
+      }
+    }
+    catch(const char*) {
+      // never leave a partial file behind
+      options.discard = 1;
+      zipClose(zf, NULL);
+      throw;
     }
 
-    // write channel data to ZIP file
-    for(ChannelsMap::iterator it = this->mChannels.begin();
-      it != this->mChannels.end(); ++it)
+    {
+      TraceSpan span(mTracer, "Close zip");
+      error = zipClose(zf,NULL);
+    }
+    if (error != ZIP_OK) {
+      throw "Failed to close OpenMotorsport file.";
+    }
+    if(stored > 0 && options.written_size > overhead)
+      mCompressionRatio = (double) (options.written_size - overhead) / stored;
+  }
+
+  // Reads the whole of the named entry into the given buffer.
+  static bool ReadZipEntry(unzFile uf, const char* name, std::vector<char>& out)
+  {
+    unz_file_info64 info;
+    if(unzLocateFile(uf, name, 0) != UNZ_OK ||
+        unzGetCurrentFileInfo64(uf, &info, NULL, 0, NULL, 0, NULL, 0) != UNZ_OK ||
+        unzOpenCurrentFile(uf) != UNZ_OK)
+      return false;
+
+    out.resize((size_t) info.uncompressed_size);
+    int read = out.size() ? unzReadCurrentFile(uf, &out[0], out.size()) : 0;
+    return unzCloseCurrentFile(uf) == UNZ_OK && read == (int) out.size();
+  }
+
+  // Reads a channel entry (of a given encoding and number of samples) into a
+  // data buffer a chunk at a time (or, for points, at once).
+  static bool ReadChannelEntry(unzFile uf, const char* name, DataBuffer& buffer,
+                               Channel::Encoding encoding, size_t samples)
+  {
+    if(encoding == Channel::kEncodingPoints) {
+      std::vector<char> data;
+      if(!ReadZipEntry(uf, name, data) || data.size() % sizeof(PointRecord) != 0)
+        return false;
+      size_t next = 0;
+      for(size_t i = 0; i < data.size(); i += sizeof(PointRecord)) {
+        PointRecord record;
+        memcpy(&record, &data[i], sizeof(PointRecord));
+        if(record.count == 0) return false;
+        next += record.count;
+        buffer.WritePoint(next - 1, record.value);
+      }
+      return next == samples;
+    }
+
+    unz_file_info64 info;
+    if(unzLocateFile(uf, name, 0) != UNZ_OK ||
+        unzGetCurrentFileInfo64(uf, &info, NULL, 0, NULL, 0, NULL, 0) != UNZ_OK ||
+        unzOpenCurrentFile(uf) != UNZ_OK)
+      return false;
+
+    // the number of samples comes from meta.xml and is not trusted beyond
+    // what the entry can hold as literals (longer runs grow the buffer)
+    bool runLength = encoding == Channel::kEncodingRunLength;
+    size_t reserve = (size_t) (info.uncompressed_size / sizeof(float));
+    if(runLength && samples < reserve) reserve = samples;
+    buffer.Reserve(reserve);
+
+    std::vector<float> chunk(kReadChunkSamples);
+    std::vector<float> decoded;
+    RunLengthDecoder decoder;
+    int read;
+    while((read = unzReadCurrentFile(uf, &chunk[0],
+        kReadChunkSamples * sizeof(float))) > 0) {
+      if(runLength) {
+        decoder.Decode(&chunk[0], read, decoded);
+        if(!decoded.empty()) buffer.Write(&decoded[0], decoded.size());
+        decoded.clear();
+      }
+      else {
+        buffer.Write(&chunk[0], read / sizeof(float));
+      }
+    }
+    return unzCloseCurrentFile(uf) == UNZ_OK && read == 0 && 
+      decoder.IsComplete();
+  }
+
+  void Session::Read(const std::string& fileName)
+  {
+    _read(fileName, true);
+  }
+
+  void Session::ReadMetadata(const std::string& fileName)
+  {
+    _read(fileName, false);
+  }
+
+  void Session::_read(const std::string& fileName, bool withData)
+  {
+    unzFile uf = unzOpen64(fileName.c_str());
+    if(uf == NULL) {
+      throw "Failed to open OpenMotorsport file for reading.";
+    }
+
+    try {
+      std::vector<char> metaXml;
+      if(!ReadZipEntry(uf, "meta.xml", metaXml)) {
+        throw "Failed to read OpenMotorsport/meta.xml.";
+      }
+      metaXml.push_back('\0');
+
+      TiXmlDocument doc;
+      doc.Parse(&metaXml[0]);
+      if(doc.Error() || !doc.RootElement()) {
+        throw "Failed to parse OpenMotorsport/meta.xml.";
+      }
+      _readMetaXml(doc.RootElement());
+
+      // read channel data from ZIP file
+      for(ChannelsMap::iterator it = this->mChannels.begin();
+        withData && it != this->mChannels.end(); ++it)
+      {
+        Channel& channel = it->second;
+
+        char dataFileName[MAX_PATH];
+        sprintf(dataFileName, "data/%d.bin", channel.GetId());
+
+        if(!ReadChannelEntry(uf, dataFileName, channel.GetDataBuffer(),
+            channel.GetEncoding(), channel.GetEncodedSamples())) {
+          throw "Failed to read channel data.";
+        }
+
+        // the times of a variable interval channel (if it has them)
+        sprintf(dataFileName, "data/%d.time.bin", channel.GetId());
+        if(channel.GetSampleInterval() > 0 ||
+            unzLocateFile(uf, dataFileName, 0) != UNZ_OK)
+          continue;
+        if(!ReadChannelEntry(uf, dataFileName, channel.GetTimeBuffer(),
+            Channel::kEncodingRaw, 0) || channel.GetTimeBuffer().GetLength() !=
+            channel.GetDataBuffer().GetLength()) {
+          throw "Failed to read channel data.";
+        }
+      }
+      _readStatisticsXml(doc.RootElement());
+
+      // any other file is kept for GetFile()
+      mFiles.clear();
+      std::vector<std::string> names;
+      char name[MAX_PATH];
+      for(int status = unzGoToFirstFile(uf); status == UNZ_OK; 
+        status = unzGoToNextFile(uf))
+      {
+        if(unzGetCurrentFileInfo64(uf, NULL, name, sizeof(name),
+            NULL, 0, NULL, 0) != UNZ_OK)
+          throw "Failed to read OpenMotorsport file.";
+        if(strcmp(name, "meta.xml") != 0 && strncmp(name, "data/", 5) != 0)
+          names.push_back(name);
+      }
+      for(size_t i = 0; i < names.size(); ++i) {
+        std::vector<char> data;
+        if(!ReadZipEntry(uf, names[i].c_str(), data)) {
+          throw "Failed to read OpenMotorsport file.";
+        }
+        mFiles[names[i]] = data.empty() ? std::string() : 
+          std::string(&data[0], data.size());
+      }
+    }
+    catch(const char*) {
+      unzClose(uf);
+      throw;
+    }
+
+    unzClose(uf);
+  }
+
+  // Reads the whole of the named entry still compressed.
+  static bool ReadRawZipEntry(unzFile uf, const char* name, int& method,
+                              std::vector<char>& out)
+  {
+    unz_file_info64 info;
+    int level;
+    if(unzLocateFile(uf, name, 0) != UNZ_OK ||
+        unzGetCurrentFileInfo64(uf, &info, NULL, 0, NULL, 0, NULL, 0) != UNZ_OK ||
+        unzOpenCurrentFile2(uf, &method, &level, 1) != UNZ_OK)
+      return false;
+
+    out.resize((size_t) info.compressed_size);
+    int read = out.size() ? unzReadCurrentFile(uf, &out[0], out.size()) : 0;
+    return unzCloseCurrentFile(uf) == UNZ_OK && read == (int) out.size();
+  }
+
+  // Inflates the named entry and deflates it again into the open raw entry,
+  // ending with a sync flush (so another stream can follow) unless last.
+  static bool RecompressZipEntry(unzFile uf, const char* name, zipFile zf,
+                                 bool last)
+  {
+    if(unzLocateFile(uf, name, 0) != UNZ_OK || unzOpenCurrentFile(uf) != UNZ_OK)
+      return false;
+
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if(deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 
+        8, Z_DEFAULT_STRATEGY) != Z_OK) {
+      unzCloseCurrentFile(uf);
+      return false;
+    }
+
+    std::vector<char> in(kMergeChunkBytes), out(kMergeChunkBytes);
+    bool ok = true;
+    int read;
+    do {
+      read = unzReadCurrentFile(uf, &in[0], in.size());
+      if(read < 0) {
+        ok = false;
+        break;
+      }
+      int flush = read > 0 ? Z_NO_FLUSH : (last ? Z_FINISH : Z_SYNC_FLUSH);
+      stream.next_in = (Bytef*) &in[0];
+      stream.avail_in = read;
+      do {
+        stream.next_out = (Bytef*) &out[0];
+        stream.avail_out = out.size();
+        deflate(&stream, flush);
+        unsigned int length = out.size() - stream.avail_out;
+        if(length > 0 && zipWriteInFileInZip(zf, &out[0], length) != ZIP_OK)
+          ok = false;
+      } while(ok && stream.avail_out == 0);
+    } while(ok && read > 0);
+
+    deflateEnd(&stream);
+    return unzCloseCurrentFile(uf) == UNZ_OK && ok;
+  }
+
+  // Deflates a few bytes into the open raw entry, ending with a sync flush so
+  // that another stream can follow.
+  static bool WriteDeflatedPrefix(zipFile zf, const void* data, 
+                                  unsigned int length)
+  {
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if(deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 
+        8, Z_DEFAULT_STRATEGY) != Z_OK)
+      return false;
+
+    unsigned char out[64];
+    stream.next_in = (Bytef*) data;
+    stream.avail_in = length;
+    stream.next_out = out;
+    stream.avail_out = sizeof(out);
+    bool ok = deflate(&stream, Z_SYNC_FLUSH) == Z_OK && stream.avail_in == 0 &&
+      stream.avail_out > 0;
+    deflateEnd(&stream);
+    return ok && zipWriteInFileInZip(zf, out, sizeof(out) - stream.avail_out) == ZIP_OK;
+  }
+
+  // The data of a channel in one of the files being merged.
+  struct MergeEntry
+  {
+    unz_file_info64 info;
+    Channel::Encoding encoding;
+    size_t samples;
+  };
+
+  // Closes the files being merged.
+  struct MergeInputs
+  {
+    std::vector<unzFile> files;
+    ~MergeInputs() {
+      for(size_t i = 0; i < files.size(); ++i) unzClose(files[i]);
+    }
+  };
+
+  void Session::Merge(const std::vector<std::string>& fileNames,
+                      const std::string& fileName)
+  {
+    if(fileNames.empty()) {
+      throw "No OpenMotorsport files to merge.";
+    }
+
+    Session merged;
+    merged.ReadMetadata(fileNames[0]);
+    std::vector<Channel*> channels;
+    merged.GetChannels(channels);
+
+    // the entry of each channel (by order of id) in each file
+    MergeInputs inputs;
+    std::vector<std::vector<MergeEntry> > entries(fileNames.size());
+    std::vector<bool> runLength(channels.size(), false);
+    std::vector<float> tolerances(channels.size(), 0.0f);
+    std::vector<bool> timed(channels.size(), false);
+    std::vector<int> shifts(fileNames.size(), 0);
+    ZPOS64_T timeBytes = 0;
+    int offset = 0;
+    for(size_t i = 0; i < fileNames.size(); ++i) {
+      Session session;
+      std::vector<Channel*> sessionChannels;
+      if(i == 0) {
+        sessionChannels = channels;
+      } else {
+        session.ReadMetadata(fileNames[i]);
+        session.GetChannels(sessionChannels);
+      }
+      // the times of this session are moved to where its samples begin
+      int start = i == 0 ? merged.mStartTime : session.mStartTime;
+      shifts[i] = merged.mStartTime + offset - start;
+      if(sessionChannels.size() != channels.size()) {
+        throw "Sessions to merge have different channels.";
+      }
+
+      unzFile uf = unzOpen64(fileNames[i].c_str());
+      if(uf == NULL) {
+        throw "Failed to open OpenMotorsport file for reading.";
+      }
+      inputs.files.push_back(uf);
+
+      // the samples of this session start after the longest channel so far
+      int length = 0;
+      for(size_t j = 0; j < channels.size(); ++j) {
+        const Channel& channel = *sessionChannels[j];
+        if(channel.GetId() != channels[j]->GetId() ||
+            channel.GetName() != channels[j]->GetName() ||
+            channel.GetGroup() != channels[j]->GetGroup() ||
+            channel.GetSampleInterval() != channels[j]->GetSampleInterval()) {
+          throw "Sessions to merge have different channels.";
+        }
+
+        char dataFileName[MAX_PATH];
+        sprintf(dataFileName, "data/%d.bin", channel.GetId());
+        MergeEntry entry;
+        if(unzLocateFile(uf, dataFileName, 0) != UNZ_OK ||
+            unzGetCurrentFileInfo64(uf, &entry.info, NULL, 0, NULL, 0, NULL, 0) != UNZ_OK) {
+          throw "Failed to read channel data.";
+        }
+        entry.encoding = channel.GetEncoding();
+        entry.samples = entry.encoding != Channel::kEncodingRaw ? 
+          channel.GetEncodedSamples() :
+          (size_t) (entry.info.uncompressed_size / sizeof(float));
+        entries[i].push_back(entry);
+        if(entry.encoding == Channel::kEncodingRunLength) runLength[j] = true;
+
+        // points cannot be joined to samples
+        float tolerance = channel.GetDataBuffer().GetTolerance();
+        if((entry.encoding == Channel::kEncodingPoints) != 
+            (entries[0][j].encoding == Channel::kEncodingPoints)) {
+          throw "Sessions to merge store a channel differently.";
+        }
+        if(tolerance > tolerances[j]) tolerances[j] = tolerance;
+
+        if(channel.GetSampleInterval() > 0) {
+          int duration = (int) entry.samples * channel.GetSampleInterval();
+          if(duration > length) length = duration;
+          continue;
+        }
+
+        // a variable interval channel has its times in every session or none
+        sprintf(dataFileName, "data/%d.time.bin", channel.GetId());
+        bool hasTimes = unzLocateFile(uf, dataFileName, 0) == UNZ_OK;
+        if(i == 0) timed[j] = hasTimes;
+        if(hasTimes != timed[j]) {
+          throw "Sessions to merge store a channel differently.";
+        }
+        std::vector<char> times;
+        if(hasTimes && !ReadZipEntry(uf, dataFileName, times)) {
+          throw "Failed to read channel data.";
+        }
+        if(times.size() >= sizeof(float)) {
+          float last;
+          memcpy(&last, &times[times.size() - sizeof(float)], sizeof(float));
+          int duration = (int) last + 1 - start;
+          if(duration > length) length = duration;
+        }
+        if(hasTimes) timeBytes += times.size() + kZipEntryOverhead;
+      }
+      if(i == 0) {
+        offset = length;
+        continue;
+      }
+
+      for(size_t j = 0; j < session.mMarkers.size(); ++j)
+        merged.mMarkers.push_back(shifts[i] + session.mMarkers[j]);
+      offset += length;
+      if(merged.mDuration >= 0 && session.mDuration >= 0)
+        merged.mDuration += session.mDuration;
+
+      // the last lap of one session continues into the first of the next
+      for(size_t j = 0; j < channels.size(); ++j) {
+        std::vector<Statistics> laps = channels[j]->GetStatistics();
+        const std::vector<Statistics>& next = sessionChannels[j]->GetStatistics();
+        for(size_t k = 0; k < next.size(); ++k) {
+          if(k == 0 && !laps.empty())
+            laps.back().Add(next[k]);
+          else
+            laps.push_back(next[k]);
+        }
+        channels[j]->SetStatistics(laps, 0);
+      }
+    }
+
+    // a channel encoded in any file is encoded in the result
+    for(size_t j = 0; j < channels.size(); ++j) {
+      size_t samples = 0;
+      for(size_t i = 0; i < entries.size(); ++i)
+        samples += entries[i][j].samples;
+      if(entries[0][j].encoding == Channel::kEncodingPoints) {
+        channels[j]->SetEncoding(Channel::kEncodingPoints, samples);
+        channels[j]->GetDataBuffer().SetTolerance(tolerances[j]);
+      }
+      else {
+        channels[j]->SetEncoding(runLength[j] ? 
+          Channel::kEncodingRunLength : Channel::kEncodingRaw, samples);
+      }
+    }
+
+    std::string metaXml = merged._writeMetaXml();
+
+    BUFFEREDFILE_OPTIONS options;
+    options.estimated_size = metaXml.size() + kZipEntryOverhead + timeBytes;
+    options.discard = 0;
+    options.written_size = 0;
+    for(FilesMap::const_iterator it = merged.mFiles.begin();
+      it != merged.mFiles.end(); ++it)
+      options.estimated_size += it->second.size() + kZipEntryOverhead;
+    for(size_t i = 0; i < entries.size(); ++i) {
+      for(size_t j = 0; j < entries[i].size(); ++j)
+        options.estimated_size += entries[i][j].info.compressed_size + kZipEntryOverhead;
+    }
+
+    zlib_filefunc64_def filefunc;
+    fill_buffered_filefunc64(&filefunc, &options);
+    zipFile zf = zipOpen2_64(fileName.c_str(), APPEND_STATUS_CREATE, NULL, &filefunc);
+    if(zf == NULL) {
+      throw "Failed to open OpenMotorsport file writing.";
+    }
+
+    try {
+      if(zipWriteNewFile64(zf, "meta.xml", &merged.mDate,
+          metaXml.c_str(), metaXml.size()) != ZIP_OK) {
+        throw "Failed to write OpenMotorsport/meta.xml.";
+      }
+      for(FilesMap::const_iterator it = merged.mFiles.begin();
+        it != merged.mFiles.end(); ++it)
+      {
+        if(zipWriteNewFile64(zf, it->first.c_str(), &merged.mDate,
+            it->second.data(), it->second.size()) != ZIP_OK) {
+          throw "Failed to write OpenMotorsport file.";
+        }
+      }
+
+      zip_fileinfo zi;
+      memset(&zi, 0, sizeof(zi));
+      zi.tmz_date.tm_sec = merged.mDate.tm_sec;
+      zi.tmz_date.tm_min = merged.mDate.tm_min;
+      zi.tmz_date.tm_hour = merged.mDate.tm_hour;
+      zi.tmz_date.tm_mday = merged.mDate.tm_mday;
+      zi.tmz_date.tm_mon = merged.mDate.tm_mon;
+      zi.tmz_date.tm_year = merged.mDate.tm_year;
+
+      std::vector<char> data;
+      for(size_t j = 0; j < channels.size(); ++j) {
+        char dataFileName[MAX_PATH];
+        sprintf(dataFileName, "data/%d.bin", channels[j]->GetId());
+
+        // the size and crc of the joined data follow from those of the parts
+        // (and the literal record that raw data needs in encoded data)
+        ZPOS64_T size = 0;
+        uLong crc = 0;
+        int last = -1;
+        std::vector<int> literals(entries.size(), 0);
+        for(size_t i = 0; i < entries.size(); ++i) {
+          const unz_file_info64& info = entries[i][j].info;
+          if(info.uncompressed_size == 0) continue;
+          if(runLength[j] && entries[i][j].encoding == Channel::kEncodingRaw) {
+            if(entries[i][j].samples > INT_MAX) {
+              throw "Channel data too long to merge.";
+            }
+            literals[i] = (int) entries[i][j].samples;
+            crc = crc32_combine(crc, crc32(0, (const Bytef*) &literals[i], 
+              sizeof(int)), sizeof(int));
+            size += sizeof(int);
+          }
+          crc = crc32_combine(crc, info.crc, (z_off_t) info.uncompressed_size);
+          size += info.uncompressed_size;
+          last = (int) i;
+        }
+
+        if(zipOpenNewFileInZip2_64(zf, dataFileName, &zi, NULL, 0, NULL, 0, 
+            NULL, Z_DEFLATED, Z_DEFAULT_COMPRESSION, 1 /* raw */,
+            size >= ZIP64_WRITE_THRESHOLD) != ZIP_OK) {
+          throw "Failed to write channel data.";
+        }
+
+        for(int i = 0; i <= last; ++i) {
+          if(entries[i][j].info.uncompressed_size == 0) continue;
+          if(literals[i] > 0 && !WriteDeflatedPrefix(zf, &literals[i], sizeof(int))) {
+            throw "Failed to write channel data.";
+          }
+          int method;
+          if(!ReadRawZipEntry(inputs.files[i], dataFileName, method, data)) {
+            throw "Failed to read channel data.";
+          }
+
+          // the last stream is copied whole, the others without their final
+          // block, unless they do not end as expected
+          bool joinable = method == Z_DEFLATED && data.size() >= kJoinableTailLength &&
+            memcmp(&data[data.size() - kJoinableTailLength], kJoinableTail,
+              kJoinableTailLength) == 0;
+          if(method == Z_DEFLATED && (i == last || joinable)) {
+            unsigned int length = data.size() - (i == last ? 0 : kFinalBlockLength);
+            if(zipWriteInFileInZip(zf, &data[0], length) != ZIP_OK) {
+              throw "Failed to write channel data.";
+            }
+          }
+          else if(!RecompressZipEntry(inputs.files[i], dataFileName, zf, i == last)) {
+            throw "Failed to write channel data.";
+          }
+        }
+        if(last < 0 && zipWriteInFileInZip(zf, kJoinableTail + 
+            kJoinableTailLength - kFinalBlockLength, kFinalBlockLength) != ZIP_OK) {
+          throw "Failed to write channel data.";
+        }
+
+        if(zipCloseFileInZipRaw64(zf, size, crc) != ZIP_OK) {
+          throw "Failed to write channel data.";
+        }
+
+        // the times are few enough to be moved and deflated again
+        if(!timed[j]) continue;
+        sprintf(dataFileName, "data/%d.time.bin", channels[j]->GetId());
+        std::vector<float> times;
+        for(size_t i = 0; i < entries.size(); ++i) {
+          if(!ReadZipEntry(inputs.files[i], dataFileName, data) ||
+              data.size() % sizeof(float) != 0) {
+            throw "Failed to read channel data.";
+          }
+          size_t first = times.size();
+          times.resize(first + data.size() / sizeof(float));
+          if(!data.empty()) memcpy(&times[first], &data[0], data.size());
+          for(size_t k = first; k < times.size(); ++k)
+            times[k] += (float) shifts[i];
+        }
+        if(zipWriteNewFile64(zf, dataFileName, &merged.mDate, 
+            times.empty() ? NULL : &times[0], 
+            times.size() * sizeof(float)) != ZIP_OK) {
+          throw "Failed to write channel data.";
+        }
+      }
+    }
+    catch(const char*) {
+      // never leave a partial file behind
+      options.discard = 1;
+      zipClose(zf, NULL);
+      throw;
+    }
+
+    if(zipClose(zf, NULL) != ZIP_OK) {
+      throw "Failed to close OpenMotorsport file.";
+    }
+  }
+
+  void Session::AddChannel(Channel& channel)
+  {
+    std::string key = channel.GetName() + "/" + channel.GetGroup();
+    std::pair<ChannelsMap::iterator, bool> inserted =
+      mChannels.insert(ChannelsMap::value_type(key, channel));
+    inserted.first->second.GetDataBuffer().SetAllocator(&mAllocator);
+    inserted.first->second.GetTimeBuffer().SetAllocator(&mAllocator);
+  }
+
+  DataBuffer& Session::AddInput(const std::string& name)
+  {
+    std::pair<InputsMap::iterator, bool> inserted =
+      mInputs.insert(InputsMap::value_type(name, DataBuffer()));
+    inserted.first->second.SetAllocator(&mAllocator);
+    return inserted.first->second;
+  }
+
+  DataBuffer& Session::GetInput(const std::string& name)
+  {
+    InputsMap::iterator it = mInputs.find(name);
+    if(it == mInputs.end()) throw "Input does not exist.";
+    return it->second;
+  }
+
+  void Session::AddDerivedChannel(Channel& channel, DerivedFunction* function,
+    const std::string& input1, const std::string& input2, 
+    const std::string& input3)
+  {
+    const std::string* names[kDerivedMaxInputs] = { &input1, &input2, &input3 };
+    DerivedChannel derived;
+    derived.function = function;
+    derived.numInputs = 0;
+    try {
+      for(int i = 0; i < kDerivedMaxInputs && (i == 0 || !names[i]->empty()); ++i)
+        derived.inputs[derived.numInputs++] = &GetInput(*names[i]);
+    }
+    catch(const char*) {
+      delete function;
+      throw;
+    }
+
+    AddChannel(channel);
+    derived.channel = &GetChannel(channel.GetName(), channel.GetGroup());
+    mDerivedChannels.push_back(derived);
+  }
+
+  bool Session::IsDerivedChannel(const Channel* channel) const
+  {
+    for(DerivedChannelsList::const_iterator it = mDerivedChannels.begin();
+      it != mDerivedChannels.end(); ++it)
+      if(it->channel == channel) return true;
+    return false;
+  }
+
+  float Session::DeriveLast(const Channel* channel)
+  {
+    for(size_t index = 0; index < mDerivedChannels.size(); ++index) {
+      DerivedChannel& derived = mDerivedChannels[index];
+      if(derived.channel != channel) continue;
+
+      if(derived.function->HasState()) {
+        _updateDerivedChannel(index);
+        return derived.channel->GetDataBuffer().GetLast();
+      }
+      float values[kDerivedMaxInputs];
+      const float* inputs[kDerivedMaxInputs];
+      for(size_t i = 0; i < derived.numInputs; ++i) {
+        if(derived.inputs[i]->GetLength() == 0) return 0.0f;
+        values[i] = derived.inputs[i]->GetLast();
+        inputs[i] = &values[i];
+      }
+      float value;
+      derived.function->Evaluate(inputs, 1, &value);
+      return value;
+    }
+    return 0.0f;
+  }
+
+  void Session::UpdateDerivedChannels()
+  {
+    for(size_t index = 0; index < mDerivedChannels.size(); ++index)
+      _updateDerivedChannel(index);
+  }
+
+  void Session::_updateDerivedChannel(size_t index)
+  {
+    DerivedChannel& derived = mDerivedChannels[index];
+    DataBuffer& output = derived.channel->GetDataBuffer();
+    size_t done = output.GetLength();
+    size_t total = derived.inputs[0]->GetLength();
+    for(size_t i = 1; i < derived.numInputs; ++i) {
+      if(derived.inputs[i]->GetLength() < total)
+        total = derived.inputs[i]->GetLength();
+    }
+
+    // evaluate as many samples at a time as every input holds contiguously
+    while(done < total) {
+      const float* inputs[kDerivedMaxInputs];
+      size_t count = total - done;
+      for(size_t i = 0; i < derived.numInputs; ++i) {
+        size_t available;
+        inputs[i] = derived.inputs[i]->GetSamples(done, &available);
+        if(available < count) count = available;
+      }
+      if(mDerivedScratch.size() < count)
+        mDerivedScratch.resize(count);
+      derived.function->Evaluate(inputs, count, &mDerivedScratch[0]);
+      output.Write(&mDerivedScratch[0], count);
+      done += count;
+    }
+  }
+
+  void Session::AddMarker(int marker)
+  { 
+    mMarkers.push_back(marker); 
+    _updateStatistics(false);
+  }
+
+  void Session::AddRelativeMarker(int marker)
+  { 
+    if(mMarkers.size() < 1)
+      mMarkers.push_back(marker); // no need to adjust as there is no previous
+    else
+      mMarkers.push_back(mMarkers.back() + marker); 
+    _updateStatistics(false);
+  }
+
+  // The number of samples of a channel before a time, from the start time
+  // and sample interval or else by a search of the (ordered) sample times.
+  static size_t SamplesBefore(Channel& channel, int time, int start)
+  {
+    long interval = channel.GetSampleInterval();
+    if(interval > 0)
+      return time > start ? (size_t) ((time - start) / interval) : 0;
+
+    const DataBuffer& times = channel.GetTimeBuffer();
+    size_t first = 0, last = channel.GetTimeBuffer().GetLength();
+    while(first < last) {
+      size_t middle = first + (last - first) / 2, count;
+      if(*times.GetSamples(middle, &count) < (float) time)
+        first = middle + 1;
+      else
+        last = middle;
+    }
+    return first;
+  }
+
+  void Session::UpdateStatistics()
+  {
+    _updateStatistics(true);
+  }
+
+  void Session::_updateLapEnds()
+  {
+    // the markers that end a lap, found again only if the sectors change
+    size_t markersPerLap = mNumSectors == kSessionNoSectors ? 1 : mNumSectors + 1;
+    if(markersPerLap != mMarkersPerLap || mLapEndMarkers > mMarkers.size()) {
+      mLapEnds.clear();
+      mLapEndMarkers = 0;
+      mMarkersPerLap = markersPerLap;
+    }
+    for(; mLapEndMarkers < mMarkers.size(); ++mLapEndMarkers) {
+      if(mLapEndMarkers % markersPerLap == 0)
+        mLapEnds.push_back(mMarkers[mLapEndMarkers]);
+    }
+  }
+
+  void Session::_updateStatistics(bool toEnd)
+  {
+    // a marker (on the game thread) only counts the samples already stored,
+    // derivation is left to Write() or UpdateStatistics()
+    if(toEnd)
+      UpdateDerivedChannels();
+    _updateLapEnds();
+    const std::vector<int>& lapEnds = mLapEnds;
+
+    for(ChannelsMap::iterator it = mChannels.begin(); it != mChannels.end(); ++it)
     {
       Channel& channel = it->second;
-      
-      char dataFileName[MAX_PATH];
-      sprintf(dataFileName, "data/%d.bin", channel.GetId());
 
-      error = zipWriteNewFile(zf, dataFileName, mDate,
-        channel.GetDataBuffer().GetBytes(), channel.GetDataBuffer().GetSize());
-      if(error != ZIP_OK) {
-        throw "Failed to write channel data.";
-      }
-    }
+      // nor are the samples of a channel with a tolerance rebuilt for it
+      if(!toEnd && channel.GetDataBuffer().GetTolerance() > 0.0f)
+        continue;
+      size_t length = channel.GetDataBuffer().GetLength();
+      if(channel.GetSampleInterval() <= 0 && (length == 0 ||
+          channel.GetTimeBuffer().GetLength() != length)) {
+        channel.UpdateStatistics(length);
+        continue;
+      }
+
+      // count up to the latest marker only, as the samples after it may 
+      // belong to a lap whose marker has not been added yet
+      size_t end = length;
+      if(!toEnd)
+        end = mMarkers.empty() ? 0 : 
+          SamplesBefore(channel, mMarkers.back(), mStartTime);
+
+      channel.UpdateStatistics(0);
+      while(channel.GetStatistics().size() <= lapEnds.size()) {
+        size_t lapEnd = SamplesBefore(channel, 
+          lapEnds[channel.GetStatistics().size() - 1], mStartTime);
+        if(lapEnd > length) break;
+        channel.UpdateStatistics(lapEnd);
+        channel.NextLapStatistics();
+      }
+      channel.UpdateStatistics(end);
+    }
+  }
+
+  Channel& Session::GetChannel(const std::string& channelName,
+                               const std::string& group)
+  {
+    if(!mChannels.size()) throw "No channels.";
+    std::string key = channelName + "/" + group;
+    if(!MAP_HAS_KEY(mChannels, key)) throw "Channel does not exist.";
+    return mChannels[key];
+  }
+
+  static bool CompareChannelIds(const Channel* a, const Channel* b)
+  {
+    return a->GetId() < b->GetId();
+  }
 
-    error = zipClose(zf,NULL);
-    if (error != ZIP_OK) {
-      throw "Failed to close OpenMotorsport file.";
-    }
+  void Session::GetChannels(std::vector<Channel*>& channels)
+  {
+    channels.clear();
+    channels.reserve(mChannels.size());
+    for(ChannelsMap::iterator it = mChannels.begin(); it != mChannels.end(); ++it)
+      channels.push_back(&it->second);
+    std::sort(channels.begin(), channels.end(), CompareChannelIds);
   }
 
-  void Session::AddChannel(Channel& channel)
+  void Session::Reserve(size_t samples)
   {
-    std::string key = channel.GetName() + "/" + channel.GetGroup();
-    mChannels.insert(ChannelsMap::value_type(key, channel));
+    // take the blocks for every channel from one slab (the points of a
+    // channel with a tolerance are not kept in blocks but reserved below)
+    size_t buffers = mInputs.size();
+    for(ChannelsMap::iterator it = mChannels.begin(); it != mChannels.end(); ++it)
+      if(it->second.GetDataBuffer().GetTolerance() <= 0.0f) buffers++;
+    size_t blockSamples = mAllocator.GetBlockSize() / sizeof(float);
+    mAllocator.Reserve(buffers * ((samples + blockSamples - 1) / blockSamples));
+    for(ChannelsMap::iterator it = mChannels.begin(); it != mChannels.end(); ++it)
+      it->second.GetDataBuffer().Reserve(samples);
+    for(InputsMap::iterator it = mInputs.begin(); it != mInputs.end(); ++it)
+      it->second.Reserve(samples);
   }
 
-  void Session::AddMarker(int marker)
-  { 
-    mMarkers.push_back(marker); 
+  size_t Session::GetBufferedBytes()
+  {
+    size_t bytes = 0;
+    for(ChannelsMap::iterator it = mChannels.begin(); it != mChannels.end(); ++it)
+      bytes += it->second.GetDataBuffer().GetSize() + 
+        it->second.GetTimeBuffer().GetSize();
+    for(InputsMap::iterator it = mInputs.begin(); it != mInputs.end(); ++it)
+      bytes += it->second.GetSize();
+    return bytes;
   }
 
-  void Session::AddRelativeMarker(int marker)
-  { 
-    if(mMarkers.size() < 1)
-      mMarkers.push_back(marker); // no need to adjust as there is no previous
-    else
-      mMarkers.push_back(mMarkers.back() + marker); 
+  std::string Session::GetProperty(const std::string& name) const
+  {
+    PropertiesMap::const_iterator it = mProperties.find(name);
+    return it == mProperties.end() ? std::string() : it->second;
   }
 
-  Channel& Session::GetChannel(const std::string& channelName,
-                               const std::string& group)
+  std::string Session::GetFile(const std::string& name) const
   {
-    if(!mChannels.size()) throw "No channels.";
-    std::string key = channelName + "/" + group;
-    if(!MAP_HAS_KEY(mChannels, key)) throw "Channel does not exist.";
-    return mChannels[key];
+    FilesMap::const_iterator it = mFiles.find(name);
+    return it == mFiles.end() ? std::string() : it->second;
   }
 
   std::string Session::_writeMetaXml()
@@ -156,6 +1296,7 @@ namespace OpenMotorsport
     if(this->mVehicleCategory != kSessionNoVehicleCategory) {
       node = new TiXmlElement("category");
       node->LinkEndChild(new TiXmlText(this->mVehicleCategory.c_str()));
+      vehicle->LinkEndChild(node);
     }
 
     TiXmlElement* venue = new TiXmlElement("venue");
@@ -165,7 +1306,7 @@ namespace OpenMotorsport
     venue->LinkEndChild(node);
 
     node = new TiXmlElement("date");
-    node->LinkEndChild(new TiXmlText(GetISO8601Date(this->mDate).c_str()));
+    node->LinkEndChild(new TiXmlText(GetISO8601Date(&this->mDate).c_str()));
     metadata->LinkEndChild(node);
 
     node = new TiXmlElement("datasource");
@@ -181,10 +1322,22 @@ namespace OpenMotorsport
       std::stringstream stream;
       stream << this->mDuration;
       node->LinkEndChild(new TiXmlText(stream.str().c_str()));
+      metadata->LinkEndChild(node);
+    }
+
+    for(PropertiesMap::iterator it = this->mProperties.begin();
+      it != this->mProperties.end(); ++it)
+    {
+      node = new TiXmlElement("property");
+      node->SetAttribute("name", it->first.c_str());
+      node->LinkEndChild(new TiXmlText(it->second.c_str()));
+      metadata->LinkEndChild(node);
     }
 
     // write <channels>
     TiXmlElement* channels = new TiXmlElement("channels");
+    if(mStartTime != 0)
+      channels->SetAttribute("start", mStartTime);
     root->LinkEndChild(channels);
 
     // for the channel/group hierachy map group names with a corresponding node
@@ -220,6 +1373,8 @@ namespace OpenMotorsport
       node->SetDoubleAttribute("time", *it);
       markers->LinkEndChild(node);
     }
+
+    _writeStatisticsXml(root);
     
     TiXmlPrinter printer;
     printer.SetIndent("\t");
@@ -227,6 +1382,223 @@ namespace OpenMotorsport
     return std::string(printer.CStr());
   }
 
+  // Gets the text of a (possibly nested) child element or an empty string.
+  static std::string GetChildText(const TiXmlElement* parent, const char* name,
+                                  const char* child = NULL)
+  {
+    TiXmlHandle handle(const_cast<TiXmlElement*>(parent));
+    TiXmlElement* node = child ? 
+      handle.FirstChild(name).FirstChild(child).ToElement() :
+      handle.FirstChild(name).ToElement();
+    if(node == NULL || node->GetText() == NULL) return "";
+    return node->GetText();
+  }
+
+  void Session::_readMetaXml(const TiXmlElement* root)
+  {
+    // derived channels are read as plain channels
+    _clearDerivedChannels();
+    mChannels.clear();
+    mAllocator.Reset();
+    mMarkers.clear();
+    mLapEnds.clear();
+    mLapEndMarkers = 0;
+
+    // read basic <metadata>
+    const TiXmlElement* metadata = root->FirstChildElement("metadata");
+    if(metadata != NULL) {
+      mFullName = GetChildText(metadata, "user");
+      mVehicleName = GetChildText(metadata, "vehicle", "name");
+      mVehicleCategory = GetChildText(metadata, "vehicle", "category");
+      mTrackName = GetChildText(metadata, "venue", "name");
+      mDataSource = GetChildText(metadata, "datasource");
+      mComments = GetChildText(metadata, "comments");
+
+      std::string date = GetChildText(metadata, "date");
+      struct tm parsed;
+      memset(&parsed, 0, sizeof(parsed));
+      if(sscanf(date.c_str(), "%d-%d-%dT%d:%d:%d", &parsed.tm_year, 
+          &parsed.tm_mon, &parsed.tm_mday, &parsed.tm_hour, &parsed.tm_min, 
+          &parsed.tm_sec) == 6) {
+        parsed.tm_year -= 1900;
+        parsed.tm_mon -= 1;
+        parsed.tm_isdst = -1;
+        mDate = parsed;
+      }
+
+      std::string duration = GetChildText(metadata, "duration");
+      mDuration = duration.empty() ? 
+        kSessionNoSampleDuration : (float) atof(duration.c_str());
+
+      mProperties.clear();
+      for(const TiXmlElement* node = metadata->FirstChildElement("property");
+        node; node = node->NextSiblingElement("property"))
+      {
+        const char* name = node->Attribute("name");
+        if(name != NULL)
+          mProperties[name] = node->GetText() ? node->GetText() : "";
+      }
+    }
+
+    // read <channels>, either directly beneath or within a <group>
+    const TiXmlElement* channels = root->FirstChildElement("channels");
+    mStartTime = 0;
+    if(channels != NULL) {
+      int start;
+      if(channels->QueryIntAttribute("start", &start) == TIXML_SUCCESS)
+        mStartTime = start;
+      for(const TiXmlElement* node = channels->FirstChildElement(); 
+        node; node = node->NextSiblingElement())
+      {
+        if(strcmp(node->Value(), "group") == 0) {
+          std::string group = GetChildText(node, "name");
+          for(const TiXmlElement* channel = node->FirstChildElement("channel"); 
+            channel; channel = channel->NextSiblingElement("channel"))
+            _readChannelXmlNode(channel, group);
+        }
+        else if(strcmp(node->Value(), "channel") == 0) {
+          _readChannelXmlNode(node, kChannelNoGroup);
+        }
+      }
+    }
+
+    // read <markers>
+    const TiXmlElement* markers = root->FirstChildElement("markers");
+    mNumSectors = kSessionNoSectors;
+    if(markers != NULL) {
+      int sectors;
+      if(markers->QueryIntAttribute("sectors", &sectors) == TIXML_SUCCESS)
+        mNumSectors = sectors;
+
+      for(const TiXmlElement* node = markers->FirstChildElement("marker"); 
+        node; node = node->NextSiblingElement("marker"))
+      {
+        double time;
+        if(node->QueryDoubleAttribute("time", &time) == TIXML_SUCCESS)
+          mMarkers.push_back((int) time);
+      }
+    }
+  }
+
+  void Session::_readChannelXmlNode(const TiXmlElement* node,
+                                    const std::string& group)
+  {
+    int id;
+    if(node->QueryIntAttribute("id", &id) != TIXML_SUCCESS)
+      throw "Channel without an id.";
+
+    int interval;
+    if(node->QueryIntAttribute("interval", &interval) != TIXML_SUCCESS)
+      interval = kChannelVariableSampleInterval;
+
+    const char* units = node->Attribute("units");
+    Channel channel(id, GetChildText(node, "name"), interval, 
+      units ? units : kChannelNoUnits, group);
+
+    const char* encoding = node->Attribute("encoding");
+    if(encoding != NULL) {
+      const char* samples = node->Attribute("samples");
+      unsigned long long count = 0;
+      double tolerance = 0.0;
+      if(samples == NULL || !(std::stringstream(samples) >> count))
+        throw "Unsupported channel encoding.";
+      if(strcmp(encoding, "rle") == 0) {
+        channel.SetEncoding(Channel::kEncodingRunLength, (size_t) count);
+      }
+      else if(strcmp(encoding, "points") == 0 && 
+          node->QueryDoubleAttribute("tolerance", &tolerance) == TIXML_SUCCESS &&
+          tolerance > 0.0) {
+        channel.SetEncoding(Channel::kEncodingPoints, (size_t) count);
+        channel.GetDataBuffer().SetTolerance((float) tolerance);
+      }
+      else {
+        throw "Unsupported channel encoding.";
+      }
+    }
+    AddChannel(channel);
+  }
+
+  void Session::_writeStatisticsXml(TiXmlElement* root)
+  {
+    // <statistics> has a <lap> for each lap with a <channel> for each channel
+    std::vector<Channel*> channels;
+    GetChannels(channels);
+    size_t laps = 0;
+    for(size_t i = 0; i < channels.size(); ++i) {
+      if(channels[i]->GetStatistics().size() > laps)
+        laps = channels[i]->GetStatistics().size();
+    }
+    if(laps == 0) return;
+
+    TiXmlElement* statistics = new TiXmlElement("statistics");
+    root->LinkEndChild(statistics);
+    for(size_t lap = 0; lap < laps; ++lap) {
+      TiXmlElement* lapNode = new TiXmlElement("lap");
+      lapNode->SetAttribute("number", (int) lap);
+      statistics->LinkEndChild(lapNode);
+      for(size_t i = 0; i < channels.size(); ++i) {
+        const std::vector<Statistics>& channelLaps = channels[i]->GetStatistics();
+        if(lap >= channelLaps.size() || channelLaps[lap].GetCount() == 0)
+          continue;
+        const Statistics& stats = channelLaps[lap];
+        TiXmlElement* node = new TiXmlElement("channel");
+        node->SetAttribute("id", channels[i]->GetId());
+        node->SetAttribute("count", (int) stats.GetCount());
+        node->SetDoubleAttribute("min", stats.GetMin());
+        node->SetDoubleAttribute("max", stats.GetMax());
+        node->SetDoubleAttribute("mean", stats.GetMean());
+        node->SetDoubleAttribute("stddev", stats.GetStandardDeviation());
+        lapNode->LinkEndChild(node);
+      }
+    }
+  }
+
+  void Session::_readStatisticsXml(const TiXmlElement* root)
+  {
+    std::tr1::unordered_map<int, Channel*> channels;
+    for(ChannelsMap::iterator it = mChannels.begin(); it != mChannels.end(); ++it)
+      channels[it->second.GetId()] = &it->second;
+    std::tr1::unordered_map<int, std::vector<Statistics> > laps;
+
+    const TiXmlElement* statistics = root->FirstChildElement("statistics");
+    if(statistics != NULL) {
+      for(const TiXmlElement* lapNode = statistics->FirstChildElement("lap");
+        lapNode; lapNode = lapNode->NextSiblingElement("lap"))
+      {
+        int lap;
+        if(lapNode->QueryIntAttribute("number", &lap) != TIXML_SUCCESS || lap < 0)
+          continue;
+        for(const TiXmlElement* node = lapNode->FirstChildElement("channel");
+          node; node = node->NextSiblingElement("channel"))
+        {
+          int id, count;
+          double min, max, mean, stddev;
+          if(node->QueryIntAttribute("id", &id) != TIXML_SUCCESS ||
+             node->QueryIntAttribute("count", &count) != TIXML_SUCCESS ||
+             node->QueryDoubleAttribute("min", &min) != TIXML_SUCCESS ||
+             node->QueryDoubleAttribute("max", &max) != TIXML_SUCCESS ||
+             node->QueryDoubleAttribute("mean", &mean) != TIXML_SUCCESS ||
+             node->QueryDoubleAttribute("stddev", &stddev) != TIXML_SUCCESS)
+            continue;
+          std::vector<Statistics>& channelLaps = laps[id];
+          if(channelLaps.size() <= (size_t) lap)
+            channelLaps.resize(lap + 1);
+          channelLaps[lap] = Statistics(count, (float) min, (float) max, 
+            mean, stddev);
+        }
+      }
+    }
+
+    // the statistics read cover every sample of the channel
+    for(std::tr1::unordered_map<int, Channel*>::iterator it = channels.begin();
+      it != channels.end(); ++it)
+    {
+      Channel* channel = it->second;
+      channel->SetStatistics(laps[it->first], 
+        channel->GetDataBuffer().GetLength());
+    }
+  }
+
   TiXmlElement* Session::_createGroupXmlNode(const std::string& groupName,
                                              TiXmlElement* parent) const
   {
@@ -256,6 +1628,15 @@ namespace OpenMotorsport
       node->SetAttribute("units", channel.GetUnits().c_str());
     if(channel.GetSampleInterval() != kChannelVariableSampleInterval) 
       node->SetAttribute("interval", channel.GetSampleInterval());
+    if(channel.GetEncoding() != Channel::kEncodingRaw) {
+      std::stringstream samples;
+      samples << (unsigned long long) channel.GetEncodedSamples();
+      node->SetAttribute("encoding", 
+        channel.GetEncoding() == Channel::kEncodingPoints ? "points" : "rle");
+      node->SetAttribute("samples", samples.str().c_str());
+    }
+    if(channel.GetEncoding() == Channel::kEncodingPoints)
+      node->SetDoubleAttribute("tolerance", channel.GetDataBuffer().GetTolerance());
      
     name = new TiXmlElement("name");
     name->LinkEndChild(new TiXmlText(channel.GetName().c_str()));
@@ -269,49 +1650,582 @@ namespace OpenMotorsport
 
   Channel::Channel(int id, const std::string name, long sampleInterval,
     const std::string units, const std::string group)
-    : mId(id), mName(name), mSampleInterval(sampleInterval),
-    mUnits(units), mGroup(group)
+    : mId(id), mName(name), mGroup(group), mUnits(units),
+    mSampleInterval(sampleInterval), mStatisticsSamples(0), 
+    mEncoding(kEncodingRaw), mEncodedSamples(0)
   {}
 
   Channel::~Channel() 
   {}
 
+  void Channel::UpdateStatistics(size_t end)
+  {
+    if(mStatistics.empty())
+      mStatistics.push_back(Statistics());
+    if(end > mDataBuffer.GetLength())
+      end = mDataBuffer.GetLength();
+
+    // the samples are counted a block at a time, or rebuilt a few at a time
+    // from the points of a buffer with a tolerance
+    float rebuilt[kRebuildChunkSamples];
+    while(mStatisticsSamples < end) {
+      size_t count;
+      const float* samples = mDataBuffer.GetSamples(mStatisticsSamples, &count);
+      if(samples == NULL) {
+        samples = rebuilt;
+        count = mDataBuffer.Read(mStatisticsSamples, rebuilt, 
+          kRebuildChunkSamples);
+      }
+      if(count > end - mStatisticsSamples)
+        count = end - mStatisticsSamples;
+      mStatistics.back().Add(samples, count);
+      mStatisticsSamples += count;
+    }
+  }
+
+  void Channel::NextLapStatistics()
+  {
+    if(mStatistics.empty())
+      mStatistics.push_back(Statistics());
+    mStatistics.push_back(Statistics());
+  }
+
+  void Channel::SetStatistics(const std::vector<Statistics>& statistics,
+                              size_t samples)
+  {
+    mStatistics = statistics;
+    mStatisticsSamples = samples;
+  }
+
+  void Channel::ClearStatistics()
+  {
+    mStatistics.clear();
+    mStatisticsSamples = 0;
+  }
+
+  /****************************************************************************/
+  /* Definition of OpenMotorsport::Statistics. */
+  /****************************************************************************/
+
+  Statistics::Statistics() :
+    mCount(0), mMin(0.0f), mMax(0.0f), mMean(0.0), mM2(0.0)
+  {}
+
+  Statistics::Statistics(size_t count, float min, float max, double mean,
+                         double stddev) :
+    mCount(count), mMin(min), mMax(max), mMean(mean), 
+    mM2(stddev * stddev * count)
+  {}
+
+  void Statistics::Add(float value)
+  {
+    if(mCount == 0) {
+      mMin = mMax = value;
+    }
+    else {
+      if(value < mMin) mMin = value;
+      if(value > mMax) mMax = value;
+    }
+    mCount++;
+    double delta = value - mMean;
+    mMean += delta / mCount;
+    mM2 += delta * (value - mMean);
+  }
+
+  void Statistics::Add(const float* values, size_t count)
+  {
+    for(size_t i = 0; i < count; ++i)
+      Add(values[i]);
+  }
+
+  void Statistics::Add(const Statistics& other)
+  {
+    if(other.mCount == 0) return;
+    if(mCount == 0) {
+      *this = other;
+      return;
+    }
+    if(other.mMin < mMin) mMin = other.mMin;
+    if(other.mMax > mMax) mMax = other.mMax;
+
+    // combines the means and squared differences of the two (Chan et al.)
+    size_t count = mCount + other.mCount;
+    double delta = other.mMean - mMean;
+    mMean += delta * other.mCount / count;
+    mM2 += other.mM2 + delta * delta * mCount * other.mCount / count;
+    mCount = count;
+  }
+
+  double Statistics::GetStandardDeviation() const
+  {
+    return mCount > 0 ? sqrt(mM2 / mCount) : 0.0;
+  }
+
+  /****************************************************************************/
+  /* Definition of OpenMotorsport::RunLengthDecoder. */
+  /****************************************************************************/
+
+  RunLengthDecoder::RunLengthDecoder() :
+    mWordBytes(0),
+    mLiteral(0),
+    mRun(0)
+  {}
+
+  void RunLengthDecoder::Decode(const void* data, size_t length,
+                                std::vector<float>& samples)
+  {
+    const unsigned char* bytes = (const unsigned char*) data;
+    while(length > 0) {
+      // whole literal samples are copied straight out
+      if(mWordBytes == 0 && mLiteral > 0 && length >= sizeof(float)) {
+        size_t count = length / sizeof(float);
+        if(count > mLiteral) count = mLiteral;
+        size_t end = samples.size();
+        samples.resize(end + count);
+        memcpy(&samples[end], bytes, count * sizeof(float));
+        bytes += count * sizeof(float);
+        length -= count * sizeof(float);
+        mLiteral -= count;
+        continue;
+      }
+
+      // otherwise gather the next count or sample a byte at a time
+      mWord[mWordBytes++] = *bytes++;
+      length--;
+      if(mWordBytes < sizeof(mWord)) continue;
+      mWordBytes = 0;
+
+      if(mLiteral > 0) {
+        float sample;
+        memcpy(&sample, mWord, sizeof(float));
+        samples.push_back(sample);
+        mLiteral--;
+      }
+      else if(mRun > 0) {
+        float sample;
+        memcpy(&sample, mWord, sizeof(float));
+        samples.insert(samples.end(), mRun, sample);
+        mRun = 0;
+      }
+      else {
+        int count;
+        memcpy(&count, mWord, sizeof(int));
+        if(count > 0)
+          mLiteral = (size_t) count;
+        else if(count < 0)
+          mRun = (size_t) -(long long) count;
+      }
+    }
+  }
+
+  /****************************************************************************/
+  /* Definition of OpenMotorsport::PointDecoder. */
+  /****************************************************************************/
+
+  PointDecoder::PointDecoder() :
+    mRecordBytes(0),
+    mStarted(false),
+    mPrevious(0.0f)
+  {}
+
+  void PointDecoder::Decode(const void* data, size_t length,
+                            std::vector<float>& samples)
+  {
+    const unsigned char* bytes = (const unsigned char*) data;
+    while(length > 0) {
+      mRecord[mRecordBytes++] = *bytes++;
+      length--;
+      if(mRecordBytes < sizeof(mRecord)) continue;
+      mRecordBytes = 0;
+
+      unsigned int count;
+      DataBuffer::Point to;
+      memcpy(&count, mRecord, sizeof(unsigned int));
+      memcpy(&to.value, mRecord + sizeof(unsigned int), sizeof(float));
+      if(count == 0) continue;
+
+      // nothing comes before the first point but it is repeated if it does
+      to.index = count;
+      DataBuffer::Point from = { 0, mStarted ? mPrevious : to.value };
+      for(unsigned int i = 1; i <= count; ++i)
+        samples.push_back(Interpolate(from, to, i));
+      mPrevious = to.value;
+      mStarted = true;
+    }
+  }
+
+  /****************************************************************************/
+  /* Definition of OpenMotorsport::BlockAllocator. */
+  /****************************************************************************/
+
+  BlockAllocator::BlockAllocator(size_t blockSize, size_t slabBlocks) :
+    mCurrentSlab(0),
+    mNextBlock(0),
+    mBlockSize(blockSize),
+    mSlabBlocks(slabBlocks > 0 ? slabBlocks : 1),
+    mTotalBlocks(0)
+  {}
+
+  BlockAllocator::~BlockAllocator()
+  {
+    for(size_t i = 0; i < mSlabs.size(); ++i)
+      delete[] mSlabs[i].memory;
+  }
+
+  void BlockAllocator::_addSlab(size_t blocks)
+  {
+    Slab slab;
+    slab.memory = new char[blocks * mBlockSize];
+    slab.blocks = blocks;
+    mSlabs.push_back(slab);
+    mTotalBlocks += blocks;
+
+    // every block can be released without the free list growing
+    if(mFree.capacity() < mTotalBlocks)
+      mFree.reserve(mTotalBlocks > 2 * mFree.capacity() ? 
+        mTotalBlocks : 2 * mFree.capacity());
+  }
+
+  void* BlockAllocator::Allocate()
+  {
+    if(!mFree.empty()) {
+      void* block = mFree.back();
+      mFree.pop_back();
+      return block;
+    }
+
+    while(mCurrentSlab < mSlabs.size() &&
+          mNextBlock == mSlabs[mCurrentSlab].blocks) {
+      mCurrentSlab++;
+      mNextBlock = 0;
+    }
+    if(mCurrentSlab == mSlabs.size())
+      _addSlab(mSlabBlocks);
+
+    return mSlabs[mCurrentSlab].memory + (mNextBlock++ * mBlockSize);
+  }
+
+  void BlockAllocator::Release(void* block)
+  {
+    mFree.push_back(block);
+  }
+
+  void BlockAllocator::Reserve(size_t blocks)
+  {
+    size_t available = mFree.size();
+    for(size_t i = mCurrentSlab; i < mSlabs.size(); ++i)
+      available += mSlabs[i].blocks - (i == mCurrentSlab ? mNextBlock : 0);
+    if(blocks > available)
+      _addSlab(blocks - available);
+  }
+
+  void BlockAllocator::Reset()
+  {
+    mFree.clear();
+    mCurrentSlab = 0;
+    mNextBlock = 0;
+  }
+
   /****************************************************************************/
   /* Definition of OpenMotorsport::DataBuffer. */
   /****************************************************************************/
 
-  DataBuffer::DataBuffer()
+  DataBuffer::DataBuffer() :
+    mAllocator(NULL),
+    mOwnedAllocator(NULL),
+    mCurrent(0),
+    mBlockSamples(kBlockAllocatorBlockSize / sizeof(float)),
+    mLength(0),
+    mTolerance(0.0f),
+    mLast(0.0f),
+    mSlopeMin(0.0),
+    mSlopeMax(0.0)
+  {}
+
+  DataBuffer::DataBuffer(const DataBuffer& other) :
+    mAllocator(NULL),
+    mOwnedAllocator(NULL),
+    mCurrent(0),
+    mBlockSamples(kBlockAllocatorBlockSize / sizeof(float)),
+    mLength(0),
+    mTolerance(0.0f),
+    mLast(0.0f),
+    mSlopeMin(0.0),
+    mSlopeMax(0.0)
+  {
+    _append(other);
+  }
+
+  DataBuffer& DataBuffer::operator=(const DataBuffer& other)
   {
-    mData.reserve(kDataBufferInitialCapacity);
+    if(this != &other) {
+      _releaseChunks();
+      _append(other);
+    }
+    return *this;
   }
 
   DataBuffer::~DataBuffer()
-  {}
+  {
+    _releaseChunks();
+    delete mOwnedAllocator;
+  }
+
+  void DataBuffer::SetAllocator(BlockAllocator* allocator)
+  {
+    if(allocator != NULL && allocator == mAllocator) return;
+
+    ChunkList chunks = mChunks;
+    BlockAllocator* previous = mAllocator;
+    BlockAllocator* owned = mOwnedAllocator;
+
+    mChunks.clear();
+    mCurrent = 0;
+    mLength = 0;
+    mAllocator = allocator;
+    mOwnedAllocator = NULL;
+    mBlockSamples = (allocator ? allocator->GetBlockSize() : 
+      kBlockAllocatorBlockSize) / sizeof(float);
+
+    for(ChunkList::iterator it = chunks.begin(); it != chunks.end(); ++it) {
+      Write(it->data, it->length);
+      previous->Release(it->data);
+    }
+    delete owned;
+  }
+
+  void DataBuffer::_addChunk()
+  {
+    // a buffer of its own (a copy, or one outside a session) is often short
+    // lived, so it takes its blocks one at a time rather than by the slab
+    if(mAllocator == NULL)
+      mAllocator = mOwnedAllocator = new BlockAllocator(
+        kBlockAllocatorBlockSize, 1);
+    Chunk chunk = { (float*) mAllocator->Allocate(), 0 };
+    mChunks.push_back(chunk);
+  }
+
+  void DataBuffer::_nextChunk()
+  {
+    // use the next reserved block if there is one
+    if(mChunks.empty() || mCurrent + 1 == mChunks.size())
+      _addChunk();
+    if(mChunks[mCurrent].length > 0)
+      mCurrent++;
+  }
+
+  void DataBuffer::_append(const DataBuffer& other)
+  {
+    mTolerance = other.mTolerance;
+    if(mTolerance > 0.0f) {
+      mPoints = other.mPoints;
+      mLength = other.mLength;
+      mLast = other.mLast;
+      mSlopeMin = other.mSlopeMin;
+      mSlopeMax = other.mSlopeMax;
+      return;
+    }
+    for(ChunkList::const_iterator it = other.mChunks.begin();
+      it != other.mChunks.end(); ++it)
+      Write(it->data, it->length);
+  }
+
+  void DataBuffer::_releaseChunks()
+  {
+    for(ChunkList::iterator it = mChunks.begin(); it != mChunks.end(); ++it)
+      mAllocator->Release(it->data);
+    mChunks.clear();
+    mCurrent = 0;
+    mLength = 0;
+    mPoints.clear();
+    mLast = 0.0f;
+  }
+
+  void DataBuffer::SetTolerance(float tolerance)
+  {
+    if(mLength > 0) throw "Tolerance must be set before writing.";
+    mTolerance = tolerance > 0.0f ? tolerance : 0.0f;
+  }
+
+  DataBuffer::Point DataBuffer::_lineEnd() const
+  {
+    // the point at the last sample on the line that is closest to it
+    const Point& from = mPoints.back();
+    Point end = { (unsigned int) (mLength - 1), from.value };
+    if(end.index == from.index) return from;
+    double length = end.index - from.index;
+    double slope = (mLast - (double) from.value) / length;
+    if(slope < mSlopeMin) slope = mSlopeMin;
+    if(slope > mSlopeMax) slope = mSlopeMax;
+    end.value = (float) (from.value + slope * length);
+    return end;
+  }
+
+  void DataBuffer::_writePoint(float value)
+  {
+    size_t index = mLength;
+    if(mPoints.empty()) {
+      Point point = { (unsigned int) index, value };
+      mPoints.push_back(point);
+    }
+    else {
+      const Point& from = mPoints.back();
+      double length = (double) (index - from.index);
+      double upper = (value + (double) mTolerance - from.value) / length;
+      double lower = (value - (double) mTolerance - from.value) / length;
+      if(index == from.index + 1) {
+        mSlopeMin = lower;
+        mSlopeMax = upper;
+      }
+      else if(lower <= mSlopeMax && upper >= mSlopeMin) {
+        // narrow the doors
+        if(upper < mSlopeMax) mSlopeMax = upper;
+        if(lower > mSlopeMin) mSlopeMin = lower;
+      }
+      else {
+        // the doors would cross, so the line ends at the last sample
+        mPoints.push_back(_lineEnd());
+        const Point& end = mPoints.back();
+        mSlopeMin = value - (double) mTolerance - end.value;
+        mSlopeMax = value + (double) mTolerance - end.value;
+      }
+    }
+    mLast = value;
+    mLength++;
+  }
+
+  void DataBuffer::WritePoint(size_t index, float value)
+  {
+    if(index < mLength) throw "Points must be written in order.";
+    Point point = { (unsigned int) index, value };
+    mPoints.push_back(point);
+    mLast = value;
+    mLength = index + 1;
+  }
+
+  void DataBuffer::GetPoints(PointList& points) const
+  {
+    points = mPoints;
+    if(!mPoints.empty() && mLength - 1 > mPoints.back().index)
+      points.push_back(_lineEnd());
+  }
 
   void DataBuffer::Write(float value)
   {
-    mData.push_back(value);
+    if(mTolerance > 0.0f) {
+      _writePoint(value);
+      return;
+    }
+    if(mChunks.empty() || mChunks[mCurrent].length == mBlockSamples)
+      _nextChunk();
+    Chunk& chunk = mChunks[mCurrent];
+    chunk.data[chunk.length++] = value;
+    mLength++;
+  }
+
+  void DataBuffer::Write(const float* values, size_t count)
+  {
+    if(mTolerance > 0.0f) {
+      for(size_t i = 0; i < count; ++i)
+        _writePoint(values[i]);
+      return;
+    }
+    while(count > 0) {
+      if(mChunks.empty() || mChunks[mCurrent].length == mBlockSamples)
+        _nextChunk();
+      Chunk& chunk = mChunks[mCurrent];
+      size_t n = mBlockSamples - chunk.length;
+      if(n > count) n = count;
+      memcpy(chunk.data + chunk.length, values, n * sizeof(float));
+      chunk.length += n;
+      mLength += n;
+      values += n;
+      count -= n;
+    }
   }
 
-  int DataBuffer::GetLength()
+  void DataBuffer::Clear()
   {
-    return mData.size();
+    _releaseChunks();
   }
 
-  int DataBuffer::GetSize()
+  void DataBuffer::Reserve(size_t samples)
   {
-    return mData.size() * sizeof(float);
+    if(mTolerance > 0.0f) {
+      mPoints.reserve(mPoints.size() + samples / kDataBufferSamplesPerPoint);
+      return;
+    }
+    size_t available = 0;
+    for(size_t i = mCurrent; i < mChunks.size(); ++i)
+      available += mBlockSamples - mChunks[i].length;
+    while(available < samples) {
+      _addChunk();
+      available += mBlockSamples;
+    }
   }
 
-  float* DataBuffer::GetBytes()
+  size_t DataBuffer::GetLength()
   {
-    float* data = new float[mData.size()];
-    int i = 0;
-    for(DataBufferList::iterator it = mData.begin(); it != mData.end(); ++it)
-    {
-      float value = *it;
-      data[i++] = value;
+    return mLength;
+  }
+
+  size_t DataBuffer::GetSize()
+  {
+    if(mTolerance > 0.0f) return mPoints.size() * sizeof(Point);
+    return mLength * sizeof(float);
+  }
+
+  const float* DataBuffer::GetSamples(size_t index, size_t* count) const
+  {
+    if(index >= mLength || mTolerance > 0.0f) {
+      *count = 0;
+      return NULL;
+    }
+    // every block before the current one is full
+    const Chunk& chunk = mChunks[index / mBlockSamples];
+    size_t offset = index % mBlockSamples;
+    *count = chunk.length - offset;
+    return chunk.data + offset;
+  }
+
+  float DataBuffer::GetLast() const
+  {
+    if(mLength == 0) return 0.0f;
+    if(mTolerance > 0.0f) return mLast;
+    const Chunk& chunk = mChunks[mCurrent];
+    return chunk.data[chunk.length - 1];
+  }
+
+  size_t DataBuffer::Read(size_t index, float* samples, size_t count) const
+  {
+    if(index >= mLength) return 0;
+    if(count > mLength - index) count = mLength - index;
+
+    if(mTolerance <= 0.0f) {
+      for(size_t done = 0; done < count; ) {
+        size_t available;
+        const float* data = GetSamples(index + done, &available);
+        if(available > count - done) available = count - done;
+        memcpy(samples + done, data, available * sizeof(float));
+        done += available;
+      }
+      return count;
+    }
+
+    // find the first point after the index (every sample follows the first)
+    size_t next = 0, last = mPoints.size();
+    while(next < last) {
+      size_t middle = (next + last) / 2;
+      if(mPoints[middle].index <= index) next = middle + 1;
+      else last = middle;
+    }
+    Point end = _lineEnd();
+    for(size_t i = 0; i < count; ++i) {
+      size_t sample = index + i;
+      while(next < mPoints.size() && mPoints[next].index <= sample) ++next;
+      samples[i] = Interpolate(mPoints[next - 1], 
+        next < mPoints.size() ? mPoints[next] : end, sample);
     }
-    return data;
+    return count;
   }
 }
@@ -23,6 +23,8 @@
 #ifndef OPENMOTORSPORT_HPP
 #define OPENMOTORSPORT_HPP
 
+#include <ctime>
+#include <map>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -37,55 +39,437 @@
 #define kSessionNoDataSource ""
 #define kSessionNoSectors -1
 #define kSessionNoSampleDuration -1
+#define kBlockAllocatorBlockSize (64 * 1024)
+#define kBlockAllocatorSlabBlocks 16
+#define kDataBufferSamplesPerPoint 8 // points reserved for a tolerance
+#define kDerivedMaxInputs 3
+#define kDerivedNoInput ""
+#define kRunLengthMinRun 4
+#define kRunLengthMinSaving 8 // run length encode if it saves 1/8 of the data
+#define kTraceNoArg (-1)
 
 class TiXmlElement;
 
 namespace OpenMotorsport 
 {
+  /**
+   * BlockAllocator hands out fixed size blocks of memory carved from a few
+   * large slabs, so that filling a block costs no call to the heap. Every
+   * block is freed at once when the allocator is reset or destroyed.
+   */
+  class BlockAllocator
+  {
+  public:
+    /**
+     * Constructs a new instance of BlockAllocator.
+     *
+     * @param blockSize The size of every block (in bytes).
+     * @param slabBlocks The number of blocks in each slab taken when the
+     *   allocator runs out (more only if Reserve() asks for them).
+     */
+    BlockAllocator(size_t blockSize = kBlockAllocatorBlockSize,
+      size_t slabBlocks = kBlockAllocatorSlabBlocks);
+
+    /**
+     * Deconstructor. Frees every slab.
+     */
+    ~BlockAllocator();
+
+    /**
+     * @return A block of GetBlockSize() bytes.
+     */
+    void* Allocate();
+
+    /**
+     * Returns a block so that it can be allocated again.
+     *
+     * @param block A block from Allocate().
+     */
+    void Release(void* block);
+
+    /**
+     * Makes sure a number of blocks can be allocated without another slab.
+     *
+     * @param blocks The number of blocks.
+     */
+    void Reserve(size_t blocks);
+
+    /**
+     * Makes every block available again, keeping the slabs.
+     */
+    void Reset();
+
+    /**
+     * @return The size of every block (in bytes).
+     */
+    size_t GetBlockSize() const { return mBlockSize; }
+
+    /**
+     * @return The number of slabs allocated from the heap so far.
+     */
+    size_t GetAllocations() const { return mSlabs.size(); }
+
+  private:
+    BlockAllocator(const BlockAllocator&);
+    BlockAllocator& operator=(const BlockAllocator&);
+
+    void _addSlab(size_t blocks);
+
+  private:
+    struct Slab
+    {
+      char* memory;
+      size_t blocks;
+    };
+    std::vector<Slab> mSlabs;
+    std::vector<void*> mFree;
+    size_t mCurrentSlab;
+    size_t mNextBlock;
+    size_t mBlockSize;
+    size_t mSlabBlocks;
+    size_t mTotalBlocks;
+  };
+
+  /**
+   * Running statistics (count, minimum, maximum, mean and standard
+   * deviation) of a series of samples, updated one sample at a time with
+   * Welford's method so that it is stable over long series.
+   */
+  class Statistics
+  {
+  public:
+    /**
+     * Default constructor (no samples).
+     */
+    Statistics();
+
+    /**
+     * Constructs statistics from their summary (as read from a file).
+     *
+     * @param count The number of samples.
+     * @param min The smallest sample.
+     * @param max The largest sample.
+     * @param mean The mean.
+     * @param stddev The (population) standard deviation.
+     */
+    Statistics(size_t count, float min, float max, double mean, double stddev);
+
+    /**
+     * Adds a sample.
+     *
+     * @param value The sample.
+     */
+    void Add(float value);
+
+    /**
+     * Adds a number of samples.
+     *
+     * @param values The samples.
+     * @param count The number of samples.
+     */
+    void Add(const float* values, size_t count);
+
+    /**
+     * Adds the samples summarised by other statistics (as if they had been
+     * added one at a time).
+     *
+     * @param other The statistics to add.
+     */
+    void Add(const Statistics& other);
+
+    /**
+     * @return The number of samples.
+     */
+    size_t GetCount() const { return mCount; }
+
+    /**
+     * @return The smallest sample (or 0 if there are none).
+     */
+    float GetMin() const { return mMin; }
+
+    /**
+     * @return The largest sample (or 0 if there are none).
+     */
+    float GetMax() const { return mMax; }
+
+    /**
+     * @return The mean of the samples.
+     */
+    double GetMean() const { return mMean; }
+
+    /**
+     * @return The (population) standard deviation of the samples.
+     */
+    double GetStandardDeviation() const;
+
+  private:
+    size_t mCount;
+    float mMin;
+    float mMax;
+    double mMean;
+    double mM2; // sum of squared differences from the mean
+  };
+
   /**
    * DataBuffer represents a basic data buffer used to write data samples
-   * from a channel. The data is currently stored internally in-memory.
+   * from a channel. The data is currently stored internally in-memory as a
+   * list of fixed size blocks from a BlockAllocator (normally the one owned
+   * by the Session): when a block is full the next one is used, so samples
+   * already written are never copied. Nothing is allocated until the first
+   * Write() or Reserve(), so copying an empty buffer is cheap.
    */
   class DataBuffer 
   {
   public:
+    struct Chunk
+    {
+      float* data;
+      size_t length;
+    };
+    typedef std::vector<Chunk> ChunkList;
+
+    /**
+     * A sample kept by a buffer with a tolerance (see SetTolerance()).
+     */
+    struct Point
+    {
+      unsigned int index;
+      float value;
+    };
+    typedef std::vector<Point> PointList;
+
     /**
      * Default constructor.
      */
     DataBuffer();
+
+    /**
+     * Copy constructor. The samples are copied into new blocks taken from
+     * an allocator owned by the copy (see SetAllocator).
+     */
+    DataBuffer(const DataBuffer& other);
+
+    /**
+     * Assignment operator. The samples are copied into new blocks.
+     */
+    DataBuffer& operator=(const DataBuffer& other);
     
     /**
-     * Deconstructor.
+     * Deconstructor. The blocks are returned to the allocator.
      */
     virtual ~DataBuffer();
 
+    /**
+     * Sets the allocator that blocks are taken from. Any samples already
+     * written are moved into blocks from the new allocator.
+     *
+     * @param allocator The allocator or NULL for one owned by this buffer.
+     *   It must outlive this buffer.
+     */
+    void SetAllocator(BlockAllocator* allocator);
+
+    /**
+     * Keeps only the samples needed to rebuild every other sample to within
+     * a given tolerance (swinging door compression). The samples between two
+     * points kept lie on the straight line between them: a sample that no
+     * line from the last point can pass within the tolerance of, together 
+     * with those before it, ends the line at the sample before. The buffer
+     * then has no chunks, see GetPoints() and Read(). This must be set while
+     * the buffer is empty.
+     *
+     * @param tolerance The largest difference allowed between a sample and 
+     *   the sample rebuilt (give or take the rounding of a float), or 0 to
+     *   keep every sample.
+     */
+    void SetTolerance(float tolerance);
+
+    /**
+     * @return Gets the tolerance (or 0 if every sample is kept).
+     */
+    float GetTolerance() const { return mTolerance; }
+
     /**
      * Writes a given value to the end of this data buffer.
      *
      * @param value A given float value.
      */
     void Write(float value);
+
+    /**
+     * Writes a block of values to the end of this data buffer.
+     *
+     * @param values The values to append.
+     * @param count The number of values.
+     */
+    void Write(const float* values, size_t count);
+
+    /**
+     * Makes room for a number of further samples, so that they can be
+     * written without allocating. With a tolerance the number of points
+     * cannot be known, so room for one per kDataBufferSamplesPerPoint
+     * samples is made.
+     *
+     * @param samples The number of samples expected.
+     */
+    void Reserve(size_t samples);
+
+    /**
+     * Removes every sample, returning the blocks to the allocator.
+     */
+    void Clear();
     
     /**
      * @return Gets the total number of samples in this data buffer.
      */
-    int GetLength();
+    size_t GetLength();
 
     /**
      * @return Gets the total size of this data buffer (expressed in bytes).
      */
-    int GetSize();
+    size_t GetSize();
+
+    /**
+     * @return Gets the most recently written sample (or 0 if empty).
+     */
+    float GetLast() const;
+
+    /**
+     * @return Gets the contents of this data buffer, in order. Some chunks
+     * may be empty.
+     */
+    const ChunkList& GetChunks() const { return mChunks; }
+
+    /**
+     * Gets the samples from a given index that are contiguous in memory.
+     *
+     * @param index The index of the first sample.
+     * @param count Receives the number of samples (0 if index is past the end).
+     * @return The first sample.
+     */
+    const float* GetSamples(size_t index, size_t* count) const;
 
     /**
-     * @return Gets the contents of this data buffer. The memory returned will
-     * be GetSize() bytes in length.
+     * Copies the samples from a given index, rebuilding them from the points
+     * if there is a tolerance.
+     *
+     * @param index The index of the first sample.
+     * @param samples Receives the samples.
+     * @param count The number of samples wanted.
+     * @return The number of samples copied (fewer if the end is reached).
+     */
+    size_t Read(size_t index, float* samples, size_t count) const;
+
+    /**
+     * Gets the points kept when there is a tolerance, ending with the last
+     * sample written (the end of the line in progress), so that they rebuild
+     * every sample.
+     *
+     * @param points Receives the points.
+     */
+    void GetPoints(PointList& points) const;
+
+    /**
+     * Adds a point that was kept by a buffer with the same tolerance (when
+     * reading a file) in place of the samples up to it.
+     *
+     * @param index The index of the sample, after that of the last point.
+     * @param value The sample.
+     */
+    void WritePoint(size_t index, float value);
+
+  private:
+    void _nextChunk();
+    void _addChunk();
+    void _append(const DataBuffer& other);
+    void _releaseChunks();
+    void _writePoint(float value);
+    Point _lineEnd() const;
+
+  private:
+    BlockAllocator* mAllocator;
+    BlockAllocator* mOwnedAllocator;
+    ChunkList mChunks;
+    size_t mCurrent;
+    size_t mBlockSamples;
+    size_t mLength;
+    float mTolerance;
+    PointList mPoints;
+    float mLast;          // the last sample, when there is a tolerance
+    double mSlopeMin;     // the slopes from the last point that pass within
+    double mSlopeMax;     // the tolerance of every sample since
+  };
+
+  /**
+   * Decodes the data of a channel stored with Channel::kEncodingRunLength.
+   * The data is a sequence of records, each a 32 bit count followed either
+   * by that many samples (if the count is positive) or by one sample that is
+   * repeated -count times (if it is negative). The data may be given in
+   * pieces of any size.
+   */
+  class RunLengthDecoder
+  {
+  public:
+    /**
+     * Default constructor.
+     */
+    RunLengthDecoder();
+
+    /**
+     * Decodes the next piece of the data.
+     *
+     * @param data The data.
+     * @param length The number of bytes.
+     * @param samples Receives the samples decoded (appended).
      */
-    float* GetBytes();
+    void Decode(const void* data, size_t length, std::vector<float>& samples);
+
+    /**
+     * @return true if the data given so far ends with a complete record.
+     */
+    bool IsComplete() const { return mWordBytes == 0 && mLiteral == 0 && mRun == 0; }
 
   private:
-    typedef std::vector<float> DataBufferList;
-    DataBufferList mData;
-    DataBufferList mTimes;
+    unsigned char mWord[4];  // a count or sample split between pieces
+    size_t mWordBytes;
+    size_t mLiteral;         // samples still to come in a literal record
+    size_t mRun;             // repeats of the sample still to come
+  };
+
+  /**
+   * Decodes the data of a channel stored with Channel::kEncodingPoints.
+   * The data is a sequence of records, one for each point kept (see
+   * DataBuffer::SetTolerance()): a 32 bit count of the samples up to and
+   * including the point since the previous one (or since the start) and
+   * then the sample. The samples in between are rebuilt on the straight 
+   * line between the two points. The data may be given in pieces of any size.
+   */
+  class PointDecoder
+  {
+  public:
+    /**
+     * Default constructor.
+     */
+    PointDecoder();
+
+    /**
+     * Decodes the next piece of the data.
+     *
+     * @param data The data.
+     * @param length The number of bytes.
+     * @param samples Receives the samples decoded (appended).
+     */
+    void Decode(const void* data, size_t length, std::vector<float>& samples);
+
+    /**
+     * @return true if the data given so far ends with a complete record.
+     */
+    bool IsComplete() const { return mRecordBytes == 0; }
+
+  private:
+    unsigned char mRecord[8]; // a record split between pieces
+    size_t mRecordBytes;
+    bool mStarted;
+    float mPrevious;          // the sample of the previous point
   };
 
   /**
@@ -96,10 +480,21 @@ namespace OpenMotorsport
   class Channel
   {
   public:
+    /**
+     * How the samples of a channel are stored in a file.
+     */
+    enum Encoding
+    {
+      kEncodingRaw,       // little endian floats
+      kEncodingRunLength, // see RunLengthDecoder
+      kEncodingPoints     // see PointDecoder
+    };
+
     /**
      * Default constructor. See alternative constructor.
      */
-    Channel() {}
+    Channel() : mStatisticsSamples(0), mEncoding(kEncodingRaw), 
+      mEncodedSamples(0) {}
 
     /**
      * Desconstructor.
@@ -154,6 +549,73 @@ namespace OpenMotorsport
      * @return Gets an instance of DataBuffer for this channel.
      */
     OpenMotorsport::DataBuffer& GetDataBuffer() { return mDataBuffer; }
+    const OpenMotorsport::DataBuffer& GetDataBuffer() const { return mDataBuffer; }
+
+    /**
+     * The time of each sample (in milliseconds, on the same clock as the
+     * markers) of a channel with a variable sample interval, written as
+     * data/<id>.time.bin. A channel with a fixed sample interval has no
+     * times: sample i is at Session::GetStartTime() + i * interval.
+     *
+     * @return Gets the instance of DataBuffer for the sample times.
+     */
+    OpenMotorsport::DataBuffer& GetTimeBuffer() { return mTimeBuffer; }
+    const OpenMotorsport::DataBuffer& GetTimeBuffer() const { return mTimeBuffer; }
+
+    /**
+     * @return The statistics of the samples of each lap (see 
+     *   Session::UpdateStatistics()), the last being the lap in progress.
+     */
+    const std::vector<Statistics>& GetStatistics() const { return mStatistics; }
+
+    /**
+     * Adds the samples not yet counted, up to a given sample, to the
+     * statistics of the lap in progress.
+     *
+     * @param end The index of the first sample not to count.
+     */
+    void UpdateStatistics(size_t end);
+
+    /**
+     * Starts the statistics of a new lap.
+     */
+    void NextLapStatistics();
+
+    /**
+     * Replaces the statistics.
+     *
+     * @param statistics The statistics of each lap.
+     * @param samples The number of samples they cover.
+     */
+    void SetStatistics(const std::vector<Statistics>& statistics, size_t samples);
+
+    /**
+     * Removes the statistics of every lap.
+     */
+    void ClearStatistics();
+
+    /**
+     * @return How the samples are stored in the file last written or read
+     *   (declared by the encoding attribute of the channel in meta.xml).
+     */
+    Encoding GetEncoding() const { return mEncoding; }
+
+    /**
+     * @return The number of samples stored in the file when they are
+     *   encoded (declared by the samples attribute), otherwise 0.
+     */
+    size_t GetEncodedSamples() const { return mEncodedSamples; }
+
+    /**
+     * Sets how the samples are stored. Normally done by the Session.
+     *
+     * @param encoding The encoding.
+     * @param samples The number of samples (unless kEncodingRaw).
+     */
+    void SetEncoding(Encoding encoding, size_t samples = 0) {
+      mEncoding = encoding;
+      mEncodedSamples = encoding != kEncodingRaw ? samples : 0;
+    }
   private:
 	int mId;
 	std::string mName;
@@ -161,14 +623,82 @@ namespace OpenMotorsport
     std::string mUnits;
 	long mSampleInterval;
     DataBuffer mDataBuffer;
+    DataBuffer mTimeBuffer;
+    std::vector<Statistics> mStatistics;
+    size_t mStatisticsSamples; // samples counted in mStatistics
+    Encoding mEncoding;
+    size_t mEncodedSamples;
   };
  
+  /**
+   * A function that derives the samples of a channel from one or more
+   * inputs. See Session::AddDerivedChannel().
+   */
+  class DerivedFunction
+  {
+  public:
+    /**
+     * Deconstructor.
+     */
+    virtual ~DerivedFunction() {}
+
+    /**
+     * Computes a batch of samples.
+     *
+     * @param inputs The samples of each input, in the order they were given.
+     * @param count The number of samples.
+     * @param output Receives count samples.
+     */
+    virtual void Evaluate(const float* const* inputs, size_t count,
+      float* output) const = 0;
+
+    /**
+     * @return true if a sample depends on those before it (state carried
+     *   between batches), so that it cannot be computed on its own.
+     */
+    virtual bool HasState() const { return false; }
+
+    /**
+     * Forgets any state carried between batches. Called when the session
+     * is cleared for reuse.
+     */
+    virtual void Reset() {}
+  };
+
+  /**
+   * Receives the phases of writing a session (for profiling). Names are
+   * string literals and spans are strictly nested. See Session::SetTracer().
+   */
+  class Tracer
+  {
+  public:
+    /**
+     * Deconstructor.
+     */
+    virtual ~Tracer() {}
+
+    /**
+     * Marks the start of a phase.
+     *
+     * @param name The phase.
+     * @param arg A value to identify the instance (a channel id) or
+     *   kTraceNoArg.
+     */
+    virtual void Begin(const char* name, int arg = kTraceNoArg) = 0;
+
+    /**
+     * Marks the end of the latest phase begun.
+     */
+    virtual void End() = 0;
+  };
+
   /**
    * This class represents an OpenMotorsport session. A instance of Session is
    * the centre of all reading/writing and manages associated metadata and channels.
    *
-   * It is currently an incomplete implementation of the OpenMotorsport format
-   * and does currently support reading existing files.
+   * It is currently an incomplete implementation of the OpenMotorsport format.
+   * Files larger than 4 GB (and channels larger than 4 GB) are written and read
+   * using zip64 extensions.
    */
   class Session
   {
@@ -189,6 +719,62 @@ namespace OpenMotorsport
      * @param channel An instance of Channel.
      */
     void AddChannel(Channel& channel);
+
+    /**
+     * Adds an input to this session. An input is a data buffer that is not
+     * written to file but from which derived channels are computed.
+     *
+     * @param name The name of this input.
+     * @return The data buffer to write the input to.
+     */
+    DataBuffer& AddInput(const std::string& name);
+
+    /**
+     * Get an input by name.
+     *
+     * @param name The name of the input.
+     * @throws Exception if this input could not be found.
+     */
+    DataBuffer& GetInput(const std::string& name);
+
+    /**
+     * Adds a channel whose samples are computed from inputs by a function,
+     * rather than written directly. The samples are computed in batches when
+     * the session is written or UpdateDerivedChannels() is called.
+     *
+     * @param channel An instance of Channel.
+     * @param function The function. The session takes ownership of it.
+     * @param input1 The name of the first input.
+     * @param input2 The name of the second input or kDerivedNoInput.
+     * @param input3 The name of the third input or kDerivedNoInput.
+     * @throws Exception if an input could not be found.
+     */
+    void AddDerivedChannel(Channel& channel, DerivedFunction* function,
+      const std::string& input1, 
+      const std::string& input2 = kDerivedNoInput,
+      const std::string& input3 = kDerivedNoInput);
+
+    /**
+     * Computes the samples of the derived channels that have not yet been
+     * computed (those for which every input has been written).
+     */
+    void UpdateDerivedChannels();
+
+    /**
+     * @param channel A channel of this session.
+     * @return true if the channel was added by AddDerivedChannel().
+     */
+    bool IsDerivedChannel(const Channel* channel) const;
+
+    /**
+     * Computes the latest sample of a derived channel from the latest sample
+     * of each input, without writing it. A channel whose function has state
+     * is brought up to date instead (see DerivedFunction::HasState()).
+     *
+     * @param channel A derived channel of this session.
+     * @return The sample or 0 if an input has no samples.
+     */
+    float DeriveLast(const Channel* channel);
     
     /**
      * Adds a new marker to this channel.
@@ -207,6 +793,20 @@ namespace OpenMotorsport
      */
     void AddRelativeMarker(int marker);
 
+    /**
+     * Brings the per lap statistics of every channel up to date (see
+     * Channel::GetStatistics()). The laps are divided by the markers of the
+     * session (every marker, or every GetNumberOfSectors() + 1 markers when
+     * there are sectors), and the samples of each channel are assigned to a
+     * lap by their time (from the start time and sample interval, or the
+     * sample times of a variable interval channel). Markers update the
+     * statistics of the stored channels up to the marker and Write() those
+     * of every channel up to the last sample, so this need not normally be
+     * called. Markers neither derive channels nor rebuild the samples of a
+     * channel with a tolerance; both wait for Write().
+     */
+    void UpdateStatistics();
+
     /**
      * Write this session to an OpenMotorsport file at the given path.
      *
@@ -214,6 +814,62 @@ namespace OpenMotorsport
      */
     void Write(const std::string& filePath);
 
+    /**
+     * @param tracer Receives the phases of Write() or NULL for none. It
+     *   must outlive this session (or be replaced).
+     */
+    void SetTracer(Tracer* tracer) { mTracer = tracer; }
+
+    /**
+     * @param enabled Whether Write() may store channels with runs of
+     *   repeated samples (a car parked in the garage) run length encoded.
+     *   A channel is only encoded if it saves at least 1/kRunLengthMinSaving
+     *   of its data. Readers must support the encoding attribute of a
+     *   channel (see RunLengthDecoder). Off by default.
+     */
+    void SetRunLengthEncoding(bool enabled) { mRunLengthEncoding = enabled; }
+
+    /**
+     * Read an OpenMotorsport file at the given path into this session. The
+     * metadata, channels (including their data) and markers are replaced.
+     *
+     * @param filePath The filepath to read from.
+     * @throws Exception if the file could not be read.
+     */
+    void Read(const std::string& filePath);
+
+    /**
+     * As Read() but the channels are left empty: only meta.xml and the other
+     * small files are read, not the data of the channels.
+     *
+     * @param filePath The filepath to read from.
+     * @throws Exception if the file could not be read.
+     */
+    void ReadMetadata(const std::string& filePath);
+
+    /**
+     * Joins sessions logged one after the other (the stints of a race) into
+     * a single OpenMotorsport file. The data of each channel is copied
+     * still compressed and the markers (and the sample times of variable
+     * interval channels) of each session are moved to where its samples
+     * begin. The metadata, start time and other files are those of the
+     * first session; the durations are added and the statistics of the
+     * laps are appended. Every session must have the same channels.
+     *
+     * The data is only recompressed for sessions whose files were not
+     * written by Write() (see zipWriteNewFileParts64). A channel that is
+     * run length encoded in any session is run length encoded in the
+     * result; its raw data from the other sessions becomes literal records.
+     * A channel with a tolerance (see DataBuffer::SetTolerance()) must have
+     * one in every session and keeps the largest.
+     *
+     * @param filePaths The sessions to join, in order.
+     * @param filePath The filepath to write to.
+     * @throws Exception if a file could not be read or written.
+     */
+    static void Merge(const std::vector<std::string>& filePaths,
+                      const std::string& filePath);
+
     /**
      * Get a channel by name and group.
      * 
@@ -223,6 +879,39 @@ namespace OpenMotorsport
      */
     Channel& GetChannel(const std::string& channelName, const std::string& group);
 
+    /**
+     * Get every channel in this session, ordered by channel identifier. The
+     * pointers remain valid until the session is read into or destroyed.
+     *
+     * @param channels Receives the channels.
+     */
+    void GetChannels(std::vector<Channel*>& channels);
+
+    /**
+     * Makes room in every channel for a number of further samples. Use this
+     * once the channels are added and the length of the session is known.
+     *
+     * @param samples The number of samples expected in each channel.
+     */
+    void Reserve(size_t samples);
+
+    /**
+     * Removes every sample and marker and resets the metadata (the date
+     * becomes now), so that this session can be used to log again. The
+     * channels and the memory allocated for their samples are kept.
+     */
+    void Clear();
+
+    /**
+     * @return The bytes of samples held by every channel and input.
+     */
+    size_t GetBufferedBytes();
+
+    /**
+     * @return The number of heap allocations made for samples so far.
+     */
+    size_t GetAllocations() const { return mAllocator.GetAllocations(); }
+
     /**
      * @param The number of sectors for this session. To indicate no sectors
      *   and no laps, use kSessionNoSectors.
@@ -288,7 +977,7 @@ namespace OpenMotorsport
     /**
      * @return The date of this session.
      */
-    const struct tm* GetDate() const { return mDate; }
+    const struct tm* GetDate() const { return &mDate; }
 
     /**
      * @param comments A textual comment about this session.
@@ -310,17 +999,96 @@ namespace OpenMotorsport
      */
     void SetDuration(float duration) { mDuration = duration; }
 
+    /**
+     * @return The time of the first sample of the channels with a fixed
+     *   sample interval (in milliseconds, on the same clock as the markers).
+     */
+    int GetStartTime() const { return mStartTime; }
+
+    /**
+     * Sets the time of the first sample of the channels with a fixed sample
+     * interval, written once as the start attribute of <channels> rather
+     * than as a channel of times. Sample i is at start + i * interval.
+     *
+     * @param startTime The time in milliseconds (0 by default).
+     */
+    void SetStartTime(int startTime) { mStartTime = startTime; }
+
+    /**
+     * Sets a free form property, written as a <property> of the metadata.
+     *
+     * @param name The property name.
+     * @param value The property value.
+     */
+    void SetProperty(const std::string& name, const std::string& value) {
+      mProperties[name] = value;
+    }
+
+    /**
+     * @param name The property name.
+     * @return The value of the property or an empty string.
+     */
+    std::string GetProperty(const std::string& name) const;
+
+    /**
+     * Adds a file to the session, written into the archive alongside
+     * meta.xml (for example, trackmap.bin).
+     *
+     * @param name The path of the file in the archive.
+     * @param data The contents of the file.
+     */
+    void SetFile(const std::string& name, const std::string& data) {
+      mFiles[name] = data;
+    }
+
+    /**
+     * @param name The path of the file in the archive.
+     * @return The contents of the file or an empty string.
+     */
+    std::string GetFile(const std::string& name) const;
+
   private:
     void _createChannelXmlNode(const OpenMotorsport::Channel& channel, TiXmlElement* parent) const;
     TiXmlElement* Session::_createGroupXmlNode(const std::string& name, TiXmlElement* parent) const;
     std::string _writeMetaXml();
+    void _readMetaXml(const TiXmlElement* root);
+    void _readChannelXmlNode(const TiXmlElement* node, const std::string& group);
+    void _resetMetadata();
+    void _read(const std::string& fileName, bool withData);
+    void _updateStatistics(bool toEnd);
+    void _updateLapEnds();
+    void _writeStatisticsXml(TiXmlElement* root);
+    void _readStatisticsXml(const TiXmlElement* root);
+    void _clearDerivedChannels();
+    void _updateDerivedChannel(size_t index);
   
   private:
     typedef std::tr1::unordered_map<std::string, OpenMotorsport::Channel> ChannelsMap;
     typedef std::vector<int> MarkersList;
+    typedef std::map<std::string, std::string> PropertiesMap;
+    typedef std::map<std::string, std::string> FilesMap;
+    
+    typedef std::tr1::unordered_map<std::string, OpenMotorsport::DataBuffer> InputsMap;
+    struct DerivedChannel
+    {
+      Channel* channel;
+      DerivedFunction* function;
+      DataBuffer* inputs[kDerivedMaxInputs];
+      size_t numInputs;
+    };
+    typedef std::vector<DerivedChannel> DerivedChannelsList;
     
+    // must be declared before (and so outlive) the channels
+    BlockAllocator mAllocator;
     ChannelsMap mChannels;
+    InputsMap mInputs;
+    DerivedChannelsList mDerivedChannels;
+    std::vector<float> mDerivedScratch;
     MarkersList mMarkers;
+    std::vector<int> mLapEnds;   // the markers that end a lap
+    size_t mLapEndMarkers;       // markers looked at for mLapEnds
+    size_t mMarkersPerLap;       // when mLapEnds was found
+    double mCompressionRatio;    // of the last file written, for the next
 
     short mNumSectors;
     std::string mFullName;
@@ -329,9 +1097,14 @@ namespace OpenMotorsport
     std::string mTrackName;
     std::string mDataSource;
     std::string mComments;
-    struct tm* mDate;
+    struct tm mDate;
 
     float mDuration;
+    int mStartTime;
+    PropertiesMap mProperties;
+    FilesMap mFiles;
+    Tracer* mTracer;
+    bool mRunLengthEncoding;
   };
 }
 
@@ -0,0 +1,206 @@
+/*
+  Martin Galpin (m@66laps.com)
+  
+  Copyright (c) 2010 66laps Limited. All rights reserved.
+  
+  This file is part of rFactor-OpenMotorsport.
+  
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+  
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+#include <string.h>
+#include <sstream>
+
+#include "PerformanceMonitor.hpp"
+#include "OpenMotorsport.hpp"
+
+static const char* kProfilePointNames[kProfilePoints] = {
+  "UpdateTelemetry", "UpdateScoring", "SampleBlock", "saveSession",
+  "Session::Write"
+};
+
+static const char* kProfileCounterNames[kProfileCounters] = {
+  "samples", "bufferedBytes", "allocations"
+};
+
+// Percentiles reported for every ProfilePoint
+static const double kProfilePercentiles[] = { 50.0, 90.0, 99.0, 99.9 };
+static const char* kProfilePercentileNames[] = { "p50", "p90", "p99", "p99.9" };
+#define kProfileNumberOfPercentiles \
+  (sizeof(kProfilePercentiles) / sizeof(kProfilePercentiles[0]))
+
+/****************************************************************************/
+/* Bucket arithmetic.                                                       */
+/****************************************************************************/
+
+// The index of the highest set bit (value must be non-zero)
+static int HighestBit(ProfileCycles value)
+{
+#if defined(_MSC_VER)
+  unsigned long index;
+  unsigned long high = (unsigned long) (value >> 32);
+  if(high) {
+    _BitScanReverse(&index, high);
+    return (int) index + 32;
+  }
+  _BitScanReverse(&index, (unsigned long) value);
+  return (int) index;
+#else
+  return 63 - __builtin_clzll(value);
+#endif
+}
+
+// Values below 2 * kLatencySubBuckets have a bucket each; above that each
+// power of two has kLatencySubBuckets buckets
+static int BucketIndex(ProfileCycles value)
+{
+  if(value < 2 * kLatencySubBuckets) return (int) value;
+  int shift = HighestBit(value) - kLatencySubBucketBits;
+  return shift * kLatencySubBuckets + (int) (value >> shift);
+}
+
+// The largest value that falls in a bucket
+static ProfileCycles BucketHighest(int index)
+{
+  if(index < 2 * kLatencySubBuckets) return (ProfileCycles) index;
+  int shift = index / kLatencySubBuckets - 1;
+  ProfileCycles mantissa = index - shift * kLatencySubBuckets;
+  return ((mantissa + 1) << shift) - 1;
+}
+
+/****************************************************************************/
+/* LatencyHistogram definition.                                             */
+/****************************************************************************/
+
+void LatencyHistogram::Record(ProfileCycles cycles)
+{
+  mBuckets[BucketIndex(cycles)]++;
+  mCount++;
+  mTotal += cycles;
+  if(cycles > mMax) mMax = cycles;
+}
+
+void LatencyHistogram::Reset()
+{
+  memset(mBuckets, 0, sizeof(mBuckets));
+  mCount = mTotal = mMax = 0;
+}
+
+ProfileCycles LatencyHistogram::GetPercentile(double percentile) const
+{
+  if(mCount == 0) return 0;
+  ProfileCycles target = (ProfileCycles) (percentile / 100.0 * mCount + 0.5);
+  if(target < 1) target = 1;
+  ProfileCycles seen = 0;
+  for(int i = 0; i < kLatencyBuckets; ++i) {
+    seen += mBuckets[i];
+    if(seen >= target)
+      return BucketHighest(i) < mMax ? BucketHighest(i) : mMax;
+  }
+  return mMax;
+}
+
+/****************************************************************************/
+/* PerformanceMonitor definition.                                           */
+/****************************************************************************/
+
+double ReadWallSeconds()
+{
+#ifdef _WIN32
+  LARGE_INTEGER frequency, now;
+  QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&now);
+  return (double) now.QuadPart / (double) frequency.QuadPart;
+#else
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+#endif
+}
+
+PerformanceMonitor::PerformanceMonitor()
+{
+  Reset();
+}
+
+void PerformanceMonitor::Reset()
+{
+  for(int i = 0; i < kProfilePoints; ++i)
+    mHistograms[i].Reset();
+  for(int i = 0; i < kProfileCounters; ++i)
+    mCounters[i] = 0;
+  mStartCycles = ReadCycleCounter();
+  mStartSeconds = ReadWallSeconds();
+}
+
+double PerformanceMonitor::_cyclesPerMicrosecond()
+{
+  double seconds = ReadWallSeconds() - mStartSeconds;
+  ProfileCycles cycles = ReadCycleCounter() - mStartCycles;
+  if(seconds <= 0.0 || cycles == 0) return 1.0;
+  return cycles / (seconds * 1e6);
+}
+
+std::string PerformanceMonitor::Report()
+{
+  double scale = _cyclesPerMicrosecond();
+  std::stringstream report;
+  report.setf(std::ios::fixed);
+  report.precision(2);
+  for(int i = 0; i < kProfilePoints; ++i) {
+    const LatencyHistogram& histogram = mHistograms[i];
+    if(histogram.GetCount() == 0) continue;
+    report << kProfilePointNames[i] << ": n=" << histogram.GetCount()
+           << " mean=" << histogram.GetMean() / scale << "us";
+    for(size_t p = 0; p < kProfileNumberOfPercentiles; ++p) {
+      report << " " << kProfilePercentileNames[p] << "=" 
+             << histogram.GetPercentile(kProfilePercentiles[p]) / scale << "us";
+    }
+    report << " max=" << histogram.GetMax() / scale << "us\n";
+  }
+  for(int i = 0; i < kProfileCounters; ++i) {
+    report << (i ? ", " : "") << kProfileCounterNames[i] << "=" 
+           << mCounters[i];
+  }
+  return report.str();
+}
+
+void PerformanceMonitor::WriteProperties(OpenMotorsport::Session& session)
+{
+  double scale = _cyclesPerMicrosecond();
+  for(int i = 0; i < kProfilePoints; ++i) {
+    const LatencyHistogram& histogram = mHistograms[i];
+    if(histogram.GetCount() == 0) continue;
+    std::stringstream value;
+    value.setf(std::ios::fixed);
+    value.precision(2);
+    value << "n=" << histogram.GetCount()
+          << " mean=" << histogram.GetMean() / scale
+          << " p99=" << histogram.GetPercentile(99.0) / scale
+          << " max=" << histogram.GetMax() / scale << " (us)";
+    session.SetProperty(
+      std::string(kProfilePropertyPrefix) + kProfilePointNames[i], value.str());
+  }
+  for(int i = 0; i < kProfileCounters; ++i) {
+    std::stringstream value;
+    value << mCounters[i];
+    session.SetProperty(
+      std::string(kProfilePropertyPrefix) + kProfileCounterNames[i], value.str());
+  }
+}
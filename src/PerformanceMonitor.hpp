@@ -0,0 +1,236 @@
+/*
+  Martin Galpin (m@66laps.com)
+  
+  Copyright (c) 2010 66laps Limited. All rights reserved.
+  
+  This file is part of rFactor-OpenMotorsport.
+  
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+  
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#pragma once
+#ifndef PERFORMANCEMONITOR_HPP
+#define PERFORMANCEMONITOR_HPP
+
+#include <string>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#pragma intrinsic(__rdtsc)
+#elif defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+// Each power of two is split into 2^kLatencySubBucketBits buckets, so a
+// recorded latency is reported to within about 3%.
+#define kLatencySubBucketBits 5
+#define kLatencySubBuckets (1 << kLatencySubBucketBits)
+#define kLatencyBuckets ((64 - kLatencySubBucketBits + 1) * kLatencySubBuckets)
+
+#define kProfilePropertyPrefix "profile."
+
+typedef unsigned long long ProfileCycles;
+
+namespace OpenMotorsport { class Session; }
+
+/**
+ * @return A cheap, monotonic cycle count (the time stamp counter on x86).
+ */
+inline ProfileCycles ReadCycleCounter()
+{
+#if defined(_MSC_VER) || defined(__i386__) || defined(__x86_64__)
+  return __rdtsc();
+#else
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (ProfileCycles) now.tv_sec * 1000000000ULL + now.tv_nsec;
+#endif
+}
+
+/**
+ * @return Seconds on a monotonic wall clock, to calibrate the cycle count.
+ */
+double ReadWallSeconds();
+
+/**
+ * The code timed by a PerformanceMonitor.
+ */
+enum ProfilePoint
+{
+  kProfileUpdateTelemetry,
+  kProfileUpdateScoring,
+  kProfileSampleBlock,
+  kProfileSaveSession,
+  kProfileSessionWrite,
+  kProfilePoints
+};
+
+/**
+ * The quantities counted by a PerformanceMonitor.
+ */
+enum ProfileCounter
+{
+  kCounterSamples,       // samples logged
+  kCounterBytesBuffered, // bytes held by the session (latest)
+  kCounterAllocations,   // heap allocations made for samples (latest)
+  kProfileCounters
+};
+
+/**
+ * A latency histogram with log-linear buckets (as HdrHistogram): exact
+ * below 2^kLatencySubBucketBits and within about 3% above it. Recording is
+ * a handful of instructions and never allocates.
+ */
+class LatencyHistogram
+{
+public:
+  /**
+   * Default constructor.
+   */
+  LatencyHistogram() { Reset(); }
+
+  /**
+   * Records a latency.
+   *
+   * @param cycles The latency in cycles.
+   */
+  void Record(ProfileCycles cycles);
+
+  /**
+   * Forgets every recorded latency.
+   */
+  void Reset();
+
+  /**
+   * @return The number of recorded latencies.
+   */
+  ProfileCycles GetCount() const { return mCount; }
+
+  /**
+   * @return The largest recorded latency in cycles.
+   */
+  ProfileCycles GetMax() const { return mMax; }
+
+  /**
+   * @return The mean recorded latency in cycles.
+   */
+  double GetMean() const { return mCount ? (double) mTotal / mCount : 0.0; }
+
+  /**
+   * @param percentile The percentile (0 to 100).
+   * @return The latency (in cycles) that percentile of the recorded
+   * latencies do not exceed, to the resolution of the buckets.
+   */
+  ProfileCycles GetPercentile(double percentile) const;
+
+private:
+  unsigned int mBuckets[kLatencyBuckets];
+  ProfileCycles mCount;
+  ProfileCycles mTotal;
+  ProfileCycles mMax;
+};
+
+/**
+ * Measures what the plugin costs the game: a latency histogram for each
+ * ProfilePoint and a set of counters. The histograms are in cycles, which
+ * are converted to time (against the wall clock) when reported.
+ */
+class PerformanceMonitor
+{
+public:
+  /**
+   * Default constructor.
+   */
+  PerformanceMonitor();
+
+  /**
+   * Forgets everything recorded and restarts the clock calibration.
+   */
+  void Reset();
+
+  /**
+   * Records the latency of a ProfilePoint.
+   *
+   * @param point The point timed.
+   * @param cycles The latency in cycles.
+   */
+  void Record(ProfilePoint point, ProfileCycles cycles) {
+    mHistograms[point].Record(cycles);
+  }
+
+  /**
+   * Adds to a counter.
+   *
+   * @param counter The counter.
+   * @param value The amount to add.
+   */
+  void Count(ProfileCounter counter, ProfileCycles value = 1) {
+    mCounters[counter] += value;
+  }
+
+  /**
+   * Sets a counter.
+   *
+   * @param counter The counter.
+   * @param value The new value.
+   */
+  void SetCounter(ProfileCounter counter, ProfileCycles value) {
+    mCounters[counter] = value;
+  }
+
+  /**
+   * @return A summary (one line per ProfilePoint and one of counters) with
+   * latencies in microseconds.
+   */
+  std::string Report();
+
+  /**
+   * Writes the summary into the properties of a session (prefixed by
+   * kProfilePropertyPrefix).
+   *
+   * @param session The session.
+   */
+  void WriteProperties(OpenMotorsport::Session& session);
+
+private:
+  double _cyclesPerMicrosecond();
+
+private:
+  LatencyHistogram mHistograms[kProfilePoints];
+  ProfileCycles mCounters[kProfileCounters];
+  ProfileCycles mStartCycles;
+  double mStartSeconds;
+};
+
+/**
+ * Records the latency of a scope, if there is a monitor.
+ */
+class ProfileScope
+{
+public:
+  ProfileScope(PerformanceMonitor* monitor, ProfilePoint point) :
+    mMonitor(monitor), mPoint(point), 
+    mStart(monitor ? ReadCycleCounter() : 0) {}
+  ~ProfileScope() {
+    if(mMonitor) mMonitor->Record(mPoint, ReadCycleCounter() - mStart);
+  }
+private:
+  PerformanceMonitor* mMonitor;
+  ProfilePoint mPoint;
+  ProfileCycles mStart;
+};
+
+#endif /* PERFORMANCEMONITOR_HPP */
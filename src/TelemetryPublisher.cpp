@@ -0,0 +1,189 @@
+/*
+  Martin Galpin (m@66laps.com)
+  
+  Copyright (c) 2010 66laps Limited. All rights reserved.
+  
+  This file is part of rFactor-OpenMotorsport.
+  
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+  
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "TelemetryPublisher.hpp"
+#include "OpenMotorsport.hpp"
+
+// Copies at most size - 1 characters and always terminates
+#define COPY_FIXED_STRING(dest, src) \
+  strncpy(dest, src.c_str(), sizeof(dest) - 1); dest[sizeof(dest) - 1] = '\0'
+
+TelemetryPublisher::TelemetryPublisher() :
+  mBlock(NULL),
+  mSession(NULL)
+#ifdef _WIN32
+  , mMapping(NULL)
+#endif
+{}
+
+TelemetryPublisher::~TelemetryPublisher()
+{
+  Close();
+}
+
+bool TelemetryPublisher::Open(const std::string& name)
+{
+  Close();
+#ifdef _WIN32
+  mMapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+    0, sizeof(SharedTelemetryBlock), name.c_str());
+  if(mMapping == NULL) return false;
+  mBlock = (SharedTelemetryBlock*) MapViewOfFile(mMapping,
+    FILE_MAP_ALL_ACCESS, 0, 0, sizeof(SharedTelemetryBlock));
+  if(mBlock == NULL) {
+    CloseHandle(mMapping);
+    mMapping = NULL;
+    return false;
+  }
+#else
+  // POSIX names are a single component with a leading slash
+  mName = !name.empty() && name[0] == '/' ? name : "/" + name;
+  int fd = shm_open(mName.c_str(), O_CREAT | O_RDWR, 0644);
+  if(fd < 0) return false;
+  if(ftruncate(fd, sizeof(SharedTelemetryBlock)) != 0) {
+    close(fd);
+    shm_unlink(mName.c_str());
+    return false;
+  }
+  void* view = mmap(NULL, sizeof(SharedTelemetryBlock),
+    PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if(view == MAP_FAILED) {
+    shm_unlink(mName.c_str());
+    return false;
+  }
+  mBlock = (SharedTelemetryBlock*) view;
+#endif
+
+  // A reader may already be mapped (e.g. the game was restarted), so the
+  // header is rewritten under the lock rather than zeroed. A previous writer
+  // that died mid-write leaves the sequence odd.
+  if(mBlock->sequence & 1) mBlock->sequence++;
+  beginWrite();
+  mBlock->magic = kSharedTelemetryMagic;
+  mBlock->version = kSharedTelemetryVersion;
+  mBlock->logging = 0;
+  mBlock->numChannels = 0;
+  mBlock->samples = 0;
+  mBlock->elapsed = 0.0f;
+  endWrite();
+  return true;
+}
+
+void TelemetryPublisher::Close()
+{
+  mSession = NULL;
+  mChannels.clear();
+  mDerived.clear();
+  if(mBlock == NULL) return;
+
+  beginWrite();
+  mBlock->logging = 0;
+  endWrite();
+
+#ifdef _WIN32
+  UnmapViewOfFile(mBlock);
+  CloseHandle(mMapping);
+  mMapping = NULL;
+#else
+  munmap(mBlock, sizeof(SharedTelemetryBlock));
+  shm_unlink(mName.c_str());
+#endif
+  mBlock = NULL;
+}
+
+void TelemetryPublisher::Attach(OpenMotorsport::Session& session)
+{
+  if(mBlock == NULL) return;
+
+  mSession = &session;
+  session.GetChannels(mChannels);
+  if(mChannels.size() > kSharedTelemetryMaxChannels)
+    mChannels.resize(kSharedTelemetryMaxChannels);
+  mDerived.resize(mChannels.size());
+  for(size_t i = 0; i < mChannels.size(); ++i)
+    mDerived[i] = session.IsDerivedChannel(mChannels[i]);
+
+  beginWrite();
+  for(size_t i = 0; i < mChannels.size(); ++i) {
+    OpenMotorsport::Channel* channel = mChannels[i];
+    SharedTelemetryChannel& shared = mBlock->channels[i];
+    shared.id = channel->GetId();
+    COPY_FIXED_STRING(shared.name, channel->GetName());
+    COPY_FIXED_STRING(shared.group, channel->GetGroup());
+    COPY_FIXED_STRING(shared.units, channel->GetUnits());
+    mBlock->values[i] = 0.0f;
+  }
+  mBlock->numChannels = (unsigned int) mChannels.size();
+  mBlock->layout++;
+  mBlock->samples = 0;
+  mBlock->elapsed = 0.0f;
+  mBlock->logging = 1;
+  endWrite();
+}
+
+void TelemetryPublisher::Detach()
+{
+  mSession = NULL;
+  mChannels.clear();
+  mDerived.clear();
+  if(mBlock == NULL) return;
+
+  beginWrite();
+  mBlock->logging = 0;
+  endWrite();
+}
+
+void TelemetryPublisher::Publish(float elapsed)
+{
+  if(mBlock == NULL || mChannels.empty()) return;
+
+  beginWrite();
+  for(size_t i = 0; i < mChannels.size(); ++i) {
+    mBlock->values[i] = mDerived[i] ? mSession->DeriveLast(mChannels[i]) :
+      mChannels[i]->GetDataBuffer().GetLast();
+  }
+  mBlock->elapsed = elapsed;
+  mBlock->samples++;
+  endWrite();
+}
+
+void TelemetryPublisher::beginWrite()
+{
+  mBlock->sequence++; // odd: readers retry until the write completes
+  SHARED_TELEMETRY_BARRIER();
+}
+
+void TelemetryPublisher::endWrite()
+{
+  SHARED_TELEMETRY_BARRIER();
+  mBlock->sequence++;
+}
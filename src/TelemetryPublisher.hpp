@@ -0,0 +1,176 @@
+/*
+  Martin Galpin (m@66laps.com)
+  
+  Copyright (c) 2010 66laps Limited. All rights reserved.
+  
+  This file is part of rFactor-OpenMotorsport.
+  
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+  
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#pragma once
+#ifndef TELEMETRYPUBLISHER_HPP
+#define TELEMETRYPUBLISHER_HPP
+
+#include <string>
+#include <vector>
+#include <string.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#pragma intrinsic(_ReadWriteBarrier)
+// x86 keeps loads and stores in order so only the compiler must be fenced.
+#define SHARED_TELEMETRY_BARRIER() _ReadWriteBarrier()
+#else
+#define SHARED_TELEMETRY_BARRIER() __sync_synchronize()
+#endif
+
+#define kSharedTelemetryMagic 0x4F4D5354 // "OMST"
+#define kSharedTelemetryVersion 1
+#define kSharedTelemetryMaxChannels 128
+#define kSharedTelemetryNameLength 32
+#define kSharedTelemetryUnitsLength 16
+
+namespace OpenMotorsport { class Session; class Channel; }
+
+/**
+ * Describes one published channel. Mirrors the channel in the session.
+ */
+struct SharedTelemetryChannel
+{
+  int id;
+  char name[kSharedTelemetryNameLength];
+  char group[kSharedTelemetryNameLength];
+  char units[kSharedTelemetryUnitsLength];
+};
+
+/**
+ * The layout of the shared memory segment. It is guarded by a sequence lock:
+ * the (single) writer makes sequence odd before changing anything and even
+ * again afterwards, so a reader knows its copy is consistent if it saw the
+ * same even sequence before and after copying. See ReadSharedTelemetry().
+ */
+struct SharedTelemetryBlock
+{
+  unsigned int magic;
+  unsigned int version;
+  volatile unsigned int sequence;
+  unsigned int layout;       // changes whenever the channels are described
+  unsigned int logging;      // non-zero while a session is being logged
+  unsigned int numChannels;
+  unsigned int samples;      // samples published in the current session
+  float elapsed;             // session time of the latest sample (seconds)
+  SharedTelemetryChannel channels[kSharedTelemetryMaxChannels];
+  float values[kSharedTelemetryMaxChannels]; // latest sample, as channels
+};
+
+/**
+ * Takes a consistent copy of a published block. This is intended for
+ * readers in other processes and never blocks the writer.
+ *
+ * @param block The mapped shared memory.
+ * @param copy Receives the copy.
+ * @param retries The number of attempts to make while a write is in progress.
+ * @return true if the copy is consistent.
+ */
+inline bool ReadSharedTelemetry(const SharedTelemetryBlock* block,
+                                SharedTelemetryBlock* copy, int retries = 64)
+{
+  while(retries-- > 0) {
+    unsigned int before = block->sequence;
+    SHARED_TELEMETRY_BARRIER();
+    if(before & 1) continue;
+    memcpy(copy, (const void*) block, sizeof(SharedTelemetryBlock));
+    SHARED_TELEMETRY_BARRIER();
+    if(block->sequence == before) return true;
+  }
+  return false;
+}
+
+/**
+ * Publishes the latest sample of a session into a named shared memory
+ * segment so that any number of local readers (dashboards, displays) can
+ * follow the session live. On Windows this is a named file mapping and
+ * elsewhere POSIX shared memory.
+ */
+class TelemetryPublisher
+{
+public:
+  /**
+   * Default constructor.
+   */
+  TelemetryPublisher();
+
+  /**
+   * Deconstructor. Closes the segment if it is open.
+   */
+  ~TelemetryPublisher();
+
+  /**
+   * Creates (or opens) the named shared memory segment.
+   *
+   * @param name The segment name.
+   * @return true if the segment is ready to publish to.
+   */
+  bool Open(const std::string& name);
+
+  /**
+   * Unmaps and releases the segment.
+   */
+  void Close();
+
+  /**
+   * @return true if the segment is open.
+   */
+  bool IsOpen() const { return mBlock != NULL; }
+
+  /**
+   * Describes the channels of a newly started session. The session must
+   * outlive the call to Detach().
+   *
+   * @param session The session being logged.
+   */
+  void Attach(OpenMotorsport::Session& session);
+
+  /**
+   * Marks the end of the session being published.
+   */
+  void Detach();
+
+  /**
+   * Publishes the most recent value of every attached channel. Derived
+   * channels are computed from the latest sample of their inputs, so every
+   * value belongs to the same sample.
+   *
+   * @param elapsed The session time of the sample (in seconds).
+   */
+  void Publish(float elapsed);
+
+private:
+  void beginWrite();
+  void endWrite();
+
+private:
+  SharedTelemetryBlock* mBlock;
+  OpenMotorsport::Session* mSession;
+  std::vector<OpenMotorsport::Channel*> mChannels;
+  std::vector<bool> mDerived;
+#ifdef _WIN32
+  void* mMapping;
+#else
+  std::string mName;
+#endif
+};
+
+#endif /* TELEMETRYPUBLISHER_HPP */
@@ -0,0 +1,444 @@
+/*
+  Martin Galpin (m@66laps.com)
+  
+  Copyright (c) 2010 66laps Limited. All rights reserved.
+  
+  This file is part of rFactor-OpenMotorsport.
+  
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+  
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+
+#include "TelemetryStreamer.hpp"
+#include "OpenMotorsport.hpp"
+
+#ifdef _WIN32
+#define CLOSE_SOCKET(s) closesocket(s)
+#define SOCKET_WOULD_BLOCK() (WSAGetLastError() == WSAEWOULDBLOCK)
+#define kSendFlags 0
+#else
+#define CLOSE_SOCKET(s) close(s)
+#define SOCKET_WOULD_BLOCK() (errno == EAGAIN || errno == EWOULDBLOCK)
+#ifdef MSG_NOSIGNAL
+#define kSendFlags MSG_NOSIGNAL // a closed consumer must not raise SIGPIPE
+#else
+#define kSendFlags 0
+#endif
+#endif
+
+#define kUnixSocketPrefix "unix:"
+
+const TelemetryStreamer::Socket TelemetryStreamer::kInvalidSocket =
+  (TelemetryStreamer::Socket) -1;
+
+static bool SetNonBlocking(size_t socket)
+{
+#ifdef _WIN32
+  u_long enable = 1;
+  return ioctlsocket((SOCKET) socket, FIONBIO, &enable) == 0;
+#else
+  int flags = fcntl((int) socket, F_GETFL, 0);
+  return flags >= 0 && fcntl((int) socket, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif
+}
+
+// Appends raw bytes to a frame
+static void Append(std::vector<char>& frame, const void* data, size_t size)
+{
+  const char* bytes = (const char*) data;
+  frame.insert(frame.end(), bytes, bytes + size);
+}
+
+static void AppendString(std::vector<char>& frame, const std::string& value)
+{
+  unsigned char length = (unsigned char)
+    (value.size() > 255 ? 255 : value.size());
+  Append(frame, &length, 1);
+  Append(frame, value.data(), length);
+}
+
+// Starts a new frame with its header (the payload size is set by EndFrame)
+static void BeginFrame(std::vector<char>& frame, unsigned short flags,
+                       unsigned int sequence, size_t numChannels,
+                       size_t numSamples)
+{
+  StreamFrameHeader header;
+  header.magic = kStreamFrameMagic;
+  header.version = kStreamFrameVersion;
+  header.flags = flags;
+  header.sequence = sequence;
+  header.dropped = 0;
+  header.numChannels = (unsigned short) numChannels;
+  header.numSamples = (unsigned short) numSamples;
+  header.payloadSize = 0;
+  frame.clear();
+  Append(frame, &header, sizeof(header));
+}
+
+static void EndFrame(std::vector<char>& frame)
+{
+  StreamFrameHeader* header = (StreamFrameHeader*) &frame[0];
+  header->payloadSize = (unsigned int) (frame.size() - sizeof(StreamFrameHeader));
+}
+
+TelemetryStreamer::TelemetryStreamer(int batch) :
+  mListener(kInvalidSocket),
+  mUnixSocket(false),
+#ifdef _WIN32
+  mWinsockStarted(false),
+#endif
+  mBatch(batch > 0 ? batch : 1),
+  mSequence(0),
+  mTotalDropped(0),
+  mSession(NULL),
+  mNumSamples(0)
+{
+  for(int i = 0; i < kStreamMaxClients; ++i)
+    mClients[i].socket = kInvalidSocket;
+  mFrame.reserve(kStreamQueueCapacity);
+  mKeyFrame.reserve(kStreamQueueCapacity);
+}
+
+TelemetryStreamer::~TelemetryStreamer()
+{
+  Close();
+}
+
+bool TelemetryStreamer::Open(const std::string& address)
+{
+  Close();
+  mUnixSocket = address.compare(0, strlen(kUnixSocketPrefix),
+    kUnixSocketPrefix) == 0;
+
+#ifdef _WIN32
+  if(mUnixSocket) return false;
+  WSADATA data;
+  if(WSAStartup(MAKEWORD(2, 2), &data) != 0) return false;
+  mWinsockStarted = true;
+#endif
+
+  if(mUnixSocket) {
+#ifndef _WIN32
+    struct sockaddr_un local;
+    mPath = address.substr(strlen(kUnixSocketPrefix));
+    if(mPath.size() >= sizeof(local.sun_path)) return false;
+    memset(&local, 0, sizeof(local));
+    local.sun_family = AF_UNIX;
+    strcpy(local.sun_path, mPath.c_str());
+    unlink(mPath.c_str());
+    mListener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(mListener == kInvalidSocket) return false;
+    if(bind(mListener, (struct sockaddr*) &local, sizeof(local)) != 0) {
+      Close();
+      return false;
+    }
+#endif
+  }
+  else {
+    size_t colon = address.rfind(':');
+    if(colon == std::string::npos) {
+      Close();
+      return false;
+    }
+    struct sockaddr_in local;
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = inet_addr(address.substr(0, colon).c_str());
+    local.sin_port = htons((unsigned short) atoi(address.c_str() + colon + 1));
+
+    mListener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if(mListener == kInvalidSocket) {
+      Close();
+      return false;
+    }
+    int reuse = 1;
+    setsockopt(mListener, SOL_SOCKET, SO_REUSEADDR,
+      (const char*) &reuse, sizeof(reuse));
+    if(bind(mListener, (struct sockaddr*) &local, sizeof(local)) != 0) {
+      Close();
+      return false;
+    }
+  }
+
+  if(listen(mListener, kStreamMaxClients) != 0 ||
+     !SetNonBlocking(mListener)) {
+    Close();
+    return false;
+  }
+  return true;
+}
+
+void TelemetryStreamer::Close()
+{
+  for(int i = 0; i < kStreamMaxClients; ++i)
+    closeClient(mClients[i]);
+  mSession = NULL;
+  mChannels.clear();
+  mNumSamples = 0;
+
+  if(mListener != kInvalidSocket) {
+    CLOSE_SOCKET(mListener);
+    mListener = kInvalidSocket;
+#ifndef _WIN32
+    if(mUnixSocket) unlink(mPath.c_str());
+#endif
+  }
+#ifdef _WIN32
+  if(mWinsockStarted) {
+    WSACleanup();
+    mWinsockStarted = false;
+  }
+#endif
+}
+
+void TelemetryStreamer::Attach(OpenMotorsport::Session& session)
+{
+  mSession = &session;
+  session.GetChannels(mChannels);
+  mStored.clear();
+  mDerived.clear();
+  for(size_t i = 0; i < mChannels.size(); ++i) {
+    if(session.IsDerivedChannel(mChannels[i]))
+      mDerived.push_back(i);
+    else
+      mStored.push_back(i);
+  }
+  mDerivedScratch.resize(mBatch);
+  mPrevious.assign(mChannels.size(), 0.0f);
+  mSamples.resize(mChannels.size() * mBatch);
+  mElapsed.resize(mBatch);
+  mMask.resize((mChannels.size() + 7) / 8 + 1);
+  mNumSamples = 0;
+
+  // Every consumer is told about the new channels before any samples
+  for(int i = 0; i < kStreamMaxClients; ++i) {
+    mClients[i].needsLayout = true;
+    mClients[i].needsKey = true;
+  }
+}
+
+void TelemetryStreamer::Detach()
+{
+  if(mNumSamples > 0)
+    sendBatch();
+  mSession = NULL;
+  mChannels.clear();
+}
+
+void TelemetryStreamer::Publish(float elapsed)
+{
+  if(mListener == kInvalidSocket || mChannels.empty()) return;
+
+  float* row = &mSamples[mNumSamples * mChannels.size()];
+  for(size_t i = 0; i < mStored.size(); ++i)
+    row[mStored[i]] = mChannels[mStored[i]]->GetDataBuffer().GetLast();
+  mElapsed[mNumSamples] = elapsed;
+
+  if(++mNumSamples >= mBatch)
+    sendBatch();
+}
+
+void TelemetryStreamer::sendBatch()
+{
+  // The derived channels are computed for the batch at once, off the
+  // per-sample path, and their last samples copied into its rows
+  if(!mDerived.empty())
+    mSession->UpdateDerivedChannels();
+  size_t numChannels = mChannels.size();
+  for(size_t d = 0; d < mDerived.size(); ++d) {
+    size_t i = mDerived[d];
+    const OpenMotorsport::DataBuffer& buffer = mChannels[i]->GetDataBuffer();
+    size_t length = mChannels[i]->GetDataBuffer().GetLength();
+    size_t first = length > (size_t) mNumSamples ? length - mNumSamples : 0;
+    size_t count = buffer.Read(first, &mDerivedScratch[0], mNumSamples);
+    size_t missing = mNumSamples - count; // none, unless an input is short
+    for(size_t s = 0; s < (size_t) mNumSamples; ++s) {
+      mSamples[s * numChannels + i] = s < missing ? 
+        mPrevious[i] : mDerivedScratch[s - missing];
+    }
+  }
+
+  acceptClients();
+
+  bool encodedKey = false;
+  bool encodedLayout = false;
+  encodeBatch(mFrame, false);
+  for(int i = 0; i < kStreamMaxClients; ++i) {
+    Client& client = mClients[i];
+    if(client.socket == kInvalidSocket) continue;
+
+    if(client.needsLayout) {
+      if(!encodedLayout) {
+        encodeLayout(mLayoutFrame);
+        encodedLayout = true;
+      }
+      // Samples are no use to a consumer without the layout
+      if(!enqueue(client, mLayoutFrame)) {
+        flush(client);
+        continue;
+      }
+      client.needsLayout = false;
+    }
+    if(client.needsKey && !encodedKey) {
+      encodeBatch(mKeyFrame, true);
+      encodedKey = true;
+    }
+    if(enqueue(client, client.needsKey ? mKeyFrame : mFrame))
+      client.needsKey = false;
+    flush(client);
+  }
+
+  // Deltas for the next frame are taken from the last sample of this one
+  const float* last = &mSamples[(mNumSamples - 1) * mChannels.size()];
+  mPrevious.assign(last, last + mChannels.size());
+  mNumSamples = 0;
+  mSequence++;
+}
+
+void TelemetryStreamer::acceptClients()
+{
+  for(;;) {
+    Socket socket = accept(mListener, NULL, NULL);
+    if(socket == kInvalidSocket) return;
+
+    Client* client = NULL;
+    for(int i = 0; i < kStreamMaxClients && !client; ++i) {
+      if(mClients[i].socket == kInvalidSocket)
+        client = &mClients[i];
+    }
+    if(!client || !SetNonBlocking(socket)) {
+      CLOSE_SOCKET(socket);
+      continue;
+    }
+    if(!mUnixSocket) {
+      int noDelay = 1;
+      setsockopt(socket, IPPROTO_TCP, TCP_NODELAY,
+        (const char*) &noDelay, sizeof(noDelay));
+    }
+
+    client->socket = socket;
+    client->queue.clear();
+    client->queue.reserve(kStreamQueueCapacity);
+    client->sent = 0;
+    client->dropped = 0;
+    client->needsLayout = true;
+    client->needsKey = true;
+  }
+}
+
+void TelemetryStreamer::closeClient(Client& client)
+{
+  if(client.socket == kInvalidSocket) return;
+  CLOSE_SOCKET(client.socket);
+  client.socket = kInvalidSocket;
+  client.queue.clear();
+  client.sent = 0;
+}
+
+void TelemetryStreamer::encodeLayout(std::vector<char>& frame)
+{
+  BeginFrame(frame, kStreamFrameLayout, mSequence, mChannels.size(), 0);
+  for(size_t i = 0; i < mChannels.size(); ++i) {
+    int id = mChannels[i]->GetId();
+    Append(frame, &id, sizeof(id));
+    AppendString(frame, mChannels[i]->GetName());
+    AppendString(frame, mChannels[i]->GetGroup());
+    AppendString(frame, mChannels[i]->GetUnits());
+  }
+  EndFrame(frame);
+}
+
+void TelemetryStreamer::encodeBatch(std::vector<char>& frame, bool key)
+{
+  size_t numChannels = mChannels.size();
+  size_t maskSize = (numChannels + 7) / 8;
+  unsigned char* mask = &mMask[0];
+
+  BeginFrame(frame, key ? kStreamFrameKey : 0, mSequence, numChannels,
+    mNumSamples);
+  const float* previous = &mPrevious[0];
+  for(int s = 0; s < mNumSamples; ++s) {
+    const float* row = &mSamples[s * numChannels];
+    Append(frame, &mElapsed[s], sizeof(float));
+
+    // Compare bit patterns so that NaNs and signed zeros are not lost
+    memset(mask, 0, maskSize);
+    for(size_t i = 0; i < numChannels; ++i) {
+      if((key && s == 0) || memcmp(&row[i], &previous[i], sizeof(float)) != 0)
+        mask[i >> 3] |= (unsigned char) (1 << (i & 7));
+    }
+    Append(frame, mask, maskSize);
+    for(size_t i = 0; i < numChannels; ++i) {
+      if(mask[i >> 3] & (1 << (i & 7)))
+        Append(frame, &row[i], sizeof(float));
+    }
+    previous = row;
+  }
+  EndFrame(frame);
+}
+
+bool TelemetryStreamer::enqueue(Client& client, const std::vector<char>& frame)
+{
+  if(client.queue.size() - client.sent + frame.size() > kStreamQueueCapacity) {
+    // The consumer is not keeping up. Drop this frame rather than wait for
+    // it; the next frame it receives must stand on its own.
+    client.dropped++;
+    mTotalDropped++;
+    client.needsKey = true;
+    return false;
+  }
+
+  // Reclaim space already sent before appending
+  if(client.sent > 0) {
+    client.queue.erase(client.queue.begin(),
+      client.queue.begin() + client.sent);
+    client.sent = 0;
+  }
+  size_t offset = client.queue.size();
+  client.queue.insert(client.queue.end(), frame.begin(), frame.end());
+  ((StreamFrameHeader*) &client.queue[offset])->dropped = client.dropped;
+  return true;
+}
+
+void TelemetryStreamer::flush(Client& client)
+{
+  while(client.sent < client.queue.size()) {
+    int sent = send(client.socket, &client.queue[client.sent],
+      (int) (client.queue.size() - client.sent), kSendFlags);
+    if(sent < 0) {
+      if(!SOCKET_WOULD_BLOCK())
+        closeClient(client);
+      return;
+    }
+    client.sent += sent;
+  }
+  client.queue.clear();
+  client.sent = 0;
+}
@@ -0,0 +1,194 @@
+/*
+  Martin Galpin (m@66laps.com)
+  
+  Copyright (c) 2010 66laps Limited. All rights reserved.
+  
+  This file is part of rFactor-OpenMotorsport.
+  
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+  
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#pragma once
+#ifndef TELEMETRYSTREAMER_HPP
+#define TELEMETRYSTREAMER_HPP
+
+#include <string>
+#include <vector>
+
+#define kStreamFrameMagic 0x464D534F // "OSMF"
+#define kStreamFrameVersion 1
+
+// Frame flags
+#define kStreamFrameLayout 0x01    // payload describes the channels
+#define kStreamFrameKey 0x02       // first sample is not delta-encoded
+
+#define kStreamMaxClients 4
+#define kStreamDefaultBatch 5
+#define kStreamQueueCapacity (256 * 1024) // bytes queued per client
+
+namespace OpenMotorsport { class Session; class Channel; }
+
+/**
+ * The header that starts every frame (all fields little-endian).
+ *
+ * A layout frame has numSamples = 0 and a payload of numChannels entries:
+ *   int id, then name, group and units, each a byte length and characters.
+ *
+ * A sample frame has a payload of numSamples entries, each of:
+ *   float elapsed (seconds), a bitmask of (numChannels + 7) / 8 bytes, then
+ *   a float for each set bit, in channel order.
+ * A set bit means that channel differs from the previous sample (the last
+ * sample of the previous frame for the first sample). In a key frame every
+ * bit of the first sample is set.
+ */
+#pragma pack(push, 1)
+struct StreamFrameHeader
+{
+  unsigned int magic;
+  unsigned short version;
+  unsigned short flags;
+  unsigned int sequence;     // frame number, gaps mean frames were dropped
+  unsigned int dropped;      // frames dropped for this client so far
+  unsigned short numChannels;
+  unsigned short numSamples;
+  unsigned int payloadSize;  // bytes that follow this header
+};
+#pragma pack(pop)
+
+/**
+ * Streams samples to local consumers over a socket as they are logged.
+ *
+ * Samples are batched every N ticks into compact, delta-encoded frames and
+ * queued per client. The socket is never allowed to block: frames are sent
+ * as far as the client will take them and, if its queue is full, the frame
+ * is dropped for that client and counted (the next frame it receives is a
+ * key frame).
+ *
+ * Addresses are "host:port" for TCP (only loopback addresses should be used)
+ * or, where supported, "unix:/path" for a Unix-domain socket.
+ */
+class TelemetryStreamer
+{
+public:
+  /**
+   * Default constructor.
+   *
+   * @param batch The number of samples in a frame.
+   */
+  TelemetryStreamer(int batch = kStreamDefaultBatch);
+
+  /**
+   * Deconstructor. Closes the socket if it is open.
+   */
+  ~TelemetryStreamer();
+
+  /**
+   * Starts listening for consumers.
+   *
+   * @param address The address to listen on.
+   * @return true if the socket is listening.
+   */
+  bool Open(const std::string& address);
+
+  /**
+   * Disconnects every consumer and stops listening.
+   */
+  void Close();
+
+  /**
+   * @return true if the socket is listening.
+   */
+  bool IsOpen() const { return mListener != kInvalidSocket; }
+
+  /**
+   * Describes the channels of a newly started session to every consumer.
+   * The session must outlive the call to Detach().
+   *
+   * @param session The session being logged.
+   */
+  void Attach(OpenMotorsport::Session& session);
+
+  /**
+   * Sends any partial batch and marks the end of the session.
+   */
+  void Detach();
+
+  /**
+   * Adds the most recent value of every stored channel to the batch and
+   * sends it when it is full. The derived channels are computed for the
+   * whole batch just before it is sent.
+   *
+   * @param elapsed The session time of the sample (in seconds).
+   */
+  void Publish(float elapsed);
+
+  /**
+   * @return The total number of frames dropped across all consumers.
+   */
+  unsigned int GetDropped() const { return mTotalDropped; }
+
+private:
+#ifdef _WIN32
+  typedef size_t Socket; // SOCKET
+#else
+  typedef int Socket;
+#endif
+  static const Socket kInvalidSocket;
+
+  struct Client
+  {
+    Socket socket;
+    std::vector<char> queue;
+    size_t sent;              // bytes of queue already sent
+    unsigned int dropped;
+    bool needsLayout;
+    bool needsKey;
+  };
+
+  void acceptClients();
+  void closeClient(Client& client);
+  void encodeLayout(std::vector<char>& frame);
+  void encodeBatch(std::vector<char>& frame, bool key);
+  void sendBatch();
+  bool enqueue(Client& client, const std::vector<char>& frame);
+  void flush(Client& client);
+
+private:
+  Socket mListener;
+  bool mUnixSocket;
+  std::string mPath;
+#ifdef _WIN32
+  bool mWinsockStarted;
+#endif
+  Client mClients[kStreamMaxClients];
+
+  int mBatch;
+  unsigned int mSequence;
+  unsigned int mTotalDropped;
+  OpenMotorsport::Session* mSession;
+  std::vector<OpenMotorsport::Channel*> mChannels;
+  std::vector<size_t> mStored;     // indices of the channels written directly
+  std::vector<size_t> mDerived;    // and of those derived from inputs
+  std::vector<float> mDerivedScratch;
+  std::vector<float> mPrevious;    // last sample of the previous frame
+  std::vector<float> mSamples;     // batch of values, one row per sample
+  std::vector<float> mElapsed;
+  std::vector<unsigned char> mMask;
+  int mNumSamples;
+  std::vector<char> mFrame;        // encoding scratch, reused
+  std::vector<char> mKeyFrame;
+  std::vector<char> mLayoutFrame;
+};
+
+#endif /* TELEMETRYSTREAMER_HPP */
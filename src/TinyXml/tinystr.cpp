@@ -35,8 +35,38 @@ distribution.
 const TiXmlString::size_type TiXmlString::npos = static_cast< TiXmlString::size_type >(-1);
 
 
-// Null rep.
-TiXmlString::Rep TiXmlString::nullrep_ = { 0, 0, { '\0' } };
+void TiXmlString::swap (TiXmlString& other)
+{
+	if (!is_small() && !other.is_small())
+	{
+		Rep* r = rep_;
+		rep_ = other.rep_;
+		other.rep_ = r;
+		return;
+	}
+
+	// At least one side lives in its inline buffer, so the contents have to
+	// be moved rather than the pointers exchanged.
+	TiXmlString tmp;
+	tmp.steal(*this);
+	steal(other);
+	other.steal(tmp);
+}
+
+
+void TiXmlString::steal (TiXmlString& other)
+{
+	if (other.is_small())
+	{
+		init(other.length(), other.length());
+		memcpy(start(), other.data(), length());
+	}
+	else
+	{
+		rep_ = other.rep_;
+	}
+	other.init(0, 0);
+}
 
 
 void TiXmlString::reserve (size_type cap)
@@ -32,6 +32,11 @@ distribution.
  * - fixed operator+=() to take a const ref argument, following spec.
  * - added "copy" constructor with length, and most compare operators.
  * - added swap(), clear(), size(), capacity(), operator+().
+ *
+ * THIS FILE WAS ALTERED FOR rFactor-OpenMotorsport.
+ *
+ * - short strings are stored in an inline buffer (no heap allocation).
+ * - added move constructor and move assignment where supported.
  */
 
 #ifndef TIXML_USE_STL
@@ -56,6 +61,22 @@ distribution.
 	#define TIXML_EXPLICIT
 #endif
 
+/*	Rvalue references (and so move semantics) are only available on newer
+	compilers. Visual Studio 2010 and GCC in C++11 mode support them.
+*/
+#if defined(_MSC_VER) && (_MSC_VER >= 1600 )
+	#define TIXML_HAS_RVALUE_REFS
+#elif defined(__GXX_EXPERIMENTAL_CXX0X__) || (__cplusplus >= 201103L)
+	#define TIXML_HAS_RVALUE_REFS
+#endif
+
+/*	Strings up to this length are stored inside the TiXmlString itself rather
+	than on the heap. This covers almost all element and attribute names.
+*/
+#ifndef TIXML_STRING_SMALL_CAPACITY
+	#define TIXML_STRING_SMALL_CAPACITY 23
+#endif
+
 
 /*
    TiXmlString is an emulation of a subset of the std::string template.
@@ -63,6 +84,7 @@ distribution.
    Only the member functions relevant to the TinyXML project have been implemented.
    The buffer allocation is made by a simplistic power of 2 like mechanism : if we increase
    a string and there's no more room, we allocate a buffer twice as big as we need.
+   Strings no longer than TIXML_STRING_SMALL_CAPACITY never touch the heap.
 */
 class TiXmlString
 {
@@ -75,8 +97,9 @@ class TiXmlString
 
 
 	// TiXmlString empty constructor
-	TiXmlString () : rep_(&nullrep_)
+	TiXmlString () : rep_(0)
 	{
+		init(0, 0);
 	}
 
 	// TiXmlString copy constructor
@@ -86,6 +109,15 @@ class TiXmlString
 		memcpy(start(), copy.data(), length());
 	}
 
+	#ifdef TIXML_HAS_RVALUE_REFS
+	// TiXmlString move constructor
+	TiXmlString ( TiXmlString && other) : rep_(0)
+	{
+		init(0, 0);
+		steal(other);
+	}
+	#endif
+
 	// TiXmlString constructor, based on a string
 	TIXML_EXPLICIT TiXmlString ( const char * copy) : rep_(0)
 	{
@@ -118,6 +150,20 @@ class TiXmlString
 		return assign(copy.start(), copy.length());
 	}
 
+	#ifdef TIXML_HAS_RVALUE_REFS
+	// = operator (move)
+	TiXmlString& operator = (TiXmlString && other)
+	{
+		if (this != &other)
+		{
+			quit();
+			init(0, 0);
+			steal(other);
+		}
+		return *this;
+	}
+	#endif
+
 
 	// += operator. Maps to append
 	TiXmlString& operator += (const char * suffix)
@@ -208,12 +254,7 @@ class TiXmlString
 
 	TiXmlString& append (const char* str, size_type len);
 
-	void swap (TiXmlString& other)
-	{
-		Rep* r = rep_;
-		rep_ = other.rep_;
-		other.rep_ = r;
-	}
+	void swap (TiXmlString& other);
 
   private:
 
@@ -228,9 +269,28 @@ class TiXmlString
 		char str[1];
 	};
 
+	// Inline storage with the same layout as Rep, used for short strings.
+	struct SmallRep
+	{
+		size_type size, capacity;
+		char str[ TIXML_STRING_SMALL_CAPACITY + 1 ];
+	};
+
+	bool is_small() const { return rep_ == reinterpret_cast<const Rep*>( &small_ ); }
+
+	// Takes the contents of other, leaving it empty. The current contents
+	// must not own heap memory (i.e. quit() has been called or it is small).
+	void steal(TiXmlString& other);
+
 	void init(size_type sz, size_type cap)
 	{
-		if (cap)
+		if (cap <= TIXML_STRING_SMALL_CAPACITY)
+		{
+			rep_ = reinterpret_cast<Rep*>( &small_ );
+			rep_->str[ rep_->size = sz ] = '\0';
+			rep_->capacity = TIXML_STRING_SMALL_CAPACITY;
+		}
+		else
 		{
 			// Lee: the original form:
 			//	rep_ = static_cast<Rep*>(operator new(sizeof(Rep) + cap));
@@ -244,15 +304,11 @@ class TiXmlString
 			rep_->str[ rep_->size = sz ] = '\0';
 			rep_->capacity = cap;
 		}
-		else
-		{
-			rep_ = &nullrep_;
-		}
 	}
 
 	void quit()
 	{
-		if (rep_ != &nullrep_)
+		if (!is_small())
 		{
 			// The rep_ is really an array of ints. (see the allocator, above).
 			// Cast it back before delete, so the compiler won't incorrectly call destructors.
@@ -261,7 +317,7 @@ class TiXmlString
 	}
 
 	Rep * rep_;
-	static Rep nullrep_;
+	SmallRep small_;
 
 } ;
 
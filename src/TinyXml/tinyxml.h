@@ -1123,6 +1123,14 @@ public:
 	*/
 	virtual const char* Parse( const char* p, TiXmlParsingData* data, TiXmlEncoding encoding );
 
+	/*	[internal use]
+		Like Parse(), but hands the element and its children to the visitor as they
+		are read rather than building them into the tree. Sets stop if a
+		callback returned false.
+	*/
+	const char* ParseVisit( const char* p, TiXmlParsingData* data, TiXmlEncoding encoding,
+							TiXmlVisitor* visitor, bool* stop );
+
 	virtual const TiXmlElement*     ToElement()     const { return this; } ///< Cast to a more defined type. Will return null not of the requested type.
 	virtual TiXmlElement*           ToElement()	          { return this; } ///< Cast to a more defined type. Will return null not of the requested type.
 
@@ -1141,9 +1149,20 @@ protected:
 	#endif
 	/*	[internal use]
 		Reads the "value" of the element -- another element, or text.
-		This should terminate with the current end tag.
+		This should terminate with the current end tag. If a visitor is given,
+		the children are handed to it and discarded instead of being linked.
+	*/
+	const char* ReadValue( const char* in, TiXmlParsingData* prevData, TiXmlEncoding encoding,
+						   TiXmlVisitor* visitor = 0, bool* stop = 0 );
+
+	/*	[internal use]
+		Reads the name and attributes, up to and including the closing '>'.
+		Sets isEmpty if the tag was closed with "/>".
 	*/
-	const char* ReadValue( const char* in, TiXmlParsingData* prevData, TiXmlEncoding encoding );
+	const char* ReadStartTag( const char* p, TiXmlParsingData* data, TiXmlEncoding encoding, bool* isEmpty );
+
+	// [internal use] Reads the end tag matching this element's name.
+	const char* ReadEndTag( const char* p, TiXmlParsingData* data, TiXmlEncoding encoding );
 
 private:
 	TiXmlAttributeSet attributeSet;
@@ -1438,6 +1457,21 @@ public:
 	*/
 	virtual const char* Parse( const char* p, TiXmlParsingData* data = 0, TiXmlEncoding encoding = TIXML_DEFAULT_ENCODING );
 
+	/** Parse the given null terminated block of xml data without building the document.
+		Every node is passed to the visitor as soon as it has been read, in the same
+		order Accept() would visit it, and is then thrown away; only the chain of
+		currently open elements is held in memory.
+
+		Unlike Accept(), returning false from any visitor callback stops the parse
+		at once, so the remainder of the data is never examined. This allows the
+		caller to read only the start of a large file.
+
+		Returns a pointer just past the last character consumed (the end of the data
+		if the visitor never stopped), or null if there was an error (see Error()).
+		The document itself is left empty.
+	*/
+	const char* ParseVisit( const char* p, TiXmlVisitor* visitor, TiXmlEncoding encoding = TIXML_DEFAULT_ENCODING );
+
 	/** Get the root element -- the only top level element -- of the document.
 		In well formed XML, there should only be one. TinyXml is tolerant of
 		multiple elements at the document level.
@@ -1538,6 +1572,7 @@ protected :
 
 private:
 	void CopyTo( TiXmlDocument* target ) const;
+	const char* ParseNodes( const char* p, TiXmlParsingData* prevData, TiXmlEncoding encoding, TiXmlVisitor* visitor );
 
 	bool error;
 	int  errorId;
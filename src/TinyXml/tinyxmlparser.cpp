@@ -702,6 +702,21 @@ void TiXmlDocument::StreamIn( std::istream * in, TIXML_STRING * tag )
 #endif
 
 const char* TiXmlDocument::Parse( const char* p, TiXmlParsingData* prevData, TiXmlEncoding encoding )
+{
+	return ParseNodes( p, prevData, encoding, 0 );
+}
+
+const char* TiXmlDocument::ParseVisit( const char* p, TiXmlVisitor* visitor, TiXmlEncoding encoding )
+{
+	assert( visitor );
+
+	// Nothing is kept, but make sure there is nothing left over from a previous load.
+	Clear();
+	location.Clear();
+	return ParseNodes( p, 0, encoding, visitor );
+}
+
+const char* TiXmlDocument::ParseNodes( const char* p, TiXmlParsingData* prevData, TiXmlEncoding encoding, TiXmlVisitor* visitor )
 {
 	ClearError();
 
@@ -751,17 +766,32 @@ const char* TiXmlDocument::Parse( const char* p, TiXmlParsingData* prevData, TiX
 		return 0;
 	}
 
-	while ( p && *p )
+	bool stop = visitor && !visitor->VisitEnter( *this );
+	bool foundNode = false;
+	const char* end = p;
+
+	while ( !stop && p && *p )
 	{
 		TiXmlNode* node = Identify( p, encoding );
-		if ( node )
+		if ( !node )
+		{
+			break;
+		}
+
+		foundNode = true;
+		if ( !visitor )
 		{
 			p = node->Parse( p, &data, encoding );
 			LinkEndChild( node );
 		}
+		else if ( node->ToElement() )
+		{
+			p = node->ToElement()->ParseVisit( p, &data, encoding, visitor, &stop );
+		}
 		else
 		{
-			break;
+			p = node->Parse( p, &data, encoding );
+			stop = p && !node->Accept( visitor );
 		}
 
 		// Did we get encoding info?
@@ -782,15 +812,33 @@ const char* TiXmlDocument::Parse( const char* p, TiXmlParsingData* prevData, TiX
 				encoding = TIXML_ENCODING_LEGACY;
 		}
 
+		if ( visitor )
+			delete node;
+
+		if ( stop )
+			return p;
+
+		// SkipWhiteSpace() returns null at the end of the data, so remember
+		// where the last node finished.
+		end = p;
 		p = SkipWhiteSpace( p, encoding );
 	}
 
+	if ( visitor && error )
+		return 0;
+
 	// Was this empty?
-	if ( !firstChild ) {
+	if ( !foundNode ) {
 		SetError( TIXML_ERROR_DOCUMENT_EMPTY, 0, 0, encoding );
 		return 0;
 	}
 
+	if ( visitor )
+	{
+		visitor->VisitExit( *this );
+		return p ? p : end;
+	}
+
 	// All is well.
 	return p;
 }
@@ -1041,9 +1089,54 @@ void TiXmlElement::StreamIn (std::istream * in, TIXML_STRING * tag)
 #endif
 
 const char* TiXmlElement::Parse( const char* p, TiXmlParsingData* data, TiXmlEncoding encoding )
+{
+	bool isEmpty = false;
+	p = ReadStartTag( p, data, encoding, &isEmpty );
+	if ( !p || isEmpty )
+		return p;
+
+	// Read the value -- which can include other
+	// elements -- read the end tag, and return.
+	p = ReadValue( p, data, encoding );		// Note this is an Element method, and will set the error if one happens.
+	return ReadEndTag( p, data, encoding );
+}
+
+
+const char* TiXmlElement::ParseVisit( const char* p, TiXmlParsingData* data, TiXmlEncoding encoding,
+									  TiXmlVisitor* visitor, bool* stop )
+{
+	bool isEmpty = false;
+	p = ReadStartTag( p, data, encoding, &isEmpty );
+	if ( !p )
+		return 0;
+
+	if ( !visitor->VisitEnter( *this, attributeSet.First() ) )
+	{
+		*stop = true;
+		return p;
+	}
+
+	if ( !isEmpty )
+	{
+		p = ReadValue( p, data, encoding, visitor, stop );
+		if ( !p || *stop )
+			return p;
+		p = ReadEndTag( p, data, encoding );
+		if ( !p )
+			return 0;
+	}
+
+	if ( !visitor->VisitExit( *this ) )
+		*stop = true;
+	return p;
+}
+
+
+const char* TiXmlElement::ReadStartTag( const char* p, TiXmlParsingData* data, TiXmlEncoding encoding, bool* isEmpty )
 {
 	p = SkipWhiteSpace( p, encoding );
 	TiXmlDocument* document = GetDocument();
+	*isEmpty = false;
 
 	if ( !p || !*p )
 	{
@@ -1075,9 +1168,6 @@ const char* TiXmlElement::Parse( const char* p, TiXmlParsingData* data, TiXmlEnc
 		return 0;
 	}
 
-    TIXML_STRING endTag ("</");
-	endTag += value;
-
 	// Check for and read attributes. Also look for an empty
 	// tag or an end tag.
 	while ( p && *p )
@@ -1098,43 +1188,13 @@ const char* TiXmlElement::Parse( const char* p, TiXmlParsingData* data, TiXmlEnc
 				if ( document ) document->SetError( TIXML_ERROR_PARSING_EMPTY, p, data, encoding );		
 				return 0;
 			}
+			*isEmpty = true;
 			return (p+1);
 		}
 		else if ( *p == '>' )
 		{
 			// Done with attributes (if there were any.)
-			// Read the value -- which can include other
-			// elements -- read the end tag, and return.
-			++p;
-			p = ReadValue( p, data, encoding );		// Note this is an Element method, and will set the error if one happens.
-			if ( !p || !*p ) {
-				// We were looking for the end tag, but found nothing.
-				// Fix for [ 1663758 ] Failure to report error on bad XML
-				if ( document ) document->SetError( TIXML_ERROR_READING_END_TAG, p, data, encoding );
-				return 0;
-			}
-
-			// We should find the end tag now
-			// note that:
-			// </foo > and
-			// </foo> 
-			// are both valid end tags.
-			if ( StringEqual( p, endTag.c_str(), false, encoding ) )
-			{
-				p += endTag.length();
-				p = SkipWhiteSpace( p, encoding );
-				if ( p && *p && *p == '>' ) {
-					++p;
-					return p;
-				}
-				if ( document ) document->SetError( TIXML_ERROR_READING_END_TAG, p, data, encoding );
-				return 0;
-			}
-			else
-			{
-				if ( document ) document->SetError( TIXML_ERROR_READING_END_TAG, p, data, encoding );
-				return 0;
-			}
+			return (p+1);
 		}
 		else
 		{
@@ -1176,7 +1236,41 @@ const char* TiXmlElement::Parse( const char* p, TiXmlParsingData* data, TiXmlEnc
 }
 
 
-const char* TiXmlElement::ReadValue( const char* p, TiXmlParsingData* data, TiXmlEncoding encoding )
+const char* TiXmlElement::ReadEndTag( const char* p, TiXmlParsingData* data, TiXmlEncoding encoding )
+{
+	TiXmlDocument* document = GetDocument();
+
+	if ( !p || !*p ) {
+		// We were looking for the end tag, but found nothing.
+		// Fix for [ 1663758 ] Failure to report error on bad XML
+		if ( document ) document->SetError( TIXML_ERROR_READING_END_TAG, p, data, encoding );
+		return 0;
+	}
+
+	TIXML_STRING endTag ("</");
+	endTag += value;
+
+	// We should find the end tag now
+	// note that:
+	// </foo > and
+	// </foo> 
+	// are both valid end tags.
+	if ( StringEqual( p, endTag.c_str(), false, encoding ) )
+	{
+		p += endTag.length();
+		p = SkipWhiteSpace( p, encoding );
+		if ( p && *p && *p == '>' ) {
+			++p;
+			return p;
+		}
+	}
+	if ( document ) document->SetError( TIXML_ERROR_READING_END_TAG, p, data, encoding );
+	return 0;
+}
+
+
+const char* TiXmlElement::ReadValue( const char* p, TiXmlParsingData* data, TiXmlEncoding encoding,
+									 TiXmlVisitor* visitor, bool* stop )
 {
 	TiXmlDocument* document = GetDocument();
 
@@ -1207,10 +1301,15 @@ const char* TiXmlElement::ReadValue( const char* p, TiXmlParsingData* data, TiXm
 				p = textNode->Parse( pWithWhiteSpace, data, encoding );
 			}
 
-			if ( !textNode->Blank() )
-				LinkEndChild( textNode );
-			else
+			if ( textNode->Blank() )
+				delete textNode;
+			else if ( visitor )
+			{
+				*stop = p && !textNode->Accept( visitor );
 				delete textNode;
+			}
+			else
+				LinkEndChild( textNode );
 		} 
 		else 
 		{
@@ -1224,17 +1323,30 @@ const char* TiXmlElement::ReadValue( const char* p, TiXmlParsingData* data, TiXm
 			else
 			{
 				TiXmlNode* node = Identify( p, encoding );
-				if ( node )
+				if ( !node )
+				{
+					return 0;
+				}
+				else if ( !visitor )
 				{
 					p = node->Parse( p, data, encoding );
 					LinkEndChild( node );
-				}				
+				}
 				else
 				{
-					return 0;
+					if ( node->ToElement() )
+						p = node->ToElement()->ParseVisit( p, data, encoding, visitor, stop );
+					else
+					{
+						p = node->Parse( p, data, encoding );
+						*stop = p && !node->Accept( visitor );
+					}
+					delete node;
 				}
 			}
 		}
+		if ( stop && *stop )
+			return p;
 		pWithWhiteSpace = p;
 		p = SkipWhiteSpace( p, encoding );
 	}
@@ -0,0 +1,443 @@
+/*
+  Martin Galpin (m@66laps.com)
+  
+  Copyright (c) 2010 66laps Limited. All rights reserved.
+  
+  This file is part of rFactor-OpenMotorsport.
+  
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+  
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#include "Catalog.hpp"
+#include "Files.hpp"
+#include "OpenMotorsport.hpp"
+#include "WorkPool.hpp"
+#include "tinyxml.h"
+#include "unzip.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Collects the fields of a meta.xml as it is parsed and stops at the end of
+// the markers, so the statistics that follow are never read.
+class MetadataVisitor : public TiXmlVisitor
+{
+public:
+  MetadataVisitor(CatalogEntry& entry) : mEntry(entry), mFound(false) {}
+
+  bool IsFound() const { return mFound; }
+
+  virtual bool VisitEnter(const TiXmlElement& element, 
+                          const TiXmlAttribute* /* firstAttribute */)
+  {
+    mPath += "/";
+    mPath += element.Value();
+    if(mPath == "/openmotorsport") {
+      mFound = true;
+    }
+    else if(mPath == "/openmotorsport/markers") {
+      element.QueryIntAttribute("sectors", &mEntry.sectors);
+    }
+    else if(mPath == "/openmotorsport/markers/marker") {
+      double time;
+      if(element.QueryDoubleAttribute("time", &time) == TIXML_SUCCESS)
+        mEntry.markers.push_back((int) time);
+    }
+    else if(mPath == "/openmotorsport/statistics") {
+      return false;
+    }
+    return mFound;
+  }
+
+  virtual bool VisitExit(const TiXmlElement& /* element */)
+  {
+    bool markers = mPath == "/openmotorsport/markers";
+    mPath.erase(mPath.rfind('/'));
+    return !markers;
+  }
+
+  virtual bool Visit(const TiXmlText& text)
+  {
+    std::string* field = NULL;
+    if(mPath == "/openmotorsport/metadata/user")
+      field = &mEntry.user;
+    else if(mPath == "/openmotorsport/metadata/vehicle/name")
+      field = &mEntry.vehicle;
+    else if(mPath == "/openmotorsport/metadata/vehicle/category")
+      field = &mEntry.category;
+    else if(mPath == "/openmotorsport/metadata/venue/name")
+      field = &mEntry.venue;
+    else if(mPath == "/openmotorsport/metadata/date")
+      field = &mEntry.date;
+    else if(mPath == "/openmotorsport/metadata/datasource")
+      field = &mEntry.datasource;
+    else if(mPath == "/openmotorsport/metadata/duration")
+      mEntry.duration = (float) atof(text.Value());
+
+    if(field) *field = text.Value();
+    return true;
+  }
+
+private:
+  CatalogEntry& mEntry;
+  std::string mPath;
+  bool mFound;
+};
+
+// Reads the entry of one changed file into its own slot.
+class CatalogTask : public WorkPool::Task
+{
+public:
+  CatalogTask(CatalogEntry& entry, std::string& error) : 
+    mEntry(entry), mError(error) {}
+
+  void Run(WorkPool&, int) {
+    try {
+      Catalog::ReadEntry(mEntry.path, mEntry);
+    }
+    catch(const char* e) {
+      mError = e;
+    }
+  }
+
+private:
+  CatalogEntry& mEntry;
+  std::string& mError;
+};
+
+// Whether text contains a (lower case) pattern, ignoring case.
+static bool ContainsNoCase(const std::string& text, const std::string& pattern)
+{
+  if(pattern.size() > text.size()) return false;
+  for(size_t i = 0; i + pattern.size() <= text.size(); ++i) {
+    size_t j = 0;
+    while(j < pattern.size() && tolower((unsigned char) text[i + j]) == pattern[j])
+      ++j;
+    if(j == pattern.size()) return true;
+  }
+  return false;
+}
+
+static std::string ToLower(const std::string& text)
+{
+  std::string lower = text;
+  for(size_t i = 0; i < lower.size(); ++i)
+    lower[i] = (char) tolower((unsigned char) lower[i]);
+  return lower;
+}
+
+/******************************************************************************/
+/* Reading and writing the catalog file. */
+/******************************************************************************/
+
+// The catalog file is little endian: the magic and version, the number of
+// entries, and then each entry with its strings prefixed by their length.
+
+template <typename T>
+static void Write(std::vector<char>& buffer, T value)
+{
+  const char* bytes = (const char*) &value;
+  buffer.insert(buffer.end(), bytes, bytes + sizeof(T));
+}
+
+static void WriteString(std::vector<char>& buffer, const std::string& value)
+{
+  Write(buffer, (unsigned short) value.size());
+  buffer.insert(buffer.end(), value.begin(), value.end());
+}
+
+class CatalogReader
+{
+public:
+  CatalogReader(const std::vector<char>& buffer) : 
+    mBuffer(buffer), mOffset(0) {}
+
+  bool IsValid() const { return mOffset <= mBuffer.size(); }
+
+  template <typename T>
+  T Read() {
+    T value = 0;
+    if(mOffset + sizeof(T) <= mBuffer.size())
+      memcpy(&value, &mBuffer[mOffset], sizeof(T));
+    mOffset += sizeof(T);
+    return value;
+  }
+
+  std::string ReadString() {
+    size_t length = Read<unsigned short>();
+    if(mOffset + length > mBuffer.size()) {
+      mOffset = mBuffer.size() + 1;
+      return std::string();
+    }
+    std::string value(mBuffer.begin() + mOffset, 
+                      mBuffer.begin() + mOffset + length);
+    mOffset += length;
+    return value;
+  }
+
+private:
+  const std::vector<char>& mBuffer;
+  size_t mOffset;
+};
+
+/******************************************************************************/
+/* Definition of CatalogEntry and CatalogQuery. */
+/******************************************************************************/
+
+CatalogEntry::CatalogEntry() :
+  modified(0),
+  size(0),
+  duration(kSessionNoSampleDuration),
+  sectors(kSessionNoSectors)
+{}
+
+int CatalogEntry::GetLaps() const
+{
+  size_t markersPerLap = sectors == kSessionNoSectors ? 1 : sectors + 1;
+  size_t lapEnds = (markers.size() + markersPerLap - 1) / markersPerLap;
+  return lapEnds > 1 ? (int) lapEnds - 1 : 0;
+}
+
+int CatalogEntry::GetBestLap() const
+{
+  size_t markersPerLap = sectors == kSessionNoSectors ? 1 : sectors + 1;
+  int best = kCatalogNoLap;
+  for(size_t i = markersPerLap; i < markers.size(); i += markersPerLap) {
+    int lap = markers[i] - markers[i - markersPerLap];
+    if(best == kCatalogNoLap || lap < best) best = lap;
+  }
+  return best;
+}
+
+CatalogQuery::CatalogQuery() : laps(0)
+{}
+
+bool CatalogQuery::Matches(const CatalogEntry& entry) const
+{
+  if(!user.empty() && !ContainsNoCase(entry.user, user))
+    return false;
+  if(!vehicle.empty() && !ContainsNoCase(entry.vehicle, vehicle) &&
+      !ContainsNoCase(entry.category, vehicle))
+    return false;
+  if(!venue.empty() && !ContainsNoCase(entry.venue, venue))
+    return false;
+  if(!after.empty() && entry.date.compare(0, after.size(), after) < 0)
+    return false;
+  if(!before.empty() && entry.date.compare(0, before.size(), before) >= 0)
+    return false;
+  return laps <= 0 || entry.GetLaps() >= laps;
+}
+
+/******************************************************************************/
+/* Definition of Catalog. */
+/******************************************************************************/
+
+Catalog::Catalog() :
+  mAdded(0),
+  mUpdated(0),
+  mRemoved(0),
+  mUnchanged(0)
+{}
+
+bool Catalog::Load(const std::string& path)
+{
+  mEntries.clear();
+
+  FILE* file = fopen(path.c_str(), "rb");
+  if(file == NULL) return false;
+  std::vector<char> buffer;
+  char chunk[64 * 1024];
+  size_t read;
+  while((read = fread(chunk, 1, sizeof(chunk), file)) > 0)
+    buffer.insert(buffer.end(), chunk, chunk + read);
+  fclose(file);
+
+  CatalogReader reader(buffer);
+  if(reader.Read<unsigned int>() != kCatalogMagic || 
+      reader.Read<unsigned int>() != kCatalogVersion)
+    return false;
+
+  unsigned int count = reader.Read<unsigned int>();
+  if(count <= buffer.size()) mEntries.reserve(count);
+  for(unsigned int i = 0; i < count && reader.IsValid(); ++i) {
+    mEntries.push_back(CatalogEntry());
+    CatalogEntry& entry = mEntries.back();
+    entry.path = reader.ReadString();
+    entry.modified = reader.Read<long long>();
+    entry.size = reader.Read<long long>();
+    entry.user = reader.ReadString();
+    entry.vehicle = reader.ReadString();
+    entry.category = reader.ReadString();
+    entry.venue = reader.ReadString();
+    entry.date = reader.ReadString();
+    entry.datasource = reader.ReadString();
+    entry.duration = reader.Read<float>();
+    entry.sectors = reader.Read<int>();
+    unsigned int markers = reader.Read<unsigned int>();
+    for(unsigned int j = 0; j < markers && reader.IsValid(); ++j)
+      entry.markers.push_back(reader.Read<int>());
+  }
+
+  if(!reader.IsValid()) {
+    mEntries.clear();
+    return false;
+  }
+  return true;
+}
+
+void Catalog::Save(const std::string& path) const
+{
+  std::vector<char> buffer;
+  Write(buffer, (unsigned int) kCatalogMagic);
+  Write(buffer, (unsigned int) kCatalogVersion);
+  Write(buffer, (unsigned int) mEntries.size());
+  for(size_t i = 0; i < mEntries.size(); ++i) {
+    const CatalogEntry& entry = mEntries[i];
+    WriteString(buffer, entry.path);
+    Write(buffer, entry.modified);
+    Write(buffer, entry.size);
+    WriteString(buffer, entry.user);
+    WriteString(buffer, entry.vehicle);
+    WriteString(buffer, entry.category);
+    WriteString(buffer, entry.venue);
+    WriteString(buffer, entry.date);
+    WriteString(buffer, entry.datasource);
+    Write(buffer, entry.duration);
+    Write(buffer, entry.sectors);
+    Write(buffer, (unsigned int) entry.markers.size());
+    for(size_t j = 0; j < entry.markers.size(); ++j)
+      Write(buffer, entry.markers[j]);
+  }
+
+  // never leave a partial catalog under the real name
+  std::string temporary = path + ".tmp";
+  FILE* file = fopen(temporary.c_str(), "wb");
+  if(file == NULL) {
+    throw "Failed to open catalog for writing.";
+  }
+  bool written = fwrite(&buffer[0], 1, buffer.size(), file) == buffer.size();
+  if(fclose(file) != 0 || !written) {
+    remove(temporary.c_str());
+    throw "Failed to write catalog.";
+  }
+  if(!MoveFileReplacing(temporary, path)) {
+    remove(temporary.c_str());
+    throw "Failed to replace catalog.";
+  }
+}
+
+void Catalog::Update(const std::string& directory, int workers)
+{
+  mAdded = mUpdated = mRemoved = mUnchanged = 0;
+  mErrors.clear();
+
+  std::vector<FileInfo> files;
+  FindFiles(directory, ".om", files);
+
+  std::tr1::unordered_map<std::string, size_t> previous;
+  for(size_t i = 0; i < mEntries.size(); ++i)
+    previous[mEntries[i].path] = i;
+
+  // keep the entries of unchanged files and read the others
+  std::vector<CatalogEntry> entries(files.size());
+  std::vector<std::string> errors(files.size());
+  std::vector<size_t> changed;
+  for(size_t i = 0; i < files.size(); ++i) {
+    std::tr1::unordered_map<std::string, size_t>::iterator it = 
+      previous.find(files[i].path);
+    if(it != previous.end()) {
+      const CatalogEntry& entry = mEntries[it->second];
+      previous.erase(it);
+      if(entry.modified == files[i].modified && entry.size == files[i].size) {
+        entries[i] = entry;
+        mUnchanged++;
+        continue;
+      }
+      mUpdated++;
+    }
+    else {
+      mAdded++;
+    }
+    entries[i].path = files[i].path;
+    entries[i].modified = files[i].modified;
+    entries[i].size = files[i].size;
+    changed.push_back(i);
+  }
+  mRemoved = previous.size();
+
+  if(!changed.empty()) {
+    WorkPool pool(workers);
+    for(size_t i = 0; i < changed.size(); ++i)
+      pool.Submit(new CatalogTask(entries[changed[i]], errors[changed[i]]));
+    pool.Run();
+  }
+
+  mEntries.clear();
+  for(size_t i = 0; i < entries.size(); ++i) {
+    if(errors[i].empty())
+      mEntries.push_back(entries[i]);
+    else
+      mErrors.push_back(entries[i].path + ": " + errors[i]);
+  }
+}
+
+void Catalog::Find(const CatalogQuery& query, 
+                   std::vector<const CatalogEntry*>& results) const
+{
+  CatalogQuery lower = query;
+  lower.user = ToLower(query.user);
+  lower.vehicle = ToLower(query.vehicle);
+  lower.venue = ToLower(query.venue);
+
+  for(size_t i = 0; i < mEntries.size(); ++i) {
+    if(lower.Matches(mEntries[i]))
+      results.push_back(&mEntries[i]);
+  }
+}
+
+void Catalog::ReadEntry(const std::string& path, CatalogEntry& entry)
+{
+  // opening the archive reads its central directory, which locates meta.xml
+  unzFile uf = unzOpen64(path.c_str());
+  if(uf == NULL) {
+    throw "Failed to open OpenMotorsport file for reading.";
+  }
+
+  std::vector<char> metaXml;
+  unz_file_info64 info;
+  bool ok = unzLocateFile(uf, "meta.xml", 0) == UNZ_OK &&
+    unzGetCurrentFileInfo64(uf, &info, NULL, 0, NULL, 0, NULL, 0) == UNZ_OK &&
+    unzOpenCurrentFile(uf) == UNZ_OK;
+  if(ok) {
+    metaXml.resize((size_t) info.uncompressed_size + 1);
+    int read = info.uncompressed_size > 0 ?
+      unzReadCurrentFile(uf, &metaXml[0], (unsigned) info.uncompressed_size) : 0;
+    ok = read == (int) info.uncompressed_size;
+    if(unzCloseCurrentFile(uf) != UNZ_OK) ok = false;
+  }
+  unzClose(uf);
+  if(!ok) {
+    throw "Failed to read OpenMotorsport/meta.xml.";
+  }
+  metaXml.back() = '\0';
+
+  MetadataVisitor visitor(entry);
+  TiXmlDocument doc;
+  doc.ParseVisit(&metaXml[0], &visitor);
+  if(doc.Error() || !visitor.IsFound()) {
+    throw "Failed to parse OpenMotorsport/meta.xml.";
+  }
+}
@@ -0,0 +1,172 @@
+/*
+  Martin Galpin (m@66laps.com)
+  
+  Copyright (c) 2010 66laps Limited. All rights reserved.
+  
+  This file is part of rFactor-OpenMotorsport.
+  
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+  
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#pragma once
+#ifndef CATALOG_HPP
+#define CATALOG_HPP
+
+#include <string>
+#include <vector>
+
+#define kCatalogMagic 0x54434D4F  // "OMCT"
+#define kCatalogVersion 1
+#define kCatalogFileName "catalog.omc"
+#define kCatalogNoLap -1
+
+/**
+ * The metadata of one OpenMotorsport file, as kept in a Catalog.
+ */
+struct CatalogEntry
+{
+  std::string path;
+  long long modified;
+  long long size;
+  std::string user;
+  std::string vehicle;
+  std::string category;
+  std::string venue;
+  std::string date;           // ISO 8601, as written to meta.xml
+  std::string datasource;
+  float duration;             // seconds or kSessionNoSampleDuration
+  int sectors;                // or kSessionNoSectors
+  std::vector<int> markers;   // milliseconds
+
+  CatalogEntry();
+
+  /**
+   * @return The number of completed laps.
+   */
+  int GetLaps() const;
+
+  /**
+   * @return The fastest lap time (in milliseconds) or kCatalogNoLap.
+   */
+  int GetBestLap() const;
+};
+
+/**
+ * A search of a Catalog. Empty criteria match every entry. Text is matched
+ * case insensitively anywhere in the field and dates by their ISO 8601
+ * prefix (so "2010-05" is May 2010).
+ */
+struct CatalogQuery
+{
+  std::string user;
+  std::string vehicle;   // the name or category
+  std::string venue;
+  std::string after;     // on or after
+  std::string before;    // before
+  int laps;              // the fewest completed laps
+
+  CatalogQuery();
+
+  /**
+   * @return true if an entry meets every criterion.
+   */
+  bool Matches(const CatalogEntry& entry) const;
+};
+
+/**
+ * An index of the OpenMotorsport files in a directory that is kept on disk,
+ * so that they can be searched without being opened.
+ *
+ * Only meta.xml is read from each file: it is found through the central
+ * directory of the archive and parsed up to the end of the markers, without
+ * building a document. An update only reads the files that are new or whose
+ * modification time or size changed, in parallel.
+ */
+class Catalog
+{
+public:
+  /**
+   * Default constructor. Creates an empty catalog.
+   */
+  Catalog();
+
+  /**
+   * Loads a catalog saved by Save().
+   *
+   * @param path The catalog file.
+   * @return false if the file is missing or not a catalog of this version
+   *   (the catalog is then empty).
+   */
+  bool Load(const std::string& path);
+
+  /**
+   * Writes the catalog to a temporary file and replaces path with it.
+   *
+   * @param path The catalog file.
+   */
+  void Save(const std::string& path) const;
+
+  /**
+   * Brings the catalog up to date with the files in a directory. Files that
+   * fail to read are left out (and tried again by the next update).
+   *
+   * @param directory The directory of OpenMotorsport (.om) files.
+   * @param workers The number of threads (0 for one per processor).
+   */
+  void Update(const std::string& directory, int workers = 0);
+
+  /**
+   * Searches the catalog.
+   *
+   * @param query The criteria.
+   * @param results Receives the matching entries (valid until the catalog
+   *   changes).
+   */
+  void Find(const CatalogQuery& query, 
+            std::vector<const CatalogEntry*>& results) const;
+
+  /**
+   * Reads the metadata of an OpenMotorsport file.
+   *
+   * @param path The file.
+   * @param entry Receives the metadata (but not the modification time or
+   *   size).
+   */
+  static void ReadEntry(const std::string& path, CatalogEntry& entry);
+
+  const std::vector<CatalogEntry>& GetEntries() const { return mEntries; }
+
+  /**
+   * The results of the last Update().
+   */
+  size_t GetAdded() const { return mAdded; }
+  size_t GetUpdated() const { return mUpdated; }
+  size_t GetRemoved() const { return mRemoved; }
+  size_t GetUnchanged() const { return mUnchanged; }
+
+  /**
+   * @return A message for every file that failed in the last Update().
+   */
+  const std::vector<std::string>& GetErrors() const { return mErrors; }
+
+private:
+  std::vector<CatalogEntry> mEntries;
+  size_t mAdded;
+  size_t mUpdated;
+  size_t mRemoved;
+  size_t mUnchanged;
+  std::vector<std::string> mErrors;
+};
+
+#endif /* CATALOG_HPP */
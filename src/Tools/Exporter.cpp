@@ -0,0 +1,326 @@
+/*
+  Martin Galpin (m@66laps.com)
+  
+  Copyright (c) 2010 66laps Limited. All rights reserved.
+  
+  This file is part of rFactor-OpenMotorsport.
+  
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+  
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#include "Exporter.hpp"
+#include "Files.hpp"
+#include "OpenMotorsport.hpp"
+#include "unzip.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define LOCK(lock) EnterCriticalSection(&lock)
+#define UNLOCK(lock) LeaveCriticalSection(&lock)
+#else
+#define LOCK(lock) pthread_mutex_lock(&lock)
+#define UNLOCK(lock) pthread_mutex_unlock(&lock)
+#endif
+
+// Characters of a CSV line: two numbers, a comma and a newline
+#define kExportMaxLine 64
+
+// Exports the channels of a file (by submitting a task for each).
+class ExportFileTask : public WorkPool::Task
+{
+public:
+  ExportFileTask(Exporter& exporter, const std::string& fileName) :
+    mExporter(exporter), mFileName(fileName) {}
+
+  void Run(WorkPool& pool, int worker) {
+    mExporter._exportFile(pool, worker, mFileName);
+  }
+
+private:
+  Exporter& mExporter;
+  std::string mFileName;
+};
+
+// Exports one channel of a file.
+class ExportChannelTask : public WorkPool::Task
+{
+public:
+  ExportChannelTask(Exporter& exporter, const std::string& fileName, int id,
+                    int interval, int start,
+                    OpenMotorsport::Channel::Encoding encoding,
+                    const std::string& name, const std::string& path) :
+    mExporter(exporter), mFileName(fileName), mId(id), mInterval(interval),
+    mStart(start), mEncoding(encoding), mName(name), mPath(path) {}
+
+  void Run(WorkPool&, int) {
+    mExporter._exportChannel(mFileName, mId, mInterval, mStart, mEncoding, 
+      mName, mPath);
+  }
+
+private:
+  Exporter& mExporter;
+  std::string mFileName;
+  int mId;
+  int mInterval;
+  int mStart;
+  OpenMotorsport::Channel::Encoding mEncoding;
+  std::string mName;
+  std::string mPath;
+};
+
+// Replaces the characters that do not belong in a file name.
+static std::string SafeFileName(const std::string& name)
+{
+  std::string safe = name;
+  for(size_t i = 0; i < safe.size(); ++i) {
+    if(strchr("\\/:*?\"<>| ", safe[i])) safe[i] = '_';
+  }
+  return safe;
+}
+
+Exporter::Exporter(Format format, const std::string& outputDirectory) :
+  mFormat(format),
+  mOutputDirectory(outputDirectory),
+  mFiles(0),
+  mChannels(0),
+  mBytesRead(0.0),
+  mBytesWritten(0.0)
+{}
+
+void Exporter::Export(const std::vector<std::string>& fileNames, int workers)
+{
+#ifdef _WIN32
+  InitializeCriticalSection(&mLock);
+#else
+  pthread_mutex_init(&mLock, NULL);
+#endif
+  MakeDirectory(mOutputDirectory);
+
+  WorkPool pool(workers);
+  for(size_t i = 0; i < fileNames.size(); ++i)
+    pool.Submit(new ExportFileTask(*this, fileNames[i]));
+  pool.Run();
+
+#ifdef _WIN32
+  DeleteCriticalSection(&mLock);
+#else
+  pthread_mutex_destroy(&mLock);
+#endif
+}
+
+void Exporter::_exportFile(WorkPool& pool, int worker, const std::string& fileName)
+{
+  OpenMotorsport::Session session;
+  std::vector<OpenMotorsport::Channel*> channels;
+  try {
+    session.ReadMetadata(fileName);
+    session.GetChannels(channels);
+  }
+  catch(const char* e) {
+    _addError(fileName, e);
+    return;
+  }
+
+  std::string directory = 
+    mOutputDirectory + kPathSeparator + SafeFileName(BaseName(fileName));
+  MakeDirectory(directory);
+
+  const char* extension = mFormat == kFormatCSV ? ".csv" : ".bin";
+  for(size_t i = 0; i < channels.size(); ++i) {
+    const OpenMotorsport::Channel& channel = *channels[i];
+    char id[16];
+    sprintf(id, "%d_", channel.GetId());
+    std::string path = directory + kPathSeparator + id +
+      SafeFileName(channel.GetGroup()) + "_" + 
+      SafeFileName(channel.GetName()) + extension;
+    pool.Submit(new ExportChannelTask(*this, fileName, channel.GetId(),
+      channel.GetSampleInterval(), session.GetStartTime(), 
+      channel.GetEncoding(), channel.GetName(), path), worker);
+  }
+  _addResult(1, 0, 0.0, 0.0);
+}
+
+// Reads the times of a variable interval channel, if it has them.
+static bool ReadTimes(unzFile uf, int id, std::vector<float>& times)
+{
+  char entry[32];
+  sprintf(entry, "data/%d.time.bin", id);
+  unz_file_info64 info;
+  if(unzLocateFile(uf, entry, 0) != UNZ_OK) return true;
+  if(unzGetCurrentFileInfo64(uf, &info, NULL, 0, NULL, 0, NULL, 0) != UNZ_OK ||
+      unzOpenCurrentFile(uf) != UNZ_OK)
+    return false;
+
+  times.resize((size_t) (info.uncompressed_size / sizeof(float)));
+  unsigned int bytes = (unsigned int) (times.size() * sizeof(float));
+  int read = bytes ? unzReadCurrentFile(uf, &times[0], bytes) : 0;
+  return unzCloseCurrentFile(uf) == UNZ_OK && read == (int) bytes &&
+    bytes == info.uncompressed_size;
+}
+
+void Exporter::_exportChannel(const std::string& fileName, int id, int interval,
+                              int start, OpenMotorsport::Channel::Encoding encoding,
+                              const std::string& name, const std::string& path)
+{
+  // each channel has its own handle, they cannot be shared between threads
+  unzFile uf = unzOpen64(fileName.c_str());
+  if(uf == NULL) {
+    _addError(fileName, "Failed to open OpenMotorsport file for reading.");
+    return;
+  }
+
+  std::vector<float> times;
+  char entry[32];
+  sprintf(entry, "data/%d.bin", id);
+  unz_file_info64 info;
+  if((interval <= 0 && !ReadTimes(uf, id, times)) ||
+      unzLocateFile(uf, entry, 0) != UNZ_OK ||
+      unzGetCurrentFileInfo64(uf, &info, NULL, 0, NULL, 0, NULL, 0) != UNZ_OK ||
+      unzOpenCurrentFile(uf) != UNZ_OK) {
+    unzClose(uf);
+    _addError(fileName, "Failed to read channel data.");
+    return;
+  }
+
+  FILE* file = fopen(path.c_str(), "wb");
+  if(file == NULL) {
+    unzCloseCurrentFile(uf);
+    unzClose(uf);
+    _addError(path, "Failed to open table for writing.");
+    return;
+  }
+
+  double read = 0.0, written = 0.0;
+  bool ok = true;
+  std::vector<char> buffer(kExportChunkBytes);
+  std::vector<float> decoded;
+  OpenMotorsport::RunLengthDecoder decoder;
+  OpenMotorsport::PointDecoder pointDecoder;
+  bool raw = encoding == OpenMotorsport::Channel::kEncodingRaw;
+  std::vector<char> lines;
+  size_t sample = 0, carry = 0;
+  int length = 0;
+
+  ExportBinaryHeader header;
+  header.count = 0;
+  if(mFormat == kFormatBinary) {
+    // the count is filled in once the samples are decoded
+    header.magic = kExportBinaryMagic;
+    header.version = kExportBinaryVersion;
+    header.interval = interval;
+    header.start = start;
+    header.times = times.empty() ? 0 : 1;
+    ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    written += sizeof(header);
+  }
+  else {
+    std::string text = interval > 0 || !times.empty() ? 
+      "time," + name + "\n" : name + "\n";
+    ok = fwrite(text.data(), 1, text.size(), file) == text.size();
+    written += text.size();
+  }
+
+  while(ok && (length = unzReadCurrentFile(uf, &buffer[carry], 
+      buffer.size() - carry)) > 0) {
+    read += length;
+    const float* values;
+    size_t count;
+    if(!raw) {
+      decoded.clear();
+      if(encoding == OpenMotorsport::Channel::kEncodingPoints)
+        pointDecoder.Decode(&buffer[0], length, decoded);
+      else
+        decoder.Decode(&buffer[0], length, decoded);
+      values = decoded.empty() ? NULL : &decoded[0];
+      count = decoded.size();
+    }
+    else {
+      // the samples are already the column, inflated straight into place
+      values = (const float*) &buffer[0];
+      count = (carry + length) / sizeof(float);
+    }
+
+    if(mFormat == kFormatBinary) {
+      ok = fwrite(values, sizeof(float), count, file) == count;
+      written += count * sizeof(float);
+    }
+    else {
+      if(lines.size() < count * kExportMaxLine)
+        lines.resize(count * kExportMaxLine);
+      char* out = lines.empty() ? NULL : &lines[0];
+      for(size_t i = 0; i < count; ++i, ++sample) {
+        if(interval > 0)
+          out += sprintf(out, "%ld,%.7g\n", 
+            (long) (start + sample * interval), values[i]);
+        else if(sample < times.size())
+          out += sprintf(out, "%.7g,%.7g\n", times[sample], values[i]);
+        else
+          out += sprintf(out, "%.7g\n", values[i]);
+      }
+      size_t size = count > 0 ? out - &lines[0] : 0;
+      if(size > 0)
+        ok = fwrite(&lines[0], 1, size, file) == size;
+      written += size;
+    }
+    header.count += (unsigned int) count;
+
+    // a raw sample may be split between reads
+    if(raw) {
+      size_t bytes = carry + length;
+      carry = bytes - count * sizeof(float);
+      memmove(&buffer[0], &buffer[count * sizeof(float)], carry);
+    }
+  }
+
+  if(ok && !(decoder.IsComplete() && pointDecoder.IsComplete())) ok = false;
+  if(ok && !times.empty() && times.size() != header.count) ok = false;
+  if(ok && mFormat == kFormatBinary && !times.empty()) {
+    ok = fwrite(&times[0], sizeof(float), times.size(), file) == times.size();
+    written += times.size() * sizeof(float);
+  }
+  if(ok && mFormat == kFormatBinary) {
+    ok = fseek(file, 0, SEEK_SET) == 0 && 
+      fwrite(&header, sizeof(header), 1, file) == 1;
+  }
+
+  if(length < 0) ok = false;
+  if(unzCloseCurrentFile(uf) != UNZ_OK) ok = false;
+  unzClose(uf);
+  if(fclose(file) != 0) ok = false;
+
+  if(ok)
+    _addResult(0, 1, read, written);
+  else
+    _addError(path, "Failed to export channel.");
+}
+
+void Exporter::_addResult(size_t files, size_t channels, double read,
+                          double written)
+{
+  LOCK(mLock);
+  mFiles += files;
+  mChannels += channels;
+  mBytesRead += read;
+  mBytesWritten += written;
+  UNLOCK(mLock);
+}
+
+void Exporter::_addError(const std::string& fileName, const std::string& message)
+{
+  LOCK(mLock);
+  mErrors.push_back(fileName + ": " + message);
+  UNLOCK(mLock);
+}
@@ -0,0 +1,132 @@
+/*
+  Martin Galpin (m@66laps.com)
+  
+  Copyright (c) 2010 66laps Limited. All rights reserved.
+  
+  This file is part of rFactor-OpenMotorsport.
+  
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+  
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#pragma once
+#ifndef EXPORTER_HPP
+#define EXPORTER_HPP
+
+#include <string>
+#include <vector>
+
+#include "OpenMotorsport.hpp"
+#include "WorkPool.hpp"
+
+#define kExportBinaryMagic 0x42434D4F  // "OMCB"
+#define kExportBinaryVersion 2
+#define kExportChunkBytes (1024 * 1024)
+
+/**
+ * The header of a binary column file, followed by count little endian
+ * floats. Sample i is at time start + i * interval (ms) unless interval is
+ * -1, when the time of each sample (ms) follows as another count floats if
+ * times is non-zero.
+ */
+struct ExportBinaryHeader
+{
+  unsigned int magic;
+  unsigned int version;
+  int interval;
+  unsigned int count;
+  int start;
+  unsigned int times;
+};
+
+/**
+ * Converts OpenMotorsport files into a table per channel: either CSV (with
+ * the time of each sample) or a binary column file (see
+ * ExportBinaryHeader). Files and their channels are exported in parallel
+ * by a WorkPool, each channel inflated straight into its output buffer
+ * (unless it is run length encoded or points, when it is decoded first).
+ * The times of a variable interval channel are read whole beforehand.
+ *
+ * The tables of <directory>/<name>.om are written to
+ * <output>/<name>/<id>_<group>_<channel>.csv (or .bin).
+ */
+class Exporter
+{
+public:
+  enum Format
+  {
+    kFormatCSV,
+    kFormatBinary
+  };
+
+  /**
+   * Constructor.
+   *
+   * @param format The format of the tables.
+   * @param outputDirectory The directory to write to.
+   */
+  Exporter(Format format, const std::string& outputDirectory);
+
+  /**
+   * Exports files, returning when all are done.
+   *
+   * @param fileNames The OpenMotorsport files.
+   * @param workers The number of threads (0 for one per processor).
+   */
+  void Export(const std::vector<std::string>& fileNames, int workers = 0);
+
+  size_t GetFiles() const { return mFiles; }
+  size_t GetChannels() const { return mChannels; }
+
+  /**
+   * @return The bytes of samples inflated.
+   */
+  double GetBytesRead() const { return mBytesRead; }
+
+  /**
+   * @return The bytes of tables written.
+   */
+  double GetBytesWritten() const { return mBytesWritten; }
+
+  /**
+   * @return A message for every file or channel that failed.
+   */
+  const std::vector<std::string>& GetErrors() const { return mErrors; }
+
+private:
+  friend class ExportFileTask;
+  friend class ExportChannelTask;
+
+  void _exportFile(WorkPool& pool, int worker, const std::string& fileName);
+  void _exportChannel(const std::string& fileName, int id, int interval,
+                      int start, OpenMotorsport::Channel::Encoding encoding,
+                      const std::string& name, const std::string& path);
+  void _addResult(size_t files, size_t channels, double read, double written);
+  void _addError(const std::string& fileName, const std::string& message);
+
+private:
+  Format mFormat;
+  std::string mOutputDirectory;
+  size_t mFiles;
+  size_t mChannels;
+  double mBytesRead;
+  double mBytesWritten;
+  std::vector<std::string> mErrors;
+#ifdef _WIN32
+  CRITICAL_SECTION mLock;
+#else
+  pthread_mutex_t mLock;
+#endif
+};
+
+#endif /* EXPORTER_HPP */
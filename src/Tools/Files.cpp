@@ -0,0 +1,94 @@
+/*
+  Martin Galpin (m@66laps.com)
+  
+  Copyright (c) 2010 66laps Limited. All rights reserved.
+  
+  This file is part of rFactor-OpenMotorsport.
+  
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+  
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#include "Files.hpp"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#endif
+
+void FindFiles(const std::string& directory, const std::string& extension,
+               std::vector<FileInfo>& files)
+{
+#ifdef _WIN32
+  WIN32_FIND_DATAA data;
+  HANDLE find = FindFirstFileA((directory + "\\*" + extension).c_str(), &data);
+  if(find == INVALID_HANDLE_VALUE) return;
+  do {
+    if(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) continue;
+    FileInfo file;
+    file.path = directory + "\\" + data.cFileName;
+    file.modified = ((long long) data.ftLastWriteTime.dwHighDateTime << 32) | 
+      data.ftLastWriteTime.dwLowDateTime;
+    file.size = ((long long) data.nFileSizeHigh << 32) | data.nFileSizeLow;
+    files.push_back(file);
+  } while(FindNextFileA(find, &data));
+  FindClose(find);
+#else
+  DIR* dir = opendir(directory.c_str());
+  if(dir == NULL) return;
+  while(struct dirent* entry = readdir(dir)) {
+    std::string name = entry->d_name;
+    if(name.size() <= extension.size() || name.compare(
+        name.size() - extension.size(), extension.size(), extension) != 0)
+      continue;
+    FileInfo file;
+    file.path = directory + "/" + name;
+    struct stat status;
+    if(stat(file.path.c_str(), &status) != 0 || !S_ISREG(status.st_mode))
+      continue;
+    file.modified = (long long) status.st_mtime;
+    file.size = (long long) status.st_size;
+    files.push_back(file);
+  }
+  closedir(dir);
+#endif
+}
+
+std::string BaseName(const std::string& path)
+{
+  size_t slash = path.find_last_of("\\/");
+  std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+  size_t dot = name.rfind('.');
+  return dot == std::string::npos ? name : name.substr(0, dot);
+}
+
+void MakeDirectory(const std::string& path)
+{
+#ifdef _WIN32
+  CreateDirectoryA(path.c_str(), NULL);
+#else
+  mkdir(path.c_str(), 0755);
+#endif
+}
+
+bool MoveFileReplacing(const std::string& from, const std::string& to)
+{
+#ifdef _WIN32
+  return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+  return rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
@@ -0,0 +1,72 @@
+/*
+  Martin Galpin (m@66laps.com)
+  
+  Copyright (c) 2010 66laps Limited. All rights reserved.
+  
+  This file is part of rFactor-OpenMotorsport.
+  
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+  
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#pragma once
+#ifndef FILES_HPP
+#define FILES_HPP
+
+#include <string>
+#include <vector>
+
+/**
+ * A file found by FindFiles().
+ */
+struct FileInfo
+{
+  std::string path;
+  long long modified;  // last write time (in the units of the platform)
+  long long size;      // bytes
+};
+
+/**
+ * Lists the files in a directory with an extension (not recursively).
+ *
+ * @param directory The directory.
+ * @param extension The extension including the dot (for example ".om").
+ * @param files Receives the files.
+ */
+void FindFiles(const std::string& directory, const std::string& extension,
+               std::vector<FileInfo>& files);
+
+/**
+ * @return The name of a file without its directory or extension.
+ */
+std::string BaseName(const std::string& path);
+
+/**
+ * Creates a directory (if it does not exist).
+ */
+void MakeDirectory(const std::string& path);
+
+/**
+ * Replaces a file with another, as atomically as the platform allows.
+ *
+ * @return true if the file was replaced.
+ */
+bool MoveFileReplacing(const std::string& from, const std::string& to);
+
+#ifdef _WIN32
+#define kPathSeparator "\\"
+#else
+#define kPathSeparator "/"
+#endif
+
+#endif /* FILES_HPP */
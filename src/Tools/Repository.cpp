@@ -0,0 +1,508 @@
+/*
+  Martin Galpin (m@66laps.com)
+  
+  Copyright (c) 2010 66laps Limited. All rights reserved.
+  
+  This file is part of rFactor-OpenMotorsport.
+  
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+  
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#include "Repository.hpp"
+#include "Files.hpp"
+#include "Sha1.hpp"
+#include "iobuffered.h"
+#include "unzip.h"
+#include "zip.h"
+#include "zlib.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define LOCK(lock) EnterCriticalSection(&lock)
+#define UNLOCK(lock) LeaveCriticalSection(&lock)
+#else
+#define LOCK(lock) pthread_mutex_lock(&lock)
+#define UNLOCK(lock) pthread_mutex_unlock(&lock)
+#endif
+
+#define kManifestMaxLine 1024
+#define kZipEntryOverhead 256
+
+// Random values for the bytes of the rolling hash (splitmix64, so that every
+// build cuts in the same places).
+static struct GearTable
+{
+  unsigned int values[256];
+
+  GearTable() {
+    unsigned long long state = 0;
+    for(int i = 0; i < 256; ++i) {
+      unsigned long long z = (state += 0x9E3779B97F4A7C15ULL);
+      z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+      z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+      values[i] = (unsigned int) ((z ^ (z >> 31)) >> 32);
+    }
+  }
+} gGear;
+
+// Splits the entries of a file (by submitting a task for each).
+class IngestFileTask : public WorkPool::Task
+{
+public:
+  IngestFileTask(Repository& repository, size_t file) :
+    mRepository(repository), mFile(file) {}
+
+  void Run(WorkPool& pool, int worker) {
+    mRepository._ingestFile(pool, worker, mFile);
+  }
+
+private:
+  Repository& mRepository;
+  size_t mFile;
+};
+
+// Splits, hashes and stores one entry of a file.
+class IngestEntryTask : public WorkPool::Task
+{
+public:
+  IngestEntryTask(Repository& repository, size_t file, size_t entry) :
+    mRepository(repository), mFile(file), mEntry(entry) {}
+
+  void Run(WorkPool&, int worker) {
+    mRepository._ingestEntry(worker, mFile, mEntry);
+  }
+
+private:
+  Repository& mRepository;
+  size_t mFile;
+  size_t mEntry;
+};
+
+Repository::Repository(const std::string& directory) :
+  mDirectory(directory),
+  mFiles(0),
+  mChunks(0),
+  mNewChunks(0),
+  mBytesRead(0.0),
+  mBytesStored(0.0)
+{
+  MakeDirectory(mDirectory);
+  MakeDirectory(mDirectory + kPathSeparator + "objects");
+  MakeDirectory(mDirectory + kPathSeparator + "manifests");
+}
+
+void Repository::SplitChunks(const char* data, size_t length, 
+                             std::vector<size_t>& ends)
+{
+  const unsigned char* bytes = (const unsigned char*) data;
+  size_t start = 0;
+  while(start < length) {
+    size_t end = length - start > kRepositoryMaxChunk ? 
+      start + kRepositoryMaxChunk : length;
+    size_t i = start + kRepositoryMinChunk;
+    if(i >= end) {
+      ends.push_back(end);
+      break;
+    }
+
+    // each byte is shifted out of the hash after 32 more, so starting 32 
+    // bytes back makes the cut depend on nothing but the bytes around it
+    unsigned int hash = 0;
+    for(size_t j = i - 32; j < i; ++j)
+      hash = (hash << 1) + gGear.values[bytes[j]];
+    for(; i < end; ++i) {
+      hash = (hash << 1) + gGear.values[bytes[i]];
+      if((hash >> (32 - kRepositoryChunkBits)) == 0) {
+        ++i;
+        break;
+      }
+    }
+    ends.push_back(i);
+    start = i;
+  }
+}
+
+void Repository::Ingest(const std::vector<std::string>& fileNames, int workers)
+{
+#ifdef _WIN32
+  InitializeCriticalSection(&mLock);
+#else
+  pthread_mutex_init(&mLock, NULL);
+#endif
+  mFileNames = fileNames;
+  mManifests.assign(fileNames.size(), Manifest());
+  mNewObjects.clear();
+  mFiles = mChunks = mNewChunks = 0;
+  mBytesRead = mBytesStored = 0.0;
+  mErrors.clear();
+
+  // a manifest is named after its file, so only the first file of a name
+  // is ingested rather than have the others overwrite its manifest
+  WorkPool pool(workers);
+  std::set<std::string> names;
+  for(size_t i = 0; i < fileNames.size(); ++i) {
+    mManifests[i].name = BaseName(fileNames[i]);
+    mManifests[i].failed = false;
+    if(!names.insert(mManifests[i].name).second) {
+      _addError(i, "Another file named " + mManifests[i].name + 
+        " is being ingested.");
+      continue;
+    }
+    pool.Submit(new IngestFileTask(*this, i));
+  }
+  pool.Run();
+
+#ifdef _WIN32
+  DeleteCriticalSection(&mLock);
+#else
+  pthread_mutex_destroy(&mLock);
+#endif
+
+  // the manifests are written last, so each refers to stored chunks only
+  for(size_t i = 0; i < mManifests.size(); ++i) {
+    if(mManifests[i].failed) continue;
+    try {
+      _writeManifest(mManifests[i]);
+      mFiles++;
+    }
+    catch(const char* e) {
+      mErrors.push_back(fileNames[i] + ": " + e);
+    }
+  }
+  mManifests.clear();
+}
+
+void Repository::_ingestFile(WorkPool& pool, int worker, size_t file)
+{
+  Manifest& manifest = mManifests[file];
+  unzFile uf = unzOpen64(mFileNames[file].c_str());
+  if(uf == NULL) {
+    _addError(file, "Failed to open OpenMotorsport file for reading.");
+    return;
+  }
+
+  char name[kManifestMaxLine];
+  int status;
+  for(status = unzGoToFirstFile(uf); status == UNZ_OK; 
+    status = unzGoToNextFile(uf))
+  {
+    unz_file_info64 info;
+    if(unzGetCurrentFileInfo64(uf, &info, name, sizeof(name), 
+        NULL, 0, NULL, 0) != UNZ_OK)
+      break;
+
+    ManifestEntry entry;
+    entry.name = name;
+    entry.size = (long long) info.uncompressed_size;
+    memset(&entry.date, 0, sizeof(entry.date));
+    entry.date.tm_sec = info.tmu_date.tm_sec;
+    entry.date.tm_min = info.tmu_date.tm_min;
+    entry.date.tm_hour = info.tmu_date.tm_hour;
+    entry.date.tm_mday = info.tmu_date.tm_mday;
+    entry.date.tm_mon = info.tmu_date.tm_mon;
+    entry.date.tm_year = info.tmu_date.tm_year;
+    manifest.entries.push_back(entry);
+  }
+  unzClose(uf);
+  if(status != UNZ_END_OF_LIST_OF_FILE) {
+    _addError(file, "Failed to read OpenMotorsport file.");
+    return;
+  }
+
+  // this worker takes the entries first; the others steal what they can
+  for(size_t i = 0; i < manifest.entries.size(); ++i)
+    pool.Submit(new IngestEntryTask(*this, file, i), worker);
+}
+
+void Repository::_ingestEntry(int worker, size_t file, size_t entry)
+{
+  ManifestEntry& manifestEntry = mManifests[file].entries[entry];
+
+  // every task opens the archive for itself, so entries inflate in parallel
+  std::vector<char> data;
+  unzFile uf = unzOpen64(mFileNames[file].c_str());
+  bool ok = uf != NULL && 
+    unzLocateFile(uf, manifestEntry.name.c_str(), 0) == UNZ_OK &&
+    unzOpenCurrentFile(uf) == UNZ_OK;
+  if(ok) {
+    data.resize((size_t) manifestEntry.size);
+    int read = data.size() ? unzReadCurrentFile(uf, &data[0], data.size()) : 0;
+    ok = unzCloseCurrentFile(uf) == UNZ_OK && read == (int) data.size();
+  }
+  if(uf != NULL) unzClose(uf);
+  if(!ok) {
+    _addError(file, "Failed to read " + manifestEntry.name + ".");
+    return;
+  }
+
+  std::vector<size_t> ends;
+  SplitChunks(data.empty() ? NULL : &data[0], data.size(), ends);
+
+  size_t newChunks = 0;
+  size_t stored = 0;
+  size_t start = 0;
+  try {
+    for(size_t i = 0; i < ends.size(); ++i) {
+      ChunkRef chunk;
+      chunk.length = (unsigned int) (ends[i] - start);
+      chunk.hash = Sha1::Hex(&data[start], chunk.length);
+      if(_storeChunk(worker, chunk.hash, &data[start], chunk.length, stored))
+        newChunks++;
+      manifestEntry.chunks.push_back(chunk);
+      start = ends[i];
+    }
+  }
+  catch(const char* e) {
+    _addError(file, e);
+    return;
+  }
+  _addResult(ends.size(), newChunks, (double) data.size(), (double) stored);
+}
+
+bool Repository::_storeChunk(int worker, const std::string& hash, 
+                             const char* data, size_t length, size_t& stored)
+{
+  std::string path = _objectPath(hash);
+  FILE* file = fopen(path.c_str(), "rb");
+  if(file != NULL) {
+    fclose(file);
+    return false;
+  }
+
+  uLongf size = compressBound((uLong) length);
+  std::vector<Bytef> compressed(size);
+  if(compress2(&compressed[0], &size, (const Bytef*) data, (uLong) length, 
+      Z_DEFAULT_COMPRESSION) != Z_OK) {
+    throw "Failed to compress chunk.";
+  }
+
+  // Two workers may store the same new chunk at once. Each writes its own
+  // temporary file, and as their contents are the same either may win.
+  MakeDirectory(mDirectory + kPathSeparator + "objects" + kPathSeparator + 
+    hash.substr(0, 2));
+  char suffix[32];
+  sprintf(suffix, ".%d.tmp", worker);
+  std::string temporary = path + suffix;
+  file = fopen(temporary.c_str(), "wb");
+  if(file == NULL) {
+    throw "Failed to open object for writing.";
+  }
+  bool written = fwrite(&compressed[0], 1, size, file) == size;
+  if(fclose(file) != 0 || !written || !MoveFileReplacing(temporary, path)) {
+    remove(temporary.c_str());
+    throw "Failed to write object.";
+  }
+
+  // only count the chunk once, whichever worker stored it
+  LOCK(mLock);
+  bool counted = !mNewObjects.insert(hash).second;
+  UNLOCK(mLock);
+  if(!counted) stored += size;
+  return !counted;
+}
+
+void Repository::Restore(const std::string& name, const std::string& fileName)
+{
+  Manifest manifest;
+  _readManifest(name, manifest);
+
+  BUFFEREDFILE_OPTIONS options;
+  options.estimated_size = 0;
+  options.discard = 0;
+  options.written_size = 0;
+  for(size_t i = 0; i < manifest.entries.size(); ++i)
+    options.estimated_size += manifest.entries[i].size + kZipEntryOverhead;
+
+  zlib_filefunc64_def filefunc;
+  fill_buffered_filefunc64(&filefunc, &options);
+  zipFile zf = zipOpen2_64(fileName.c_str(), APPEND_STATUS_CREATE, NULL, 
+    &filefunc);
+  if(zf == NULL) {
+    throw "Failed to open OpenMotorsport file writing.";
+  }
+
+  try {
+    for(size_t i = 0; i < manifest.entries.size(); ++i) {
+      ManifestEntry& entry = manifest.entries[i];
+      std::vector<std::vector<char> > chunks(entry.chunks.size());
+      std::vector<const void*> parts;
+      std::vector<ZPOS64_T> lengths;
+      for(size_t j = 0; j < entry.chunks.size(); ++j) {
+        _loadChunk(entry.chunks[j], chunks[j]);
+        parts.push_back(&chunks[j][0]);
+        lengths.push_back(chunks[j].size());
+      }
+
+      if(zipWriteNewFileParts64(zf, entry.name.c_str(), &entry.date,
+          parts.empty() ? NULL : &parts[0],
+          lengths.empty() ? NULL : &lengths[0], (unsigned) parts.size()) 
+          != ZIP_OK) {
+        throw "Failed to write OpenMotorsport file.";
+      }
+    }
+  }
+  catch(const char*) {
+    // never leave a partial file behind
+    options.discard = 1;
+    zipClose(zf, NULL);
+    throw;
+  }
+
+  if(zipClose(zf, NULL) != ZIP_OK) {
+    throw "Failed to close OpenMotorsport file.";
+  }
+}
+
+void Repository::_loadChunk(const ChunkRef& chunk, std::vector<char>& data)
+{
+  FILE* file = fopen(_objectPath(chunk.hash).c_str(), "rb");
+  if(file == NULL) {
+    throw "Missing object in repository.";
+  }
+  std::vector<Bytef> compressed;
+  Bytef buffer[16 * 1024];
+  size_t read;
+  while((read = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    compressed.insert(compressed.end(), buffer, buffer + read);
+  fclose(file);
+
+  data.resize(chunk.length);
+  uLongf length = chunk.length;
+  if(compressed.empty() || uncompress((Bytef*) &data[0], &length, 
+      &compressed[0], (uLong) compressed.size()) != Z_OK || 
+      length != chunk.length || 
+      Sha1::Hex(&data[0], data.size()) != chunk.hash) {
+    throw "Corrupt object in repository.";
+  }
+}
+
+// A manifest is text: a header line, then a line for each entry (its size,
+// number of chunks, date and name) followed by a line for each of its chunks
+// (hash and length).
+
+void Repository::_writeManifest(const Manifest& manifest)
+{
+  std::string path = _manifestPath(manifest.name);
+  std::string temporary = path + ".tmp";
+  FILE* file = fopen(temporary.c_str(), "w");
+  if(file == NULL) {
+    throw "Failed to open manifest for writing.";
+  }
+
+  fprintf(file, "openmotorsport-manifest %d\n", kManifestVersion);
+  for(size_t i = 0; i < manifest.entries.size(); ++i) {
+    const ManifestEntry& entry = manifest.entries[i];
+    const struct tm& date = entry.date;
+    fprintf(file, "entry %lld %u %04d-%02d-%02d %02d:%02d:%02d %s\n",
+      entry.size, (unsigned) entry.chunks.size(), date.tm_year, 
+      date.tm_mon + 1, date.tm_mday, date.tm_hour, date.tm_min, date.tm_sec,
+      entry.name.c_str());
+    for(size_t j = 0; j < entry.chunks.size(); ++j) {
+      fprintf(file, "%s %u\n", entry.chunks[j].hash.c_str(), 
+        entry.chunks[j].length);
+    }
+  }
+
+  bool written = !ferror(file);
+  if(fclose(file) != 0 || !written) {
+    remove(temporary.c_str());
+    throw "Failed to write manifest.";
+  }
+  if(!MoveFileReplacing(temporary, path)) {
+    remove(temporary.c_str());
+    throw "Failed to replace manifest.";
+  }
+}
+
+void Repository::_readManifest(const std::string& name, Manifest& manifest)
+{
+  FILE* file = fopen(_manifestPath(name).c_str(), "r");
+  if(file == NULL) {
+    throw "Failed to open manifest.";
+  }
+
+  char line[kManifestMaxLine];
+  int version = 0;
+  bool ok = fgets(line, sizeof(line), file) != NULL &&
+    sscanf(line, "openmotorsport-manifest %d", &version) == 1 &&
+    version == kManifestVersion;
+
+  manifest.name = name;
+  while(ok && fgets(line, sizeof(line), file) != NULL) {
+    ManifestEntry entry;
+    unsigned int chunks;
+    int offset = 0;
+    memset(&entry.date, 0, sizeof(entry.date));
+    ok = sscanf(line, "entry %lld %u %d-%d-%d %d:%d:%d %n", &entry.size, 
+      &chunks, &entry.date.tm_year, &entry.date.tm_mon, &entry.date.tm_mday,
+      &entry.date.tm_hour, &entry.date.tm_min, &entry.date.tm_sec, 
+      &offset) == 8 && offset > 0;
+    if(!ok) break;
+    entry.date.tm_mon -= 1;
+    entry.name = line + offset;
+    entry.name.erase(entry.name.find_last_not_of("\r\n") + 1);
+
+    long long size = 0;
+    for(unsigned int i = 0; ok && i < chunks; ++i) {
+      char hash[64];
+      ChunkRef chunk;
+      ok = fgets(line, sizeof(line), file) != NULL &&
+        sscanf(line, "%63s %u", hash, &chunk.length) == 2 &&
+        strlen(hash) == 2 * kSha1DigestLength;
+      chunk.hash = hash;
+      size += chunk.length;
+      entry.chunks.push_back(chunk);
+    }
+    ok = ok && size == entry.size;
+    manifest.entries.push_back(entry);
+  }
+  fclose(file);
+
+  if(!ok) {
+    throw "Failed to read manifest.";
+  }
+}
+
+std::string Repository::_objectPath(const std::string& hash) const
+{
+  return mDirectory + kPathSeparator + "objects" + kPathSeparator + 
+    hash.substr(0, 2) + kPathSeparator + hash.substr(2);
+}
+
+std::string Repository::_manifestPath(const std::string& name) const
+{
+  return mDirectory + kPathSeparator + "manifests" + kPathSeparator + name + 
+    kManifestExtension;
+}
+
+void Repository::_addResult(size_t chunks, size_t newChunks, double read, 
+                            double stored)
+{
+  LOCK(mLock);
+  mChunks += chunks;
+  mNewChunks += newChunks;
+  mBytesRead += read;
+  mBytesStored += stored;
+  UNLOCK(mLock);
+}
+
+void Repository::_addError(size_t file, const std::string& message)
+{
+  LOCK(mLock);
+  mManifests[file].failed = true;
+  mErrors.push_back(mFileNames[file] + ": " + message);
+  UNLOCK(mLock);
+}
@@ -0,0 +1,179 @@
+/*
+  Martin Galpin (m@66laps.com)
+  
+  Copyright (c) 2010 66laps Limited. All rights reserved.
+  
+  This file is part of rFactor-OpenMotorsport.
+  
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+  
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#pragma once
+#ifndef REPOSITORY_HPP
+#define REPOSITORY_HPP
+
+#include <ctime>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "WorkPool.hpp"
+
+#define kRepositoryMinChunk (2 * 1024)
+#define kRepositoryMaxChunk (64 * 1024)
+#define kRepositoryChunkBits 13  // a cut every 8 KB on average
+#define kManifestVersion 1
+#define kManifestExtension ".omm"
+
+/**
+ * A chunk of an entry, named by the SHA-1 of its contents.
+ */
+struct ChunkRef
+{
+  std::string hash;
+  unsigned int length;
+};
+
+/**
+ * An entry of an archive (meta.xml, a channel or any other file) as the
+ * chunks that make up its uncompressed contents.
+ */
+struct ManifestEntry
+{
+  std::string name;
+  struct tm date;
+  long long size;
+  std::vector<ChunkRef> chunks;
+};
+
+/**
+ * The entries of an archive, in their original order.
+ */
+struct Manifest
+{
+  std::string name;
+  std::vector<ManifestEntry> entries;
+  bool failed;
+};
+
+/**
+ * A content addressed store of OpenMotorsport files. The uncompressed
+ * contents of every entry of an archive are split into chunks where their
+ * content (not their offset) says so, so the same run of samples gives the
+ * same chunks wherever it appears. Each chunk is stored once, deflated, as
+ * objects/<first two digits of its hash>/<rest of its hash>, and every file
+ * ingested leaves a manifest (manifests/<name>.omm) of the chunks needed to
+ * write it again.
+ *
+ * Files restored hold the same entries and contents as the originals, but
+ * are deflated afresh so they need not be identical byte for byte.
+ */
+class Repository
+{
+public:
+  /**
+   * Constructor. Creates the repository if it does not exist.
+   *
+   * @param directory The directory of the repository.
+   */
+  Repository(const std::string& directory);
+
+  /**
+   * Adds files to the repository, chunking and hashing their entries in
+   * parallel. A manifest is only written for a file that was added in full.
+   * Manifests are named after their files, so a file with the same name as
+   * one before it is not added (and is reported by GetErrors()).
+   *
+   * @param fileNames The OpenMotorsport files.
+   * @param workers The number of threads (0 for one per processor).
+   */
+  void Ingest(const std::vector<std::string>& fileNames, int workers = 0);
+
+  /**
+   * Writes a file from its manifest, checking the hash of every chunk.
+   *
+   * @param name The name of the manifest (the name of the file ingested
+   *   without its extension).
+   * @param fileName The file to write.
+   */
+  void Restore(const std::string& name, const std::string& fileName);
+
+  /**
+   * Finds where data should be cut into chunks: where a rolling hash of the
+   * preceding bytes has its top kRepositoryChunkBits clear, but no sooner
+   * than kRepositoryMinChunk and no later than kRepositoryMaxChunk bytes
+   * after the previous cut.
+   *
+   * @param ends Receives the end of each chunk (the last is length).
+   */
+  static void SplitChunks(const char* data, size_t length, 
+                          std::vector<size_t>& ends);
+
+  /**
+   * The results of the last Ingest().
+   */
+  size_t GetFiles() const { return mFiles; }
+  size_t GetChunks() const { return mChunks; }
+  size_t GetNewChunks() const { return mNewChunks; }
+
+  /**
+   * @return The uncompressed bytes of the entries ingested.
+   */
+  double GetBytesRead() const { return mBytesRead; }
+
+  /**
+   * @return The bytes of the objects added to the repository.
+   */
+  double GetBytesStored() const { return mBytesStored; }
+
+  /**
+   * @return A message for every file that failed.
+   */
+  const std::vector<std::string>& GetErrors() const { return mErrors; }
+
+private:
+  friend class IngestFileTask;
+  friend class IngestEntryTask;
+
+  void _ingestFile(WorkPool& pool, int worker, size_t file);
+  void _ingestEntry(int worker, size_t file, size_t entry);
+  bool _storeChunk(int worker, const std::string& hash, const char* data, 
+                   size_t length, size_t& stored);
+  void _loadChunk(const ChunkRef& chunk, std::vector<char>& data);
+  void _writeManifest(const Manifest& manifest);
+  void _readManifest(const std::string& name, Manifest& manifest);
+  std::string _objectPath(const std::string& hash) const;
+  std::string _manifestPath(const std::string& name) const;
+  void _addResult(size_t chunks, size_t newChunks, double read, double stored);
+  void _addError(size_t file, const std::string& message);
+
+private:
+  std::string mDirectory;
+  std::vector<std::string> mFileNames;
+  std::vector<Manifest> mManifests;
+  std::set<std::string> mNewObjects;
+  size_t mFiles;
+  size_t mChunks;
+  size_t mNewChunks;
+  double mBytesRead;
+  double mBytesStored;
+  std::vector<std::string> mErrors;
+#ifdef _WIN32
+  CRITICAL_SECTION mLock;
+#else
+  pthread_mutex_t mLock;
+#endif
+};
+
+#endif /* REPOSITORY_HPP */
@@ -0,0 +1,131 @@
+/*
+  Martin Galpin (m@66laps.com)
+  
+  Copyright (c) 2010 66laps Limited. All rights reserved.
+  
+  This file is part of rFactor-OpenMotorsport.
+  
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+  
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#include "Sha1.hpp"
+
+#include <string.h>
+
+#define ROTATE_LEFT(value, bits) (((value) << (bits)) | ((value) >> (32 - (bits))))
+
+Sha1::Sha1() :
+  mLength(0),
+  mBuffered(0)
+{
+  mState[0] = 0x67452301;
+  mState[1] = 0xEFCDAB89;
+  mState[2] = 0x98BADCFE;
+  mState[3] = 0x10325476;
+  mState[4] = 0xC3D2E1F0;
+}
+
+void Sha1::Update(const void* data, size_t length)
+{
+  const unsigned char* bytes = (const unsigned char*) data;
+  mLength += length;
+
+  if(mBuffered > 0) {
+    size_t copy = 64 - mBuffered < length ? 64 - mBuffered : length;
+    memcpy(mBuffer + mBuffered, bytes, copy);
+    mBuffered += copy;
+    bytes += copy;
+    length -= copy;
+    if(mBuffered < 64) return;
+    _block(mBuffer);
+    mBuffered = 0;
+  }
+  for(; length >= 64; bytes += 64, length -= 64)
+    _block(bytes);
+  memcpy(mBuffer, bytes, length);
+  mBuffered = length;
+}
+
+void Sha1::Final(unsigned char digest[kSha1DigestLength])
+{
+  unsigned long long bits = mLength * 8;
+  unsigned char padding[72] = {0x80};
+  size_t length = mBuffered < 56 ? 56 - mBuffered : 120 - mBuffered;
+  for(int i = 0; i < 8; ++i)
+    padding[length + i] = (unsigned char) (bits >> (56 - 8 * i));
+  Update(padding, length + 8);
+
+  for(int i = 0; i < kSha1DigestLength; ++i)
+    digest[i] = (unsigned char) (mState[i / 4] >> (24 - 8 * (i % 4)));
+}
+
+std::string Sha1::Hex(const void* data, size_t length)
+{
+  Sha1 sha1;
+  sha1.Update(data, length);
+  unsigned char digest[kSha1DigestLength];
+  sha1.Final(digest);
+
+  static const char digits[] = "0123456789abcdef";
+  std::string hex(2 * kSha1DigestLength, '0');
+  for(int i = 0; i < kSha1DigestLength; ++i) {
+    hex[2 * i] = digits[digest[i] >> 4];
+    hex[2 * i + 1] = digits[digest[i] & 0x0F];
+  }
+  return hex;
+}
+
+void Sha1::_block(const unsigned char* block)
+{
+  unsigned int w[80];
+  for(int i = 0; i < 16; ++i) {
+    w[i] = (block[4 * i] << 24) | (block[4 * i + 1] << 16) | 
+      (block[4 * i + 2] << 8) | block[4 * i + 3];
+  }
+  for(int i = 16; i < 80; ++i)
+    w[i] = ROTATE_LEFT(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+  unsigned int a = mState[0], b = mState[1], c = mState[2], d = mState[3], 
+    e = mState[4];
+  for(int i = 0; i < 80; ++i) {
+    unsigned int f, k;
+    if(i < 20) {
+      f = (b & c) | (~b & d);
+      k = 0x5A827999;
+    }
+    else if(i < 40) {
+      f = b ^ c ^ d;
+      k = 0x6ED9EBA1;
+    }
+    else if(i < 60) {
+      f = (b & c) | (b & d) | (c & d);
+      k = 0x8F1BBCDC;
+    }
+    else {
+      f = b ^ c ^ d;
+      k = 0xCA62C1D6;
+    }
+    unsigned int temp = ROTATE_LEFT(a, 5) + f + e + k + w[i];
+    e = d;
+    d = c;
+    c = ROTATE_LEFT(b, 30);
+    b = a;
+    a = temp;
+  }
+  mState[0] += a;
+  mState[1] += b;
+  mState[2] += c;
+  mState[3] += d;
+  mState[4] += e;
+}
@@ -0,0 +1,69 @@
+/*
+  Martin Galpin (m@66laps.com)
+  
+  Copyright (c) 2010 66laps Limited. All rights reserved.
+  
+  This file is part of rFactor-OpenMotorsport.
+  
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+  
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#pragma once
+#ifndef SHA1_HPP
+#define SHA1_HPP
+
+#include <stddef.h>
+#include <string>
+
+#define kSha1DigestLength 20
+
+/**
+ * Computes the SHA-1 digest of data given in any number of parts.
+ */
+class Sha1
+{
+public:
+  /**
+   * Default constructor. Starts a new digest.
+   */
+  Sha1();
+
+  /**
+   * Adds data to the digest.
+   */
+  void Update(const void* data, size_t length);
+
+  /**
+   * Completes the digest. No more data may be added.
+   *
+   * @param digest Receives kSha1DigestLength bytes.
+   */
+  void Final(unsigned char digest[kSha1DigestLength]);
+
+  /**
+   * @return The digest of data as 40 lower case hexadecimal characters.
+   */
+  static std::string Hex(const void* data, size_t length);
+
+private:
+  void _block(const unsigned char* block);
+
+private:
+  unsigned int mState[5];
+  unsigned long long mLength;
+  unsigned char mBuffer[64];
+  size_t mBuffered;
+};
+
+#endif /* SHA1_HPP */
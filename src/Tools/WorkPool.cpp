@@ -0,0 +1,256 @@
+/*
+  Martin Galpin (m@66laps.com)
+  
+  Copyright (c) 2010 66laps Limited. All rights reserved.
+  
+  This file is part of rFactor-OpenMotorsport.
+  
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+  
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#include "WorkPool.hpp"
+
+#ifdef _WIN32
+#define ATOMIC_INCREMENT(value) InterlockedIncrement(&value)
+#define ATOMIC_DECREMENT(value) InterlockedDecrement(&value)
+#else
+#include <unistd.h>
+#define ATOMIC_INCREMENT(value) __sync_add_and_fetch(&value, 1)
+#define ATOMIC_DECREMENT(value) __sync_sub_and_fetch(&value, 1)
+#endif
+
+// Passed to each worker thread
+struct WorkerArgument
+{
+  WorkPool* pool;
+  int worker;
+};
+
+WorkPool::WorkPool(int workers) :
+  mPending(0),
+  mSteals(0),
+  mNext(0),
+  mSignals(0)
+{
+  if(workers <= 0) workers = GetProcessors();
+#ifdef _WIN32
+  InitializeCriticalSection(&mIdleLock);
+  mIdle = CreateSemaphore(NULL, 0, workers, NULL);
+  mSleepers = 0;
+#else
+  pthread_mutex_init(&mIdleLock, NULL);
+  pthread_cond_init(&mIdle, NULL);
+#endif
+  for(int i = 0; i < workers; ++i) {
+    Queue* queue = new Queue();
+#ifdef _WIN32
+    InitializeCriticalSection(&queue->lock);
+#else
+    pthread_mutex_init(&queue->lock, NULL);
+#endif
+    mQueues.push_back(queue);
+  }
+}
+
+WorkPool::~WorkPool()
+{
+  for(size_t i = 0; i < mQueues.size(); ++i) {
+    Queue* queue = mQueues[i];
+    for(size_t j = 0; j < queue->tasks.size(); ++j)
+      delete queue->tasks[j];
+#ifdef _WIN32
+    DeleteCriticalSection(&queue->lock);
+#else
+    pthread_mutex_destroy(&queue->lock);
+#endif
+    delete queue;
+  }
+#ifdef _WIN32
+  CloseHandle(mIdle);
+  DeleteCriticalSection(&mIdleLock);
+#else
+  pthread_cond_destroy(&mIdle);
+  pthread_mutex_destroy(&mIdleLock);
+#endif
+}
+
+int WorkPool::GetProcessors()
+{
+#ifdef _WIN32
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return info.dwNumberOfProcessors > 0 ? (int) info.dwNumberOfProcessors : 1;
+#else
+  long processors = sysconf(_SC_NPROCESSORS_ONLN);
+  return processors > 0 ? (int) processors : 1;
+#endif
+}
+
+void WorkPool::_lock(Queue& queue)
+{
+#ifdef _WIN32
+  EnterCriticalSection(&queue.lock);
+#else
+  pthread_mutex_lock(&queue.lock);
+#endif
+}
+
+void WorkPool::_unlock(Queue& queue)
+{
+#ifdef _WIN32
+  LeaveCriticalSection(&queue.lock);
+#else
+  pthread_mutex_unlock(&queue.lock);
+#endif
+}
+
+void WorkPool::Submit(Task* task, int worker)
+{
+  if(worker < 0 || worker >= GetWorkers())
+    worker = mNext++ % GetWorkers();
+
+  ATOMIC_INCREMENT(mPending);
+  Queue& queue = *mQueues[worker];
+  _lock(queue);
+  queue.tasks.push_back(task);
+  _unlock(queue);
+  _signal(false);
+}
+
+void WorkPool::_wait(long seen)
+{
+  // sleep unless a task was submitted (or the last finished) since seen
+#ifdef _WIN32
+  EnterCriticalSection(&mIdleLock);
+  bool sleep = mPending > 0 && mSignals == seen;
+  if(sleep) mSleepers++;
+  LeaveCriticalSection(&mIdleLock);
+  if(sleep) WaitForSingleObject(mIdle, INFINITE);
+#else
+  pthread_mutex_lock(&mIdleLock);
+  while(mPending > 0 && mSignals == seen)
+    pthread_cond_wait(&mIdle, &mIdleLock);
+  pthread_mutex_unlock(&mIdleLock);
+#endif
+}
+
+void WorkPool::_signal(bool all)
+{
+#ifdef _WIN32
+  EnterCriticalSection(&mIdleLock);
+  mSignals++;
+  long wake = all ? mSleepers : (mSleepers > 0 ? 1 : 0);
+  mSleepers -= wake;
+  LeaveCriticalSection(&mIdleLock);
+  if(wake > 0) ReleaseSemaphore(mIdle, wake, NULL);
+#else
+  pthread_mutex_lock(&mIdleLock);
+  mSignals++;
+  if(all)
+    pthread_cond_broadcast(&mIdle);
+  else
+    pthread_cond_signal(&mIdle);
+  pthread_mutex_unlock(&mIdleLock);
+#endif
+}
+
+WorkPool::Task* WorkPool::_take(int worker)
+{
+  Task* task = NULL;
+  Queue& own = *mQueues[worker];
+  _lock(own);
+  if(!own.tasks.empty()) {
+    task = own.tasks.back();
+    own.tasks.pop_back();
+  }
+  _unlock(own);
+  if(task) return task;
+
+  // steal the oldest task, which is likely to be the largest (a whole file)
+  int workers = GetWorkers();
+  for(int i = 1; i < workers && task == NULL; ++i) {
+    Queue& other = *mQueues[(worker + i) % workers];
+    _lock(other);
+    if(!other.tasks.empty()) {
+      task = other.tasks.front();
+      other.tasks.pop_front();
+    }
+    _unlock(other);
+  }
+  if(task) ATOMIC_INCREMENT(mSteals);
+  return task;
+}
+
+void WorkPool::_work(int worker)
+{
+  while(mPending > 0) {
+    long seen = mSignals;
+    Task* task = _take(worker);
+    if(task == NULL) {
+      // others are still running tasks that may submit more
+      _wait(seen);
+      continue;
+    }
+    task->Run(*this, worker);
+    delete task;
+    if(ATOMIC_DECREMENT(mPending) == 0)
+      _signal(true);
+  }
+}
+
+#ifdef _WIN32
+DWORD WINAPI WorkPool::_thread(LPVOID argument)
+#else
+void* WorkPool::_thread(void* argument)
+#endif
+{
+  WorkerArgument* work = (WorkerArgument*) argument;
+  work->pool->_work(work->worker);
+  return 0;
+}
+
+void WorkPool::Run()
+{
+  // the calling thread is worker 0
+  int workers = GetWorkers();
+  std::vector<WorkerArgument> arguments(workers);
+#ifdef _WIN32
+  std::vector<HANDLE> threads;
+#else
+  std::vector<pthread_t> threads;
+#endif
+  for(int i = 1; i < workers; ++i) {
+    arguments[i].pool = this;
+    arguments[i].worker = i;
+#ifdef _WIN32
+    HANDLE thread = CreateThread(NULL, 0, _thread, &arguments[i], 0, NULL);
+    if(thread != NULL) threads.push_back(thread);
+#else
+    pthread_t thread;
+    if(pthread_create(&thread, NULL, _thread, &arguments[i]) == 0)
+      threads.push_back(thread);
+#endif
+  }
+
+  _work(0);
+
+  for(size_t i = 0; i < threads.size(); ++i) {
+#ifdef _WIN32
+    WaitForSingleObject(threads[i], INFINITE);
+    CloseHandle(threads[i]);
+#else
+    pthread_join(threads[i], NULL);
+#endif
+  }
+}
@@ -0,0 +1,142 @@
+/*
+  Martin Galpin (m@66laps.com)
+  
+  Copyright (c) 2010 66laps Limited. All rights reserved.
+  
+  This file is part of rFactor-OpenMotorsport.
+  
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+  
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#pragma once
+#ifndef WORKPOOL_HPP
+#define WORKPOOL_HPP
+
+#include <deque>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+/**
+ * A pool of worker threads that share tasks by work stealing. Every worker
+ * has its own queue: it takes its newest task first (which keeps the tasks
+ * of one file on one thread while it is busy) and, when empty, steals the
+ * oldest task of another worker. Tasks may submit more tasks. A worker with
+ * nothing to take sleeps until a task is submitted or the last one is done.
+ */
+class WorkPool
+{
+public:
+  /**
+   * A unit of work. Deleted by the pool once run.
+   */
+  class Task
+  {
+  public:
+    virtual ~Task() {}
+
+    /**
+     * @param pool The pool running the task (to submit more).
+     * @param worker The index of the worker running the task.
+     */
+    virtual void Run(WorkPool& pool, int worker) = 0;
+  };
+
+  /**
+   * Constructor.
+   *
+   * @param workers The number of worker threads (0 for one per processor).
+   */
+  WorkPool(int workers = 0);
+
+  /**
+   * Deconstructor. Deletes any task that was never run.
+   */
+  ~WorkPool();
+
+  /**
+   * Adds a task.
+   *
+   * @param task The task, owned by the pool from now on.
+   * @param worker The worker to queue it for (tasks submitted from outside
+   *   the pool are dealt out in turn when this is -1).
+   */
+  void Submit(Task* task, int worker = -1);
+
+  /**
+   * Runs the tasks (and those they submit) and returns when all are done.
+   */
+  void Run();
+
+  /**
+   * @return The number of worker threads.
+   */
+  int GetWorkers() const { return (int) mQueues.size(); }
+
+  /**
+   * @return The number of tasks taken from another worker during Run().
+   */
+  long GetSteals() const { return mSteals; }
+
+  /**
+   * @return The number of processors of this machine.
+   */
+  static int GetProcessors();
+
+private:
+  struct Queue
+  {
+    std::deque<Task*> tasks;
+#ifdef _WIN32
+    CRITICAL_SECTION lock;
+#else
+    pthread_mutex_t lock;
+#endif
+  };
+
+  Task* _take(int worker);
+  void _work(int worker);
+  void _wait(long seen);
+  void _signal(bool all);
+  static void _lock(Queue& queue);
+  static void _unlock(Queue& queue);
+#ifdef _WIN32
+  static DWORD WINAPI _thread(LPVOID argument);
+#else
+  static void* _thread(void* argument);
+#endif
+
+private:
+  std::vector<Queue*> mQueues;
+  volatile long mPending;  // submitted but not yet finished
+  volatile long mSteals;
+  long mNext;
+
+  // wakes idle workers, every change of mSignals is made under mIdleLock
+  volatile long mSignals;
+#ifdef _WIN32
+  CRITICAL_SECTION mIdleLock;
+  HANDLE mIdle;
+  long mSleepers;
+#else
+  pthread_mutex_t mIdleLock;
+  pthread_cond_t mIdle;
+#endif
+};
+
+#endif /* WORKPOOL_HPP */
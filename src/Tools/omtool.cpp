@@ -0,0 +1,400 @@
+/*
+  Martin Galpin (m@66laps.com)
+  
+  Copyright (c) 2010 66laps Limited. All rights reserved.
+  
+  This file is part of rFactor-OpenMotorsport.
+  
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+  
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#include "OpenMotorsport.hpp"
+#include "DerivedChannels.hpp"
+#include "Catalog.hpp"
+#include "Exporter.hpp"
+#include "Files.hpp"
+#include "Repository.hpp"
+
+#include <windows.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+
+/*
+omtool works with OpenMotorsport files outside of the game.
+
+  omtool merge <output.om> <input.om>...
+    Joins the stints of a session (logged one after the other) into one
+    file without recompressing their data.
+
+  omtool export [-binary] [-threads <n>] <directory> <output directory>
+    Converts every file in a directory to a table per channel, CSV unless
+    -binary is given (see Exporter.hpp), using every processor unless a
+    number of threads is given.
+
+  omtool catalog <directory> [<catalog>]
+    Indexes the metadata of every file in a directory (see Catalog.hpp),
+    reading only the files that changed since the catalog was last updated.
+    The catalog is <directory>/catalog.omc unless given.
+
+  omtool find <catalog> [-user <s>] [-vehicle <s>] [-venue <s>]
+              [-after <date>] [-before <date>] [-laps <n>]
+    Lists the files of a catalog that match every criterion given.
+
+  omtool ingest [-threads <n>] <repository> <directory>
+    Adds every file in a directory to a repository that stores each chunk
+    of data once (see Repository.hpp).
+
+  omtool restore <repository> <name> <output.om>
+    Writes a file added to a repository (by its name without extension).
+
+  omtool bench [-samples <n>]
+    Times the kernels of the derived channels (see DerivedChannels.hpp) at
+    every instruction set this CPU supports, against the scalar code.
+*/
+
+#define kBenchSamples (1024 * 1024)
+#define kBenchMinimumMs 500
+
+static int usage()
+{
+  std::cerr << "usage: omtool merge <output.om> <input.om>..." << std::endl
+            << "       omtool export [-binary] [-threads <n>] <directory> "
+               "<output directory>" << std::endl
+            << "       omtool catalog <directory> [<catalog>]" << std::endl
+            << "       omtool find <catalog> [-user <s>] [-vehicle <s>] "
+               "[-venue <s>] [-after <date>] [-before <date>] [-laps <n>]"
+            << std::endl
+            << "       omtool ingest [-threads <n>] <repository> <directory>"
+            << std::endl
+            << "       omtool restore <repository> <name> <output.om>" 
+            << std::endl
+            << "       omtool bench [-samples <n>]" << std::endl;
+  return 2;
+}
+
+static int merge(int argc, char* argv[])
+{
+  if(argc < 2) return usage();
+
+  std::string output = argv[0];
+  std::vector<std::string> inputs(argv + 1, argv + argc);
+
+  DWORD start = GetTickCount();
+  OpenMotorsport::Session::Merge(inputs, output);
+  std::cout << "Merged " << inputs.size() << " files into " << output 
+            << " in " << (GetTickCount() - start) << " ms" << std::endl;
+  return 0;
+}
+
+static int exportFiles(int argc, char* argv[])
+{
+  Exporter::Format format = Exporter::kFormatCSV;
+  int threads = 0;
+  int i = 0;
+  for(; i < argc && argv[i][0] == '-'; ++i) {
+    std::string option = argv[i];
+    if(option == "-binary")
+      format = Exporter::kFormatBinary;
+    else if(option == "-threads" && i + 1 < argc)
+      threads = atoi(argv[++i]);
+    else
+      return usage();
+  }
+  if(argc - i != 2) return usage();
+
+  std::vector<FileInfo> files;
+  FindFiles(argv[i], ".om", files);
+  std::vector<std::string> fileNames;
+  for(size_t j = 0; j < files.size(); ++j)
+    fileNames.push_back(files[j].path);
+  if(fileNames.empty()) {
+    std::cerr << "omtool: No OpenMotorsport files in " << argv[i] << std::endl;
+    return 1;
+  }
+
+  Exporter exporter(format, argv[i + 1]);
+  DWORD start = GetTickCount();
+  exporter.Export(fileNames, threads);
+  double seconds = (GetTickCount() - start) / 1000.0;
+
+  const std::vector<std::string>& errors = exporter.GetErrors();
+  for(size_t j = 0; j < errors.size(); ++j)
+    std::cerr << "omtool: " << errors[j] << std::endl;
+
+  double read = exporter.GetBytesRead() / (1024 * 1024);
+  double written = exporter.GetBytesWritten() / (1024 * 1024);
+  std::cout << std::fixed << std::setprecision(1)
+            << "Exported " << exporter.GetFiles() << " files ("
+            << exporter.GetChannels() << " channels) in " << seconds << " s: "
+            << read << " MB of samples, " << written << " MB written";
+  if(seconds > 0.0)
+    std::cout << ", " << read / seconds << " MB/s";
+  std::cout << std::endl;
+  return errors.empty() ? 0 : 1;
+}
+
+static int catalogFiles(int argc, char* argv[])
+{
+  if(argc < 1 || argc > 2) return usage();
+
+  std::string directory = argv[0];
+  std::string path = argc > 1 ? 
+    argv[1] : directory + kPathSeparator + kCatalogFileName;
+
+  DWORD start = GetTickCount();
+  Catalog catalog;
+  catalog.Load(path);
+  catalog.Update(directory);
+  catalog.Save(path);
+
+  const std::vector<std::string>& errors = catalog.GetErrors();
+  for(size_t i = 0; i < errors.size(); ++i)
+    std::cerr << "omtool: " << errors[i] << std::endl;
+
+  std::cout << "Catalogued " << catalog.GetEntries().size() << " files ("
+            << catalog.GetAdded() << " added, " << catalog.GetUpdated()
+            << " updated, " << catalog.GetRemoved() << " removed, "
+            << catalog.GetUnchanged() << " unchanged) in "
+            << (GetTickCount() - start) << " ms" << std::endl;
+  return errors.empty() ? 0 : 1;
+}
+
+// Formats a lap time (in milliseconds) as m:ss.mmm.
+static std::string formatLapTime(int time)
+{
+  if(time == kCatalogNoLap) return "-";
+  char text[32];
+  sprintf(text, "%d:%02d.%03d", time / 60000, (time / 1000) % 60, time % 1000);
+  return text;
+}
+
+static int findEntries(int argc, char* argv[])
+{
+  if(argc < 1) return usage();
+
+  CatalogQuery query;
+  for(int i = 1; i < argc; i += 2) {
+    std::string option = argv[i];
+    if(i + 1 >= argc) return usage();
+    if(option == "-user")
+      query.user = argv[i + 1];
+    else if(option == "-vehicle")
+      query.vehicle = argv[i + 1];
+    else if(option == "-venue")
+      query.venue = argv[i + 1];
+    else if(option == "-after")
+      query.after = argv[i + 1];
+    else if(option == "-before")
+      query.before = argv[i + 1];
+    else if(option == "-laps")
+      query.laps = atoi(argv[i + 1]);
+    else
+      return usage();
+  }
+
+  Catalog catalog;
+  if(!catalog.Load(argv[0])) {
+    throw "Failed to read catalog.";
+  }
+
+  DWORD start = GetTickCount();
+  std::vector<const CatalogEntry*> results;
+  catalog.Find(query, results);
+  DWORD elapsed = GetTickCount() - start;
+
+  for(size_t i = 0; i < results.size(); ++i) {
+    const CatalogEntry& entry = *results[i];
+    std::cout << entry.date << "  " << entry.user << "  " << entry.vehicle
+              << "  " << entry.venue << "  " << entry.GetLaps() << " laps, best "
+              << formatLapTime(entry.GetBestLap()) << "  " << entry.path 
+              << std::endl;
+  }
+  std::cout << results.size() << " of " << catalog.GetEntries().size()
+            << " files matched in " << elapsed << " ms" << std::endl;
+  return 0;
+}
+
+static int ingest(int argc, char* argv[])
+{
+  int threads = 0;
+  int i = 0;
+  for(; i < argc && argv[i][0] == '-'; ++i) {
+    std::string option = argv[i];
+    if(option == "-threads" && i + 1 < argc)
+      threads = atoi(argv[++i]);
+    else
+      return usage();
+  }
+  if(argc - i != 2) return usage();
+
+  std::vector<FileInfo> files;
+  FindFiles(argv[i + 1], ".om", files);
+  std::vector<std::string> fileNames;
+  for(size_t j = 0; j < files.size(); ++j)
+    fileNames.push_back(files[j].path);
+  if(fileNames.empty()) {
+    std::cerr << "omtool: No OpenMotorsport files in " << argv[i + 1] 
+              << std::endl;
+    return 1;
+  }
+
+  Repository repository(argv[i]);
+  DWORD start = GetTickCount();
+  repository.Ingest(fileNames, threads);
+  double seconds = (GetTickCount() - start) / 1000.0;
+
+  const std::vector<std::string>& errors = repository.GetErrors();
+  for(size_t j = 0; j < errors.size(); ++j)
+    std::cerr << "omtool: " << errors[j] << std::endl;
+
+  double read = repository.GetBytesRead() / (1024 * 1024);
+  double stored = repository.GetBytesStored() / (1024 * 1024);
+  std::cout << std::fixed << std::setprecision(1)
+            << "Ingested " << repository.GetFiles() << " files in " << seconds
+            << " s: " << read << " MB in " << repository.GetChunks() 
+            << " chunks, " << repository.GetNewChunks() << " new ("
+            << stored << " MB stored)";
+  if(seconds > 0.0)
+    std::cout << ", " << read / seconds << " MB/s";
+  std::cout << std::endl;
+  return errors.empty() ? 0 : 1;
+}
+
+static int restore(int argc, char* argv[])
+{
+  if(argc != 3) return usage();
+
+  Repository repository(argv[0]);
+  DWORD start = GetTickCount();
+  repository.Restore(argv[1], argv[2]);
+  std::cout << "Restored " << argv[1] << " to " << argv[2] << " in "
+            << (GetTickCount() - start) << " ms" << std::endl;
+  return 0;
+}
+
+// Evaluates a derived function repeatedly for at least kBenchMinimumMs,
+// returning the time taken per sample (in nanoseconds).
+static double timeFunction(const OpenMotorsport::DerivedFunction& function,
+                           const float* const* inputs, size_t count,
+                           float* output)
+{
+  double samples = 0.0;
+  DWORD start = GetTickCount(), elapsed;
+  do {
+    function.Evaluate(inputs, count, output);
+    samples += count;
+  } while((elapsed = GetTickCount() - start) < kBenchMinimumMs);
+  return elapsed * 1e6 / samples;
+}
+
+static int bench(int argc, char* argv[])
+{
+  size_t count = kBenchSamples;
+  if(argc == 2 && std::string(argv[0]) == "-samples")
+    count = (size_t) atoi(argv[1]);
+  else if(argc != 0)
+    return usage();
+  if(count == 0) return usage();
+
+  // a car lapping a bumpy circle: unit vectors for the orientation columns
+  // and velocity, scaled up for the position
+  std::vector<float> x(count), y(count), z(count);
+  std::vector<float> px(count), py(count), pz(count);
+  for(size_t i = 0; i < count; ++i) {
+    float angle = i * 0.001f;
+    x[i] = cosf(angle);
+    y[i] = 0.05f * sinf(angle * 7.0f);
+    z[i] = sinf(angle);
+    px[i] = 500.0f * x[i];
+    py[i] = 10.0f * y[i];
+    pz[i] = 500.0f * z[i];
+  }
+  const float* vector[3] = { &x[0], &y[0], &z[0] };
+  const float* position[3] = { &px[0], &py[0], &pz[0] };
+
+  InclinationFunction inclination(1.0f);
+  MagnitudeFunction magnitude(3.6f);
+  DistanceFunction distance;
+  const char* names[] = { "inclination", "magnitude", "distance" };
+  const OpenMotorsport::DerivedFunction* functions[] = 
+    { &inclination, &magnitude, &distance };
+  const float* const* inputs[] = { vector, vector, position };
+  const char* levels[] = { "scalar", "sse2", "avx" };
+
+  std::vector<float> scalar(count), output(count);
+  std::cout << count << " samples, ns/sample (speedup, largest difference "
+               "from scalar)" << std::endl;
+  for(int f = 0; f < 3; ++f) {
+    std::cout << std::setw(12) << std::left << names[f] << std::right;
+    double base = 0.0;
+    for(int level = kDerivedKernelScalar; level <= GetDerivedKernelLevel();
+      ++level)
+    {
+      SetDerivedKernelLevel((DerivedKernelLevel) level);
+      float* out = level == kDerivedKernelScalar ? &scalar[0] : &output[0];
+      double ns = timeFunction(*functions[f], inputs[f], count, out);
+
+      // once more from the start to compare with the scalar code
+      distance.Reset();
+      functions[f]->Evaluate(inputs[f], count, out);
+      float difference = 0.0f;
+      for(size_t i = 0; i < count; ++i) {
+        if(fabsf(out[i] - scalar[i]) > difference)
+          difference = fabsf(out[i] - scalar[i]);
+      }
+
+      if(level == kDerivedKernelScalar) base = ns;
+      std::cout << std::fixed << std::setprecision(2) << "  " << levels[level]
+                << " " << ns << " (" << std::setprecision(1) << base / ns
+                << "x, " << std::scientific << std::setprecision(1) 
+                << difference << ")";
+    }
+    std::cout << std::endl;
+  }
+  SetDerivedKernelLevel(GetDerivedKernelLevel());
+  return 0;
+}
+
+int main(int argc, char* argv[])
+{
+  if(argc < 2) return usage();
+
+  std::string command = argv[1];
+  try {
+    if(command == "merge")
+      return merge(argc - 2, argv + 2);
+    if(command == "export")
+      return exportFiles(argc - 2, argv + 2);
+    if(command == "catalog")
+      return catalogFiles(argc - 2, argv + 2);
+    if(command == "find")
+      return findEntries(argc - 2, argv + 2);
+    if(command == "ingest")
+      return ingest(argc - 2, argv + 2);
+    if(command == "restore")
+      return restore(argc - 2, argv + 2);
+    if(command == "bench")
+      return bench(argc - 2, argv + 2);
+  }
+  catch(const char* e) {
+    std::cerr << "omtool: " << e << std::endl;
+    return 1;
+  }
+  return usage();
+}
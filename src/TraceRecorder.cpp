@@ -0,0 +1,104 @@
+/*
+  Martin Galpin (m@66laps.com)
+  
+  Copyright (c) 2010 66laps Limited. All rights reserved.
+  
+  This file is part of rFactor-OpenMotorsport.
+  
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+  
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#include <stdio.h>
+
+#include "TraceRecorder.hpp"
+
+TraceRecorder::TraceRecorder(size_t capacity) :
+  mEvents(capacity > 0 ? capacity : 1)
+{
+  Clear();
+}
+
+void TraceRecorder::_record(const char* name, char phase, int arg)
+{
+  Event& event = mEvents[mNext];
+  event.name = name;
+  event.time = ReadCycleCounter();
+  event.phase = phase;
+  event.arg = arg;
+  if(++mNext == mEvents.size()) {
+    mNext = 0;
+    mWrapped = true;
+  }
+}
+
+void TraceRecorder::Begin(const char* name, int arg)
+{
+  _record(name, 'B', arg);
+}
+
+void TraceRecorder::End()
+{
+  _record(NULL, 'E', kTraceNoArg);
+}
+
+void TraceRecorder::Instant(const char* name)
+{
+  _record(name, 'i', kTraceNoArg);
+}
+
+void TraceRecorder::Clear()
+{
+  mNext = 0;
+  mWrapped = false;
+  mStartCycles = ReadCycleCounter();
+  mStartSeconds = ReadWallSeconds();
+}
+
+bool TraceRecorder::Write(const std::string& fileName)
+{
+  FILE* file = fopen(fileName.c_str(), "w");
+  if(file == NULL) return false;
+
+  double seconds = ReadWallSeconds() - mStartSeconds;
+  ProfileCycles cycles = ReadCycleCounter() - mStartCycles;
+  double cyclesPerMicrosecond = 
+    seconds > 0.0 && cycles > 0 ? cycles / (seconds * 1e6) : 1.0;
+
+  fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+  size_t first = mWrapped ? mNext : 0;
+  size_t count = mWrapped ? mEvents.size() : mNext;
+  int depth = 0;
+  bool comma = false;
+  for(size_t i = 0; i < count; ++i) {
+    const Event& event = mEvents[(first + i) % mEvents.size()];
+    // the beginning of a span may have been overwritten
+    if(event.phase == 'E' && depth == 0) continue;
+    depth += event.phase == 'B' ? 1 : event.phase == 'E' ? -1 : 0;
+
+    double ts = (double) (ProfileCycles) (event.time - mStartCycles) /
+      cyclesPerMicrosecond;
+    fprintf(file, "%s\n{\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":1", 
+      comma ? "," : "", event.phase, ts);
+    if(event.name)
+      fprintf(file, ",\"name\":\"%s\"", event.name);
+    if(event.phase == 'i')
+      fprintf(file, ",\"s\":\"t\"");
+    if(event.arg != kTraceNoArg)
+      fprintf(file, ",\"args\":{\"id\":%d}", event.arg);
+    fprintf(file, "}");
+    comma = true;
+  }
+  fprintf(file, "\n]}\n");
+  return fclose(file) == 0;
+}
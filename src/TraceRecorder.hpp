@@ -0,0 +1,119 @@
+/*
+  Martin Galpin (m@66laps.com)
+  
+  Copyright (c) 2010 66laps Limited. All rights reserved.
+  
+  This file is part of rFactor-OpenMotorsport.
+  
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+  
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#pragma once
+#ifndef TRACERECORDER_HPP
+#define TRACERECORDER_HPP
+
+#include <string>
+#include <vector>
+
+#include "OpenMotorsport.hpp"
+#include "PerformanceMonitor.hpp"
+
+#define kTraceDefaultCapacity 65536
+
+/**
+ * Records spans of the plugin (callbacks, logging and the phases of saving
+ * a session) into a ring allocated up front, and writes them in the Chrome
+ * trace event format (chrome://tracing, Perfetto). When the ring is full the
+ * oldest events are overwritten.
+ */
+class TraceRecorder : public OpenMotorsport::Tracer
+{
+public:
+  /**
+   * Constructor.
+   *
+   * @param capacity The number of events kept.
+   */
+  TraceRecorder(size_t capacity = kTraceDefaultCapacity);
+
+  /**
+   * Marks the start of a span.
+   *
+   * @param name The span, a string literal.
+   * @param arg A value to show with the span or kTraceNoArg.
+   */
+  void Begin(const char* name, int arg = kTraceNoArg);
+
+  /**
+   * Marks the end of the latest span begun.
+   */
+  void End();
+
+  /**
+   * Marks a point in time.
+   *
+   * @param name The event, a string literal.
+   */
+  void Instant(const char* name);
+
+  /**
+   * Forgets every recorded event.
+   */
+  void Clear();
+
+  /**
+   * Writes the recorded events as trace event JSON.
+   *
+   * @param fileName The file to write.
+   * @return true if the file was written.
+   */
+  bool Write(const std::string& fileName);
+
+private:
+  struct Event
+  {
+    const char* name;
+    ProfileCycles time;
+    char phase; // 'B', 'E' or 'i' as the trace event format
+    int arg;
+  };
+
+  void _record(const char* name, char phase, int arg);
+
+private:
+  std::vector<Event> mEvents;
+  size_t mNext;
+  bool mWrapped;
+  ProfileCycles mStartCycles;
+  double mStartSeconds;
+};
+
+/**
+ * Records a span for the life of a scope, if there is a recorder.
+ */
+class TraceScope
+{
+public:
+  TraceScope(TraceRecorder* recorder, const char* name, 
+    int arg = kTraceNoArg) : mRecorder(recorder) {
+    if(mRecorder) mRecorder->Begin(name, arg);
+  }
+  ~TraceScope() {
+    if(mRecorder) mRecorder->End();
+  }
+private:
+  TraceRecorder* mRecorder;
+};
+
+#endif /* TRACERECORDER_HPP */
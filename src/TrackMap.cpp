@@ -0,0 +1,215 @@
+/*
+  Martin Galpin (m@66laps.com)
+  
+  Copyright (c) 2010 66laps Limited. All rights reserved.
+  
+  This file is part of rFactor-OpenMotorsport.
+  
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+  
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#include "TrackMap.hpp"
+
+#include <math.h>
+#include <string.h>
+#include <fstream>
+#include <sstream>
+
+// Appends a value (x86 is little endian).
+template <class T>
+static void Put(std::string& data, T value)
+{
+  data.append((const char*) &value, sizeof(T));
+}
+
+template <class T>
+static bool Get(const std::string& data, size_t& offset, T& value)
+{
+  if(offset + sizeof(T) > data.size()) return false;
+  memcpy(&value, data.data() + offset, sizeof(T));
+  offset += sizeof(T);
+  return true;
+}
+
+static int Quantise(float value)
+{
+  return (int) floor(value / kTrackMapQuantum + 0.5f);
+}
+
+TrackMap::TrackMap() :
+  mLength(0.0f),
+  mSeen(0),
+  mChanged(false)
+{}
+
+void TrackMap::Reset(const std::string& track, float length)
+{
+  if(length < 0.0f) length = 0.0f;
+  if(length > kTrackMapMaxLength) length = kTrackMapMaxLength;
+  mTrack = track;
+  mLength = length;
+  mPoints.assign((size_t) ceil(length / kTrackMapResolution), Point());
+  for(size_t i = 0; i < mPoints.size(); ++i) {
+    mPoints[i].x = mPoints[i].y = mPoints[i].z = 0.0;
+    mPoints[i].count = 0;
+  }
+  mSeen = 0;
+  mChanged = false;
+}
+
+void TrackMap::Add(float distance, float x, float y, float z)
+{
+  if(distance < 0.0f || distance >= mLength) return;
+  size_t i = (size_t) (distance / kTrackMapResolution);
+  if(i >= mPoints.size()) return;
+
+  Point& point = mPoints[i];
+  if(point.count++ == 0) mSeen++;
+  point.x += x;
+  point.y += y;
+  point.z += z;
+  mChanged = true;
+}
+
+float TrackMap::GetCoverage() const
+{
+  return mPoints.empty() ? 0.0f : float(mSeen) / mPoints.size();
+}
+
+// The average position of point i or, if it was never seen, the position
+// between its nearest seen neighbours (the track is a loop).
+void TrackMap::_interpolate(size_t i, float p[3]) const
+{
+  size_t n = mPoints.size();
+  const Point& point = mPoints[i];
+  if(point.count > 0) {
+    p[0] = float(point.x / point.count);
+    p[1] = float(point.y / point.count);
+    p[2] = float(point.z / point.count);
+    return;
+  }
+
+  size_t before = 1, after = 1;
+  while(mPoints[(i + n - before) % n].count == 0) before++;
+  while(mPoints[(i + after) % n].count == 0) after++;
+  const Point& a = mPoints[(i + n - before) % n];
+  const Point& b = mPoints[(i + after) % n];
+  double t = double(before) / (before + after);
+  p[0] = float(a.x / a.count + (b.x / b.count - a.x / a.count) * t);
+  p[1] = float(a.y / a.count + (b.y / b.count - a.y / a.count) * t);
+  p[2] = float(a.z / a.count + (b.z / b.count - a.z / a.count) * t);
+}
+
+bool TrackMap::Encode(std::string& data) const
+{
+  if(!IsComplete()) return false;
+
+  data.clear();
+  data.reserve(32 + mPoints.size() * 3 * sizeof(short));
+  Put<unsigned int>(data, kTrackMapMagic);
+  Put<unsigned short>(data, kTrackMapVersion);
+  Put<unsigned short>(data, 0);
+  Put<float>(data, mLength);
+  Put<float>(data, kTrackMapResolution);
+  Put<unsigned int>(data, (unsigned int) mPoints.size());
+
+  // each delta is from the previous point as it will be decoded, so that
+  // rounding never accumulates
+  int previous[3];
+  for(size_t i = 0; i < mPoints.size(); ++i) {
+    float p[3];
+    _interpolate(i, p);
+    for(int j = 0; j < 3; ++j) {
+      int q = Quantise(p[j]);
+      if(i == 0) {
+        Put<int>(data, q);
+        previous[j] = q;
+        continue;
+      }
+      int delta = q - previous[j];
+      if(delta > 32767) delta = 32767;
+      if(delta < -32768) delta = -32768;
+      Put<short>(data, (short) delta);
+      previous[j] += delta;
+    }
+  }
+  return true;
+}
+
+bool TrackMap::Decode(const std::string& data)
+{
+  size_t offset = 0;
+  unsigned int magic, count;
+  unsigned short version, reserved;
+  float length, resolution;
+  if(!Get(data, offset, magic) || magic != kTrackMapMagic ||
+      !Get(data, offset, version) || version != kTrackMapVersion ||
+      !Get(data, offset, reserved) ||
+      !Get(data, offset, length) || !Get(data, offset, resolution) ||
+      !Get(data, offset, count))
+    return false;
+
+  // a map of a different layout of the track is no use
+  if(resolution != kTrackMapResolution || 
+      fabs(length - mLength) > kTrackMapResolution ||
+      count != (size_t) ceil(length / kTrackMapResolution))
+    return false;
+  if(data.size() != offset + 3 * sizeof(int) + 
+      (count > 0 ? count - 1 : 0) * 3 * sizeof(short))
+    return false;
+
+  mLength = length;
+  mPoints.resize(count);
+
+  int q[3] = { 0, 0, 0 };
+  for(size_t i = 0; i < count; ++i) {
+    for(int j = 0; j < 3; ++j) {
+      if(i == 0) {
+        Get(data, offset, q[j]);
+      } else {
+        short delta;
+        Get(data, offset, delta);
+        q[j] += delta;
+      }
+    }
+    Point& point = mPoints[i];
+    point.x = q[0] * kTrackMapQuantum;
+    point.y = q[1] * kTrackMapQuantum;
+    point.z = q[2] * kTrackMapQuantum;
+    point.count = 1;
+  }
+  mSeen = count;
+  mChanged = false;
+  return true;
+}
+
+bool TrackMap::Load(const std::string& fileName)
+{
+  std::ifstream file(fileName.c_str(), std::ios::in | std::ios::binary);
+  if(!file) return false;
+  std::stringstream data;
+  data << file.rdbuf();
+  return Decode(data.str());
+}
+
+bool TrackMap::Save(const std::string& fileName)
+{
+  std::string data;
+  if(!Encode(data)) return false;
+  std::ofstream file(fileName.c_str(), std::ios::out | std::ios::binary);
+  file.write(data.data(), data.size());
+  if(!file.good()) return false;
+  mChanged = false;
+  return true;
+}
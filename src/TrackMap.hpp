@@ -0,0 +1,144 @@
+/*
+  Martin Galpin (m@66laps.com)
+  
+  Copyright (c) 2010 66laps Limited. All rights reserved.
+  
+  This file is part of rFactor-OpenMotorsport.
+  
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+  
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#pragma once
+#ifndef TRACKMAP_HPP
+#define TRACKMAP_HPP
+
+#include <string>
+#include <vector>
+
+#define kTrackMapMagic 0x4D544D4F   // "OMTM"
+#define kTrackMapVersion 1
+#define kTrackMapResolution 5.0f    // meters of track between points
+#define kTrackMapQuantum 0.01f      // meters per unit of a stored coordinate
+#define kTrackMapMinCoverage 0.9f   // fraction of points seen to be complete
+#define kTrackMapMaxLength 100000.0f
+#define kTrackMapFileName "trackmap.bin"
+
+/**
+ * Builds the centreline of a track from the position of the car. The track
+ * is divided by distance into points kTrackMapResolution meters apart and
+ * every position is averaged into the point at its distance around the
+ * track, so later laps refine (rather than extend) the map.
+ *
+ * A map is stored as a compact polyline (little endian):
+ *
+ *   uint32 magic, uint16 version, uint16 reserved
+ *   float length, float resolution (meters)
+ *   uint32 count
+ *   int32 x, y, z of the first point (in kTrackMapQuantum)
+ *   int16 dx, dy, dz from the previous point, for the other count-1 points
+ *
+ * Point i is at distance (i + 0.5) * resolution. Points that were never
+ * seen are interpolated from their neighbours.
+ */
+class TrackMap
+{
+public:
+  /**
+   * Default constructor. The map is empty until Reset().
+   */
+  TrackMap();
+
+  /**
+   * Starts an empty map.
+   *
+   * @param track The name of the track.
+   * @param length The length of a lap (in meters).
+   */
+  void Reset(const std::string& track, float length);
+
+  /**
+   * Adds a position of the car.
+   *
+   * @param distance The distance around the track (in meters).
+   */
+  void Add(float distance, float x, float y, float z);
+
+  /**
+   * @return The fraction of the points that have been seen.
+   */
+  float GetCoverage() const;
+
+  /**
+   * @return true if enough of the track has been seen to be drawn.
+   */
+  bool IsComplete() const { return GetCoverage() >= kTrackMapMinCoverage; }
+
+  /**
+   * @return true if positions have been added since the map was reset,
+   *   decoded or saved.
+   */
+  bool IsChanged() const { return mChanged; }
+
+  const std::string& GetTrack() const { return mTrack; }
+  float GetLength() const { return mLength; }
+
+  /**
+   * Stores the map as a polyline.
+   *
+   * @param data Receives the polyline.
+   * @return false if the map is not complete.
+   */
+  bool Encode(std::string& data) const;
+
+  /**
+   * Replaces the points with a polyline of the same track (each counting
+   * as a single position).
+   *
+   * @param data The polyline.
+   * @return false if the polyline is invalid or of a different length.
+   */
+  bool Decode(const std::string& data);
+
+  /**
+   * Decodes the polyline in a file.
+   *
+   * @return false if the file cannot be read or Decode() fails.
+   */
+  bool Load(const std::string& fileName);
+
+  /**
+   * Encodes the map into a file.
+   *
+   * @return false if the map is not complete or the file cannot be written.
+   */
+  bool Save(const std::string& fileName);
+
+private:
+  struct Point
+  {
+    double x, y, z;
+    unsigned int count;
+  };
+
+  void _interpolate(size_t i, float p[3]) const;
+
+private:
+  std::string mTrack;
+  float mLength;
+  std::vector<Point> mPoints;
+  size_t mSeen;
+  bool mChanged;
+};
+
+#endif /* TRACKMAP_HPP */
@@ -0,0 +1,115 @@
+/*
+  Martin Galpin (m@66laps.com)
+  
+  Copyright (c) 2010 66laps Limited. All rights reserved.
+  
+  This file is part of rFactor-OpenMotorsport.
+  
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+  
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#include <string.h>
+
+#include "WheelSampler.hpp"
+#include "OpenMotorsport.hpp"
+#include "ChannelDefinitions.hpp"
+
+#define kFractionToPercent 100.0f
+
+const WheelChannel kWheelChannelDefinitions[kWheelChannels] = {
+  { kChannelRotation, kUnitsRadiansPerSecond, kWheelFieldRotation, -1.0f },
+  { kChannelSuspensionDeflection, kUnitsMeters, 
+    kWheelFieldSuspensionDeflection, 1.0f },
+  { kChannelRideHeight, kUnitsMeters, kWheelFieldRideHeight, 1.0f },
+  { kChannelTireLoad, kUnitsNewtons, kWheelFieldTireLoad, 1.0f },
+  { kChannelLateralForce, kUnitsNewtons, kWheelFieldLateralForce, 1.0f },
+  { kChannelBrakeTemperature, kUnitsCelcius, 
+    kWheelFieldBrakeTemperature, 1.0f },
+  { kChannelPressure, kUnitsPascal, kWheelFieldPressure, 1.0f },
+  { kChannelTemperatureLeft, kUnitsCelcius, 
+    kWheelFieldTemperatureLeft, 1.0f },
+  { kChannelTemperatureCenter, kUnitsCelcius, 
+    kWheelFieldTemperatureCenter, 1.0f },
+  { kChannelTemperatureRight, kUnitsCelcius, 
+    kWheelFieldTemperatureRight, 1.0f },
+  { kChannelGripFraction, kUnitsPercent, 
+    kWheelFieldGripFraction, kFractionToPercent },
+  { kChannelWear, kUnitsPercent, kWheelFieldWear, kFractionToPercent }
+};
+
+// Copies the logged fields of a wheel, indexed by kWheelField*. TelemWheelV2
+// extends TelemWheel, so the fields are not read as one run of floats.
+static void ReadWheelFields(const TelemWheelV2& wheel, float* fields)
+{
+  fields[kWheelFieldRotation] = wheel.mRotation;
+  fields[kWheelFieldSuspensionDeflection] = wheel.mSuspensionDeflection;
+  fields[kWheelFieldRideHeight] = wheel.mRideHeight;
+  fields[kWheelFieldTireLoad] = wheel.mTireLoad;
+  fields[kWheelFieldLateralForce] = wheel.mLateralForce;
+  fields[kWheelFieldGripFraction] = wheel.mGripFract;
+  fields[kWheelFieldBrakeTemperature] = wheel.mBrakeTemp;
+  fields[kWheelFieldPressure] = wheel.mPressure;
+  fields[kWheelFieldTemperatureLeft] = wheel.mTemperature[0];
+  fields[kWheelFieldTemperatureCenter] = wheel.mTemperature[1];
+  fields[kWheelFieldTemperatureRight] = wheel.mTemperature[2];
+  fields[kWheelFieldWear] = wheel.mWear;
+}
+
+WheelSampler::WheelSampler() :
+  mAttached(false)
+{
+  for(int i = 0; i < kWheelFields; ++i)
+    mScales[i] = 1.0f;
+  for(int i = 0; i < kWheelChannels; ++i)
+    mScales[kWheelChannelDefinitions[i].field] = kWheelChannelDefinitions[i].scale;
+  memset(mBuffers, 0, sizeof(mBuffers));
+}
+
+void WheelSampler::Attach(OpenMotorsport::Session& session)
+{
+  mAttached = false;
+  for(int i = 0; i < kWheelChannels; ++i) {
+    for(int w = 0; w < kNumberOfWheels; ++w) {
+      mBuffers[i][w] = &session.GetChannel(
+        kWheelChannelDefinitions[i].name, kWheels[w]).GetDataBuffer();
+    }
+  }
+  mAttached = true;
+}
+
+void WheelSampler::Detach()
+{
+  mAttached = false;
+  memset(mBuffers, 0, sizeof(mBuffers));
+}
+
+void WheelSampler::Sample(const TelemWheelV2* wheels)
+{
+  if(!mAttached) return;
+
+  float w0[kWheelFields], w1[kWheelFields], w2[kWheelFields], w3[kWheelFields];
+  ReadWheelFields(wheels[0], w0);
+  ReadWheelFields(wheels[1], w1);
+  ReadWheelFields(wheels[2], w2);
+  ReadWheelFields(wheels[3], w3);
+  for(int i = 0; i < kWheelChannels; ++i) {
+    int field = kWheelChannelDefinitions[i].field;
+    float scale = mScales[field];
+    OpenMotorsport::DataBuffer** buffers = mBuffers[i];
+    buffers[0]->Write(w0[field] * scale);
+    buffers[1]->Write(w1[field] * scale);
+    buffers[2]->Write(w2[field] * scale);
+    buffers[3]->Write(w3[field] * scale);
+  }
+}
@@ -0,0 +1,106 @@
+/*
+  Martin Galpin (m@66laps.com)
+  
+  Copyright (c) 2010 66laps Limited. All rights reserved.
+  
+  This file is part of rFactor-OpenMotorsport.
+  
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+  
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#pragma once
+#ifndef WHEELSAMPLER_HPP
+#define WHEELSAMPLER_HPP
+
+#include "InternalsPlugin.hpp"
+
+// The fields of TelemWheelV2 that are logged, mRotation up to and including mWear
+#define kWheelFields 12
+#define kWheelFieldRotation 0
+#define kWheelFieldSuspensionDeflection 1
+#define kWheelFieldRideHeight 2
+#define kWheelFieldTireLoad 3
+#define kWheelFieldLateralForce 4
+#define kWheelFieldGripFraction 5
+#define kWheelFieldBrakeTemperature 6
+#define kWheelFieldPressure 7
+#define kWheelFieldTemperatureLeft 8
+#define kWheelFieldTemperatureCenter 9
+#define kWheelFieldTemperatureRight 10
+#define kWheelFieldWear 11
+
+#define kWheelChannels 12
+
+namespace OpenMotorsport { class Session; class DataBuffer; }
+
+/**
+ * Describes a channel logged for every wheel.
+ */
+struct WheelChannel
+{
+  const char* name;
+  const char* units;
+  int field;   // one of kWheelField*
+  float scale; // applied to the field before it is written
+};
+
+/**
+ * The channels logged for every wheel, in the order they are added to a
+ * session (see LoggingPlugin::CreateLoggingSession).
+ */
+extern const WheelChannel kWheelChannelDefinitions[kWheelChannels];
+
+/**
+ * Samples the four wheels of a TelemInfoV2. The data buffers of the wheel
+ * channels are looked up once, when the sampler is attached, rather than
+ * by name on every sample. Every wheel of a channel has its own buffer, so
+ * each value is written on its own.
+ */
+class WheelSampler
+{
+public:
+  /**
+   * Default constructor.
+   */
+  WheelSampler();
+
+  /**
+   * Looks up the wheel channels of a session. The session must outlive
+   * the call to Detach() and the channels must not be removed.
+   *
+   * @param session The session (with every wheel channel added).
+   * @throws const char* If a wheel channel does not exist.
+   */
+  void Attach(OpenMotorsport::Session& session);
+
+  /**
+   * Forgets the attached session.
+   */
+  void Detach();
+
+  /**
+   * Writes a sample of every wheel channel.
+   *
+   * @param wheels The four wheels (front left, front right, rear left,
+   * rear right).
+   */
+  void Sample(const TelemWheelV2* wheels);
+
+private:
+  float mScales[kWheelFields];
+  OpenMotorsport::DataBuffer* mBuffers[kWheelChannels][4];
+  bool mAttached;
+};
+
+#endif /* WHEELSAMPLER_HPP */